@@ -0,0 +1,32 @@
+#pragma once
+#ifndef __CUDAALLOCATIONS_H__
+#define __CUDAALLOCATIONS_H__
+
+#include "DeviceAllocations.h"
+#include "cuda_runtime_api.h"
+
+// cudaMalloc and cudaMallocHost that count successful allocations in DeviceAllocations. Use these instead of the
+// plain calls, otherwise an allocation in the frame path goes unnoticed.
+template <typename T>
+inline cudaError_t countedCudaMalloc(T **pointer, size_t bytes)
+{
+    const cudaError_t result = cudaMalloc(reinterpret_cast<void **>(pointer), bytes);
+    if (result == cudaSuccess)
+    {
+        DeviceAllocations::record();
+    }
+    return result;
+}
+
+template <typename T>
+inline cudaError_t countedCudaMallocHost(T **pointer, size_t bytes)
+{
+    const cudaError_t result = cudaMallocHost(reinterpret_cast<void **>(pointer), bytes);
+    if (result == cudaSuccess)
+    {
+        DeviceAllocations::record();
+    }
+    return result;
+}
+
+#endif // __CUDAALLOCATIONS_H__
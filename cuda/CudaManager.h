@@ -8,7 +8,12 @@
 #include "Texture.h"
 #include <functional>
 #include <string>
-#include "TensorRTManager.h"
+#include "InferenceEngineFactory.h"
+#include "CudaAllocations.h"
+#include "Options.h"
+#include "Benchmark.h"
+#include "MemoryReport.h"
+#include "PreprocessPass.h"
 class CudaManager
 {
     VulkanData vulkanData;
@@ -18,59 +23,326 @@ class CudaManager
 
     cudaTextureObject_t textureObjMipMapInput_ = 0;
     std::vector<cudaTextureObject_t> textureObjMipMaps;
+    // Per texture: the imported Vulkan image. The texture object samples the mapped array itself, so whatever Vulkan
+    // last wrote to the image is what CUDA reads once the frame's semaphore wait has passed.
+    struct ImportedTexture
+    {
+        cudaExternalMemory_t memory = nullptr;
+        cudaMipmappedArray_t mapped = nullptr; // The Vulkan image's memory as a CUDA array
+        size_t importedBytes = 0;
+    };
+    std::vector<ImportedTexture> imports;
 
     cudaExternalSemaphore_t cudaExtCudaUpdateVkSemaphore;
     cudaExternalSemaphore_t cudaExtVkUpdateCudaSemaphore;
 
-    VkSemaphore cudaUpdateVkSemaphore, vkUpdateCudaSemaphore;
+    VkSemaphore cudaUpdateVkSemaphore = VK_NULL_HANDLE, vkUpdateCudaSemaphore = VK_NULL_HANDLE;
+
+    // With timeline semaphores both sides count frames: the Vulkan frame submitted before cudaUpdateVkImage() signals
+    // vkUpdateCuda with frameValue(), the CUDA work waits for that value and signals cudaUpdateVk with it. Both only
+    // read the textures, so a Vulkan frame does not need the previous CUDA frame; it only keeps CUDA from falling more
+    // than kMaxCudaLag frames behind.
+    bool timelineSync = false;
+    static constexpr uint64_t kMaxCudaLag = 2;
+
+    // With the Vulkan preprocessing pass each frame writes its sample into slot frameValue() % kInputSlots of the input
+    // tensor. The previous frame on that slot is the last one frame N's semaphore wait covers (N - kMaxCudaLag - 1 on
+    // timelines, N - 1 with binary semaphores), so CUDA is done reading a slot before Vulkan writes it again.
+    static constexpr uint32_t kInputSlots = kMaxCudaLag + 1;
+    // Slots start on TensorRT's 256-byte tensor address alignment.
+    static constexpr VkDeviceSize kInputSlotBytes = (kMnistSize * kMnistSize * sizeof(float) + 255) / 256 * 256;
 
 private:
-    std::unique_ptr<TensorRTManager> tensorRTManager = nullptr;
+    std::unique_ptr<InferenceEngine> inferenceEngine = nullptr;
+    // The network input, shared with Vulkan: an exportable VkBuffer that CUDA imports once and maps into its address
+    // space. Device engines read it as their input tensor; for host engines the sample is copied out of it after the
+    // kernels.
+    struct SharedTensor
+    {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkDeviceSize size = 0;
+        cudaExternalMemory_t import = nullptr;
+        float *data = nullptr; // CUDA address of the buffer
+    } inputTensor;
+
+    // One executable graph per texture: semaphore wait, preprocessing kernel, enqueueV3 and semaphore signal only
+    // differ in the texture object, so each sequence is captured once and replayed with cudaGraphLaunch.
+    std::vector<cudaGraphExec_t> frameGraphs;
+    bool graphsSupported = true;
+    size_t framesSubmitted = 0;
+    uint64_t inferencesCompleted = 0;
+    uint64_t framesSkipped = 0; // Frames whose inference request could not start, counted in framesSubmitted
+
+    // Set when there is no CUDA device sharing memory with the Vulkan one (software Vulkan drivers, machines without
+    // a GPU, --cuda-interop=0). Textures are then plain Vulkan images, the preprocessing runs on the CPU from the loaded
+    // pixels and only host engines can be used.
+    bool hostPipeline = false;
+    std::vector<float> hostWork;
+    // --preprocess=vulkan with interop: the Vulkan frame runs PreprocessPass into the input tensor and the CUDA work
+    // of a frame is only the network.
+    bool vulkanPreprocess = false;
+
+    // Running average of the CPU time spent issuing a frame's CUDA work, indexed by eager (0) / graph (1).
+    double submitMsTotal[2] = {0.0, 0.0};
+    size_t submitFrames[2] = {0, 0};
+#ifdef ENABLE_BENCHMARKS
+    bool benchmarkRestoreGraphs = false;
+#endif
 
 public:
     // Texture texture{};
     cudaStream_t stream;
     std::vector<Texture> textures;
 
-    int getDetection() const { return tensorRTManager->getPrediction(); }
+    int getDetection() const { return inferenceEngine->getPrediction(); }
+    const char *getInferenceEngineName() const { return inferenceEngine->name(); }
+    //! CUDA allocations of the whole process so far, see DeviceAllocations.
+    size_t getDeviceAllocationCount() const { return DeviceAllocations::count(); }
+    double getInferenceLatencyMs() const { return inferenceEngine->getLastLatencyMs(); }
+    float getInferenceGpuMs() const { return inferenceEngine->getLastGpuMs(); }
+    bool useCudaGraphs = Options::settings().cudaGraphs;
+    bool cudaGraphsActive() const { return useCudaGraphs && graphsSupported && inferenceEngine->supportsGraphCapture(); }
+    double getSubmitMs(bool graphs) const { return submitFrames[graphs] ? submitMsTotal[graphs] / submitFrames[graphs] : 0.0; }
+    uint64_t getInferencesCompleted() const { return inferencesCompleted; }
+    uint64_t getInferencesSubmitted() const { return framesSubmitted - framesSkipped; }
+    bool usesHostPipeline() const { return hostPipeline; }
+    bool usesTimelineSemaphores() const { return timelineSync; }
+    bool usesVulkanPreprocess() const { return vulkanPreprocess; }
+    const MnistPreprocessConfig &preprocessConfig() const { return vulkanImageCuda.preprocess; }
+    VkBuffer inputTensorBuffer() const { return inputTensor.buffer; }
+    VkDeviceSize inputTensorSize() const { return inputTensor.size; }
+    // First float of the sample the next cudaUpdateVkImage() hands to the network.
+    uint32_t inputSlotOffset() const
+    {
+        return vulkanPreprocess ? uint32_t(frameValue() % kInputSlots * (kInputSlotBytes / sizeof(float))) : 0;
+    }
+    // How many frames the CUDA work may still trail the newest Vulkan frame that has completed: once Vulkan frame N
+    // has finished, CUDA is done with every frame up to N - maxCudaLag().
+    uint64_t maxCudaLag() const { return hostPipeline ? 0 : timelineSync ? kMaxCudaLag + 1 : 1; }
+    // Timeline value of the frame the next cudaUpdateVkImage() call issues.
+    uint64_t frameValue() const { return framesSubmitted + 1; }
+
+    // Blocks the calling thread until the CUDA work of frame `value` (1-based) has finished, without touching either
+    // queue. Returns false on timeout, or when the semaphores are not timelines.
+    bool waitForCudaFrame(uint64_t value, uint64_t timeoutNs) const
+    {
+        if (!timelineSync)
+            return false;
+        VkSemaphoreWaitInfo waitInfo{};
+        waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores = &cudaUpdateVkSemaphore;
+        waitInfo.pValues = &value;
+        return vkWaitSemaphores(vulkanData.device, &waitInfo, timeoutNs) == VK_SUCCESS;
+    }
+
+    // Adds the texture pixels kept on the host, the imported Vulkan memory and CUDA's own buffers.
+    void addMemoryUsage(MemoryReport &report) const
+    {
+        for (const Texture &texture : textures)
+        {
+            report.hostBytes += texture.hostPixelBytes();
+        }
+        for (const ImportedTexture &imported : imports)
+        {
+            if (imported.memory)
+            {
+                report.externalImports++;
+                report.externalBytes += imported.importedBytes;
+            }
+        }
+        if (inputTensor.import)
+        {
+            report.externalImports++;
+            report.externalBytes += inputTensor.size;
+        }
+    }
+
+    // Blocks until every queued request has finished, so the counters above agree.
+    void finishInference()
+    {
+        if (timelineSync && framesSubmitted > 0)
+        {
+            waitForCudaFrame(framesSubmitted, UINT64_MAX);
+        }
+        inferenceEngine->finish(stream);
+        inferencesCompleted = framesSubmitted - framesSkipped;
+    }
     CudaManager(VulkanData vulkandata, uint32_t imageCount)
         : vulkanData(vulkandata),
           stream(0),
           vulkanImageCuda(1)
     {
+        inferenceEngine = InferenceEngineFactory::create(Options::settings().engine);
+        if (!inferenceEngine)
+        {
+            printf("Error: unknown inference engine %s\n", Options::settings().engine.c_str());
+            exit(EXIT_FAILURE);
+        }
+
         int cuda_device = -1;
-        // This tell cuda which Vulkan device to use. Both Vulkan and CUDA should use the same device.
-        cuda_device = vulkanImageCuda.initCuda(vulkanData.vkDeviceUUID, VK_UUID_SIZE);
+        int cudaDeviceCount = 0;
+        if (Options::settings().cudaInterop && vulkanData.externalMemory && cudaGetDeviceCount(&cudaDeviceCount) == cudaSuccess && cudaDeviceCount > 0)
+        {
+            // This tell cuda which Vulkan device to use. Both Vulkan and CUDA should use the same device.
+            cuda_device = vulkanImageCuda.initCuda(vulkanData.vkDeviceUUID, VK_UUID_SIZE);
+        }
+        cudaGetLastError();
         if (cuda_device == -1)
         {
-            printf("Error: No CUDA-Vulkan interop capable device found\n");
+            if (inferenceEngine->inputLocation() != InferenceEngine::InputLocation::kHost)
+            {
+                printf("Error: No CUDA-Vulkan interop capable device found, and the %s engine needs one\n", inferenceEngine->name());
+                exit(EXIT_FAILURE);
+            }
+            std::cout << "No CUDA-Vulkan interop, preprocessing on the CPU" << std::endl;
+            hostPipeline = true;
+            hostWork.resize(kMnistWorkSize * kMnistWorkSize);
+        }
+        else
+        {
+            // A Cuda stream is a sequence of operations that execute in order on the device.
+            // The default stream is a special stream that is created by default and is used for all operations that do not specify a stream.
+            // The default stream is also known as the "null stream" or "stream 0".
+            // The default stream is not a real stream, but rather a special case that allows for easier programming.
+            checkCudaErrors(cudaStreamCreate(&stream));
+        }
+
+        vulkanImageCuda.preprocess.enabled = Options::settings().mnistFit;
+        vulkanImageCuda.preprocess.invert = Options::settings().mnistInvert;
+        vulkanImageCuda.preprocess.normalize = Options::settings().mnistNormalize;
+
+        const std::string &preprocess = Options::settings().preprocess;
+        if (preprocess != "cuda" && preprocess != "vulkan")
+        {
+            printf("Error: unknown preprocessing %s, expected cuda or vulkan\n", preprocess.c_str());
             exit(EXIT_FAILURE);
         }
-        // A Cuda stream is a sequence of operations that execute in order on the device.
-        // The default stream is a special stream that is created by default and is used for all operations that do not specify a stream.
-        // The default stream is also known as the "null stream" or "stream 0".
-        // The default stream is not a real stream, but rather a special case that allows for easier programming.
-        checkCudaErrors(cudaStreamCreate(&stream));
+        if (preprocess == "vulkan" && !hostPipeline)
+        {
+            vulkanPreprocess = PreprocessPass::shaderAvailable();
+            if (!vulkanPreprocess)
+            {
+                std::cout << PreprocessPass::kShaderFile << " not found, preprocessing with CUDA" << std::endl;
+            }
+        }
+        // The renderer checks the compute pass against the CPU reference on the loaded pixels, then drops them.
+        const bool keepPixels = hostPipeline || vulkanPreprocess;
 
         textures.resize(imageCount);
         textureObjMipMaps.resize(imageCount);
+        imports.resize(imageCount);
+        // Graphs are per texture, or per input slot when the frame's texture no longer appears in the CUDA work.
+        frameGraphs.resize(std::max<size_t>(imageCount, kInputSlots), nullptr);
+        std::vector<std::string> texturePaths;
+        for (int i = 0; i < imageCount; ++i)
+        {
+            texturePaths.push_back("textures/digit_rgba" + std::to_string(i) + ".ppm");
+        }
+        {
+            ThreadPool decodePool;
+            auto tLoad = Benchmark::Clock::now();
+            // The host pipeline never imports the textures, so their memory is not exported, but it preprocesses from
+            // host copies of the pixels. Otherwise nothing on the host outlives the decode into the staging ring.
+            Texture::loadImageData(textures, texturePaths, vulkanData, !hostPipeline, keepPixels, decodePool);
+            std::cout << "Texture decode: " << imageCount << " images in " << Benchmark::elapsedMs(tLoad) << " ms on "
+                      << decodePool.size() << " threads" << std::endl;
+#ifdef ENABLE_BENCHMARKS
+            benchmarkTextureDecode(texturePaths, decodePool);
+#endif
+        }
+        // All uploads go out in as few submissions as the staging ring needs, and CUDA reads the pixels right away.
+        vulkanData.stagingRing->finish();
+        if (hostPipeline)
+        {
+            loadEngine();
+            return;
+        }
         for (int i = 0; i < imageCount; ++i)
         {
-            textures[i].loadImageData("textures/digit_rgba" +std::to_string(i) + ".ppm", vulkanData, textureObjMipMaps[i],
-                                      [this](unsigned int mipLevels, unsigned int imageWidth, unsigned int imageHeight, size_t totalImageMemSize, VkDeviceMemory &textureImageMemory, cudaTextureObject_t &textureObjMipMapInput)
-                                      {
-                                          this->cudaVkImportImageMem(mipLevels, imageWidth, imageHeight, totalImageMemSize, textureImageMemory, textureObjMipMapInput);
-                                      });
+            cudaVkImportImageMem(textures[i].mipLevels, textures[i].width, textures[i].height, textures[i].totalImageMemSize, textures[i].memory, textureObjMipMaps[i],
+                                 imports[i]);
         }
 
+#ifndef NDEBUG
+        // Debug builds check the preprocessing kernels against the CPU reference on every texture. The tolerance covers
+        // the different summation order of the GPU reductions.
+        constexpr float kParityTolerance = 1e-3f;
+        for (int i = 0; i < imageCount; ++i)
+        {
+            float maxError = vulkanImageCuda.checkParity(textures[i].width, textures[i].height, textureObjMipMaps[i], stream);
+            if (maxError > kParityTolerance)
+            {
+                std::cerr << "Downsample kernel differs from the CPU reference on texture " << i << ": max error " << maxError << std::endl;
+            }
+            assert(maxError <= kParityTolerance);
+        }
+#endif
+        timelineSync = vulkanData.timelineSemaphores;
         createSyncObjectsExt();
         cudaVkImportSemaphore();
 
-        tensorRTManager = std::make_unique<TensorRTManager>(stream);
+        loadEngine();
+        createInputTensor(vulkanPreprocess ? kInputSlots : 1);
+        if (inferenceEngine->inputLocation() == InferenceEngine::InputLocation::kDevice &&
+            !inferenceEngine->bindInputBuffer(inputTensor.data, 1))
+        {
+            std::cout << "The " << inferenceEngine->name() << " engine keeps its own input buffer" << std::endl;
+            // Nothing would carry the sample Vulkan writes into that buffer.
+            if (vulkanPreprocess)
+            {
+                std::cout << "Preprocessing with CUDA" << std::endl;
+                vulkanPreprocess = false;
+            }
+        }
+        if (vulkanPreprocess)
+        {
+            std::cout << "Preprocessing in a Vulkan compute pass, " << kInputSlots << " input slots" << std::endl;
+        }
+    }
+
+    void loadEngine()
+    {
+        if (!inferenceEngine->load() || !inferenceEngine->warmup(stream))
+        {
+            printf("Error: could not initialize the %s inference engine\n", Options::settings().engine.c_str());
+            exit(EXIT_FAILURE);
+        }
+        std::cout << "Inference engine: " << inferenceEngine->name() << std::endl;
     }
 
     ~CudaManager()
     {
+        if (inferenceEngine)
+        {
+            inferenceEngine->finish(stream);
+        }
+        if (inputTensor.import)
+        {
+            cudaFree(inputTensor.data);
+            cudaDestroyExternalMemory(inputTensor.import);
+        }
+        vkDestroyBuffer(vulkanData.device, inputTensor.buffer, nullptr);
+        vkFreeMemory(vulkanData.device, inputTensor.memory, nullptr);
+        for (cudaGraphExec_t graphExec : frameGraphs)
+        {
+            if (graphExec)
+                cudaGraphExecDestroy(graphExec);
+        }
+        for (size_t i = 0; i < imports.size(); ++i)
+        {
+            if (!imports[i].memory)
+                continue;
+            cudaDestroyTextureObject(textureObjMipMaps[i]);
+            cudaFreeMipmappedArray(imports[i].mapped);
+            cudaDestroyExternalMemory(imports[i].memory);
+        }
+        if (!hostPipeline)
+        {
+            cudaDestroyExternalSemaphore(cudaExtCudaUpdateVkSemaphore);
+            cudaDestroyExternalSemaphore(cudaExtVkUpdateCudaSemaphore);
+        }
 
         vkDestroySemaphore(vulkanData.device, cudaUpdateVkSemaphore, nullptr);
         vkDestroySemaphore(vulkanData.device, vkUpdateCudaSemaphore, nullptr);
@@ -80,10 +352,11 @@ public:
     void init()
     {
     }
-    void cudaVkImportImageMem(unsigned int mipLevels, unsigned int imageWidth, unsigned int imageHeight, size_t totalImageMemSize, VkDeviceMemory &textureImageMemory, cudaTextureObject_t &textureObjMipMapInput)
+    void cudaVkImportImageMem(unsigned int mipLevels, unsigned int imageWidth, unsigned int imageHeight, size_t totalImageMemSize, VkDeviceMemory &textureImageMemory, cudaTextureObject_t &textureObjMipMapInput,
+                              ImportedTexture &imported)
     {
-        cudaExternalMemory_t cudaExtMemImageBuffer;
-        cudaMipmappedArray_t cudaMipmappedImageArray, cudaMipmappedImageArrayTemp, cudaMipmappedImageArrayOrig;
+        cudaExternalMemory_t &cudaExtMemImageBuffer = imported.memory;
+        cudaMipmappedArray_t &cudaMipmappedImageArray = imported.mapped;
         // Describes a memory resource that cuda will import
         cudaExternalMemoryHandleDesc cudaExtMemHandleDesc;
 
@@ -121,39 +394,16 @@ public:
         // This maps the Vulkan image memory into a CUDA mipmapped array.
         checkCudaErrors(cudaExternalMemoryGetMappedMipmappedArray(
             &cudaMipmappedImageArray, cudaExtMemImageBuffer, &externalMemoryMipmappedArrayDesc));
-        // Allocates two mipmapped arrays for the CUDA kernel to use.
-
-        checkCudaErrors(cudaMallocMipmappedArray(&cudaMipmappedImageArrayTemp, &formatDesc, extent, mipLevels));
-        checkCudaErrors(cudaMallocMipmappedArray(&cudaMipmappedImageArrayOrig, &formatDesc, extent, mipLevels));
-
-        for (int mipLevelIdx = 0; mipLevelIdx < mipLevels; mipLevelIdx++)
-        {
-            cudaArray_t cudaMipLevelArray, cudaMipLevelArrayTemp, cudaMipLevelArrayOrig;
-
-            checkCudaErrors(cudaGetMipmappedArrayLevel(&cudaMipLevelArray, cudaMipmappedImageArray, mipLevelIdx));
-            checkCudaErrors(
-                cudaGetMipmappedArrayLevel(&cudaMipLevelArrayTemp, cudaMipmappedImageArrayTemp, mipLevelIdx));
-            checkCudaErrors(
-                cudaGetMipmappedArrayLevel(&cudaMipLevelArrayOrig, cudaMipmappedImageArrayOrig, mipLevelIdx));
-
-            uint32_t width = (imageWidth >> mipLevelIdx) ? (imageWidth >> mipLevelIdx) : 1;
-            uint32_t height = (imageHeight >> mipLevelIdx) ? (imageHeight >> mipLevelIdx) : 1;
-            checkCudaErrors(cudaMemcpy2DArrayToArray(cudaMipLevelArrayOrig,
-                                                     0,
-                                                     0,
-                                                     cudaMipLevelArray,
-                                                     0,
-                                                     0,
-                                                     width * sizeof(uchar4),
-                                                     height,
-                                                     cudaMemcpyDeviceToDevice));
-        }
+        imported.importedBytes = totalImageMemSize;
 
+        // The texture object reads the imported memory directly: no private copy, and nothing runs at import time.
+        // CUDA only ever reads the image while Vulkan holds it in SHADER_READ_ONLY_OPTIMAL, between the semaphore
+        // operations that order the two APIs.
         cudaResourceDesc resDescr;
         memset(&resDescr, 0, sizeof(cudaResourceDesc));
 
         resDescr.resType = cudaResourceTypeMipmappedArray;
-        resDescr.res.mipmap.mipmap = cudaMipmappedImageArrayOrig;
+        resDescr.res.mipmap.mipmap = cudaMipmappedImageArray;
 
         cudaTextureDesc texDescr;
         memset(&texDescr, 0, sizeof(cudaTextureDesc));
@@ -173,33 +423,302 @@ public:
 
         printf("CUDA Kernel Vulkan image buffer\n");
     }
+
+    // Creates the shared input buffer for `samples` network inputs, kInputSlotBytes apart, and maps it into CUDA. The
+    // buffer has a memory allocation of its own, so the exported handle covers exactly this buffer.
+    void createInputTensor(uint32_t samples)
+    {
+        inputTensor.size = VkDeviceSize(samples) * kInputSlotBytes;
+        createExternalBuffer(inputTensor.size,
+                             VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT, inputTensor.buffer,
+                             inputTensor.memory, vulkanData);
+        VkMemoryRequirements requirements;
+        vkGetBufferMemoryRequirements(vulkanData.device, inputTensor.buffer, &requirements);
+
+        cudaExternalMemoryHandleDesc handleDesc;
+        memset(&handleDesc, 0, sizeof(handleDesc));
+        handleDesc.type = cudaExternalMemoryHandleTypeOpaqueFd;
+        handleDesc.handle.fd = (int)(uintptr_t)getMemHandle(inputTensor.memory, VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT_KHR, vulkanData);
+        handleDesc.size = requirements.size; // The whole allocation, as createExternalBuffer() sized it
+        checkCudaErrors(cudaImportExternalMemory(&inputTensor.import, &handleDesc));
+
+        cudaExternalMemoryBufferDesc bufferDesc;
+        memset(&bufferDesc, 0, sizeof(bufferDesc));
+        bufferDesc.offset = 0;
+        bufferDesc.size = inputTensor.size;
+        checkCudaErrors(cudaExternalMemoryGetMappedBuffer(reinterpret_cast<void **>(&inputTensor.data), inputTensor.import, &bufferDesc));
+        printf("CUDA imported Vulkan input tensor buffer, %u samples\n", samples);
+    }
+
+    // Replaces the pixels of texture imageIndex in place; the image, its import and its texture object are reused.
+    // The upload is recorded into the staging ring and has to be submitted before the next Vulkan frame, whose
+    // semaphore signal then orders it before the CUDA work of that frame.
+    void updateTexture(uint32_t imageIndex, const unsigned char *pixels)
+    {
+        textures[imageIndex].updateImageData(pixels);
+    }
     void cudaUpdateVkImage(uint32_t imageIndex)
     {
-        cudaVkSemaphoreWait(cudaExtVkUpdateCudaSemaphore);
-        float *d_mnistInput;
-        cudaMalloc(&d_mnistInput, 28 * 28 * sizeof(float));
+        if (hostPipeline)
+        {
+            hostFrameWork(imageIndex);
+            return;
+        }
+#ifdef ENABLE_BENCHMARKS
+        benchmarkSubmitModes();
+#endif
+        auto tSubmit = Benchmark::Clock::now();
+        bool graphs = cudaGraphsActive();
+        if (!inferenceEngine->beginRequest(1, stream))
+        {
+            // Vulkan still waits for this frame's signal.
+            cudaVkSemaphoreWait(cudaExtVkUpdateCudaSemaphore, frameValue());
+            cudaVkSemaphoreSignal(cudaExtCudaUpdateVkSemaphore, frameValue());
+            skipFrame();
+            return;
+        }
+        // The network reads the slot this frame's compute pass wrote.
+        if (vulkanPreprocess && inferenceEngine->inputLocation() == InferenceEngine::InputLocation::kDevice)
+        {
+            inferenceEngine->bindInputBuffer(inputSample(), 1);
+        }
+        const uint32_t graphIndex = vulkanPreprocess ? uint32_t(frameValue() % kInputSlots) : imageIndex;
+
+        // TensorRT has to have run once with the current shapes before enqueueV3 may be captured, so the very first
+        // frame always goes through the eager path.
+        if (graphs && frameGraphs[graphIndex] == nullptr && framesSubmitted > 0)
+        {
+            frameGraphs[graphIndex] = captureFrameGraph(imageIndex);
+            if (frameGraphs[graphIndex] == nullptr)
+            {
+                std::cerr << "CUDA graph capture is not supported for this frame sequence, falling back to eager submission" << std::endl;
+                graphsSupported = false;
+                graphs = false;
+            }
+        }
+
+        if (graphs && frameGraphs[graphIndex] != nullptr)
+        {
+            // Timeline values change every frame, so the semaphore operations stay outside the graph.
+            if (timelineSync)
+                cudaVkSemaphoreWait(cudaExtVkUpdateCudaSemaphore, frameValue());
+            checkCudaErrors(cudaGraphLaunch(frameGraphs[graphIndex], stream));
+            if (timelineSync)
+                cudaVkSemaphoreSignal(cudaExtCudaUpdateVkSemaphore, frameValue());
+        }
+        else
+        {
+            graphs = false;
+            issueFrameWork(imageIndex);
+        }
+
+        // Inference runs ahead of the render thread: this frame's request is queued and whatever finished since the
+        // last frame becomes the displayed prediction.
+        inferenceEngine->completeRequest(stream);
+        inferencesCompleted += inferenceEngine->poll();
+
+        submitMsTotal[graphs] += Benchmark::elapsedMs(tSubmit);
+        submitFrames[graphs]++;
+        framesSubmitted++;
+    }
+
+    // Frame work of the host pipeline. updateTexture() keeps the loaded pixels in step with the image, so they are exactly
+    // what the GPU samples.
+    void hostFrameWork(uint32_t imageIndex)
+    {
+        auto tSubmit = Benchmark::Clock::now();
+        const Texture &texture = textures[imageIndex];
+        if (!inferenceEngine->beginRequest(1, stream))
+        {
+            skipFrame();
+            return;
+        }
+        mnistPreprocessHost(reinterpret_cast<const unsigned char *>(texture.image_data), texture.width, texture.height,
+                            vulkanImageCuda.preprocess, hostWork.data(), inferenceEngine->inputBuffer());
+        inferenceEngine->enqueueNetwork(stream);
+        inferenceEngine->completeRequest(stream);
+        inferencesCompleted += inferenceEngine->poll();
+
+        submitMsTotal[0] += Benchmark::elapsedMs(tSubmit);
+        submitFrames[0]++;
+        framesSubmitted++;
+    }
+
+    // The frame goes on without a prediction. Only the first failure and every 1000th after it are logged, as a
+    // backend that cannot take requests fails on every frame.
+    void skipFrame()
+    {
+        if (framesSkipped % 1000 == 0)
+        {
+            printf("Error: the %s inference engine could not start a request, skipping frame %zu (%llu skipped so far)\n",
+                   inferenceEngine->name(), framesSubmitted, (unsigned long long)framesSkipped + 1);
+        }
+        framesSkipped++;
+        framesSubmitted++;
+    }
+
+    // The fixed per-frame sequence. Vulkan only waits for the signal, the scores are copied out after it.
+    void issueFrameWork(uint32_t imageIndex)
+    {
+        const bool deviceInput = inferenceEngine->inputLocation() == InferenceEngine::InputLocation::kDevice;
+        cudaVkSemaphoreWait(cudaExtVkUpdateCudaSemaphore, frameValue());
+
+        // For device engines the preprocessing kernel writes straight into the input tensor bound to the TensorRT context.
+        // With vulkanPreprocess the Vulkan frame the wait stands for has already written the sample.
+        if (!vulkanPreprocess)
+        {
+            vulkanImageCuda.updateCuda(textures[imageIndex].width, textures[imageIndex].height, networkInput(), textureObjMipMaps[imageIndex], stream);
+        }
+        if (deviceInput)
+        {
+            inferenceEngine->enqueueNetwork(stream);
+        }
+
+        cudaVkSemaphoreSignal(cudaExtCudaUpdateVkSemaphore, frameValue());
+
+        // Host engines run on this thread, so the sample has to have arrived before they start.
+        if (!deviceInput)
+        {
+            checkCudaErrors(cudaMemcpyAsync(inferenceEngine->inputBuffer(), inputSample(), kMnistSize * kMnistSize * sizeof(float), cudaMemcpyDeviceToHost, stream));
+            checkCudaErrors(cudaStreamSynchronize(stream));
+            inferenceEngine->enqueueNetwork(stream);
+        }
+    }
 
-        vulkanImageCuda.updateCuda(textures[imageIndex].width, textures[imageIndex].height, d_mnistInput, textureObjMipMaps[imageIndex], stream);
+    float *networkInput()
+    {
+        // A device engine bound to the shared buffer hands it back as its input buffer.
+        return inferenceEngine->inputLocation() == InferenceEngine::InputLocation::kDevice ? inferenceEngine->inputBuffer() : inputSample();
+    }
+
+    // CUDA address of the sample of the frame being issued.
+    float *inputSample() { return inputTensor.data + inputSlotOffset(); }
+
+    // Captures issueFrameWork() for one texture (one input slot with vulkanPreprocess), minus the semaphore operations
+    // on timelines. Errors are not fatal here: drivers that cannot capture external semaphore operations, or a TensorRT
+    // engine that cannot be captured, make this return nullptr.
+    cudaGraphExec_t captureFrameGraph(uint32_t imageIndex)
+    {
+        cudaGraph_t graph = nullptr;
+        cudaGraphExec_t graphExec = nullptr;
+        if (cudaStreamBeginCapture(stream, cudaStreamCaptureModeThreadLocal) != cudaSuccess)
+        {
+            cudaGetLastError();
+            return nullptr;
+        }
+
+        cudaExternalSemaphoreWaitParams waitParams;
+        memset(&waitParams, 0, sizeof(waitParams));
+        cudaExternalSemaphoreSignalParams signalParams;
+        memset(&signalParams, 0, sizeof(signalParams));
 
-        tensorRTManager->infer(d_mnistInput, stream);
+        bool recorded = timelineSync || cudaWaitExternalSemaphoresAsync(&cudaExtVkUpdateCudaSemaphore, &waitParams, 1, stream) == cudaSuccess;
+        if (recorded)
+        {
+            if (!vulkanPreprocess)
+            {
+                vulkanImageCuda.updateCuda(textures[imageIndex].width, textures[imageIndex].height, networkInput(), textureObjMipMaps[imageIndex], stream);
+            }
+            recorded = inferenceEngine->enqueueNetwork(stream);
+        }
+        recorded = recorded && (timelineSync || cudaSignalExternalSemaphoresAsync(&cudaExtCudaUpdateVkSemaphore, &signalParams, 1, stream) == cudaSuccess);
 
-        cudaVkSemaphoreSignal(cudaExtCudaUpdateVkSemaphore);
+        if (cudaStreamEndCapture(stream, &graph) == cudaSuccess && recorded && graph != nullptr)
+        {
+            if (cudaGraphInstantiate(&graphExec, graph, 0) != cudaSuccess)
+            {
+                graphExec = nullptr;
+            }
+        }
+        if (graph != nullptr)
+        {
+            cudaGraphDestroy(graph);
+        }
+        // A failed capture leaves a sticky error behind, clear it so the eager path starts clean.
+        cudaGetLastError();
+        return graphExec;
     }
-    void cudaVkSemaphoreSignal(cudaExternalSemaphore_t &extSemaphore)
+
+#ifdef ENABLE_BENCHMARKS
+    // CPU cost of getting the startup textures into memory: the serial sdkLoadPPM4 path the textures used to load
+    // through against the mapped loader on the pool. Both decode into host memory from a warm page cache.
+    void benchmarkTextureDecode(const std::vector<std::string> &paths, ThreadPool &pool)
+    {
+        std::vector<std::string> resolved;
+        for (const std::string &path : paths)
+        {
+            char *found = sdkFindFilePath(path.c_str(), "");
+            resolved.push_back(found ? found : path);
+            free(found);
+        }
+
+        auto tStart = Benchmark::Clock::now();
+        for (const std::string &path : resolved)
+        {
+            unsigned char *pixels = nullptr;
+            unsigned int w = 0, h = 0;
+            sdkLoadPPM4(path.c_str(), &pixels, &w, &h);
+            free(pixels);
+        }
+        const double serialMs = Benchmark::elapsedMs(tStart);
+
+        tStart = Benchmark::Clock::now();
+        std::vector<Pnm::Image> files(resolved.size());
+        std::vector<std::vector<unsigned char>> pixels(resolved.size());
+        for (size_t i = 0; i < resolved.size(); ++i)
+        {
+            std::string error;
+            if (!files[i].open(resolved[i], error))
+                continue;
+            pixels[i].resize(files[i].rgbaSize());
+            pool.enqueue([&file = files[i], &out = pixels[i]] { file.decodeRgba(out.data()); });
+        }
+        pool.wait();
+        const double parallelMs = Benchmark::elapsedMs(tStart);
+
+        std::cout << "[Benchmark] Texture decode of " << resolved.size() << " images: sdkLoadPPM4 " << serialMs
+                  << " ms serial, mapped loader " << parallelMs << " ms on " << pool.size() << " threads" << std::endl;
+    }
+
+    // Runs the first frames eagerly, the next ones from graphs, then prints both averages and restores the option.
+    void benchmarkSubmitModes()
+    {
+        constexpr size_t kFramesPerMode = 300;
+        if (framesSubmitted == 0)
+        {
+            benchmarkRestoreGraphs = useCudaGraphs;
+            useCudaGraphs = false;
+        }
+        else if (framesSubmitted == kFramesPerMode)
+        {
+            useCudaGraphs = true;
+        }
+        else if (framesSubmitted == 2 * kFramesPerMode)
+        {
+            std::cout << "[Benchmark] CPU submit per frame: eager " << getSubmitMs(false) * 1000.0 << " us, graph "
+                      << (submitFrames[1] ? std::to_string(getSubmitMs(true) * 1000.0) + " us" : std::string("unsupported"))
+                      << std::endl;
+            useCudaGraphs = benchmarkRestoreGraphs;
+        }
+    }
+#endif
+    // value is ignored by binary semaphores.
+    void cudaVkSemaphoreSignal(cudaExternalSemaphore_t &extSemaphore, uint64_t value)
     {
         cudaExternalSemaphoreSignalParams extSemaphoreSignalParams;
         memset(&extSemaphoreSignalParams, 0, sizeof(extSemaphoreSignalParams));
 
-        extSemaphoreSignalParams.params.fence.value = 0;
+        extSemaphoreSignalParams.params.fence.value = timelineSync ? value : 0;
         extSemaphoreSignalParams.flags = 0;
         checkCudaErrors(cudaSignalExternalSemaphoresAsync(&extSemaphore, &extSemaphoreSignalParams, 1, stream));
     }
 
-    void cudaVkSemaphoreWait(cudaExternalSemaphore_t &extSemaphore)
+    void cudaVkSemaphoreWait(cudaExternalSemaphore_t &extSemaphore, uint64_t value)
     {
         cudaExternalSemaphoreWaitParams extSemaphoreWaitParams;
         memset(&extSemaphoreWaitParams, 0, sizeof(extSemaphoreWaitParams));
-        extSemaphoreWaitParams.params.fence.value = 0;
+        extSemaphoreWaitParams.params.fence.value = timelineSync ? value : 0;
         extSemaphoreWaitParams.flags = 0;
         checkCudaErrors(cudaWaitExternalSemaphoresAsync(&extSemaphore, &extSemaphoreWaitParams, 1, stream));
     }
@@ -213,8 +732,11 @@ public:
         // 2. Clear the descriptor to ensure all fields are zeroed.
         memset(&externalSemaphoreHandleDesc, 0, sizeof(externalSemaphoreHandleDesc));
 
-        // 3. Set the type to indicate the handle is an opaque file descriptor (Linux-specific).
-        externalSemaphoreHandleDesc.type = cudaExternalSemaphoreHandleTypeOpaqueFd;
+        // 3. Set the type to indicate the handle is an opaque file descriptor (Linux-specific), of a timeline
+        //    semaphore when the device supports them.
+        const cudaExternalSemaphoreHandleType handleType =
+            timelineSync ? cudaExternalSemaphoreHandleTypeTimelineSemaphoreFd : cudaExternalSemaphoreHandleTypeOpaqueFd;
+        externalSemaphoreHandleDesc.type = handleType;
 
         // 4. Obtain a file descriptor for the Vulkan semaphore (cudaUpdateVkSemaphore) using Vulkan's external semaphore API.
         externalSemaphoreHandleDesc.handle.fd =
@@ -228,24 +750,44 @@ public:
 
         // 7. Repeat the process for the second semaphore (vkUpdateCudaSemaphore).
         memset(&externalSemaphoreHandleDesc, 0, sizeof(externalSemaphoreHandleDesc));
-        externalSemaphoreHandleDesc.type = cudaExternalSemaphoreHandleTypeOpaqueFd;
+        externalSemaphoreHandleDesc.type = handleType;
         externalSemaphoreHandleDesc.handle.fd =
             (int)(uintptr_t)getSemaphoreHandle(vkUpdateCudaSemaphore, VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_FD_BIT, vulkanData);
         externalSemaphoreHandleDesc.flags = 0;
         checkCudaErrors(cudaImportExternalSemaphore(&cudaExtVkUpdateCudaSemaphore, &externalSemaphoreHandleDesc));
 
         // 8. Print a message indicating success.
-        printf("CUDA Imported Vulkan semaphore\n");
+        printf("CUDA Imported Vulkan %s semaphore\n", timelineSync ? "timeline" : "binary");
     }
-    void getWaitFrameSemaphores(std::vector<VkSemaphore> &wait, std::vector<VkPipelineStageFlags> &waitStages) const
+    // Semaphores the next Vulkan frame waits on and signals. waitValues/signalValues run parallel to the semaphore
+    // lists and only matter for timeline semaphores.
+    void getWaitFrameSemaphores(std::vector<VkSemaphore> &wait, std::vector<VkPipelineStageFlags> &waitStages, std::vector<uint64_t> &waitValues) const
     {
+        if (hostPipeline)
+            return;
+        if (timelineSync)
+        {
+            if (frameValue() <= kMaxCudaLag + 1)
+                return;
+            waitValues.push_back(frameValue() - kMaxCudaLag - 1);
+        }
+        else
+        {
+            // A binary semaphore is only signalled once CUDA has run a frame.
+            if (framesSubmitted == 0)
+                return;
+            waitValues.push_back(0);
+        }
         wait.push_back(cudaUpdateVkSemaphore);
         waitStages.push_back(VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
     }
 
-    void getSignalFrameSemaphores(std::vector<VkSemaphore> &signal) const
+    void getSignalFrameSemaphores(std::vector<VkSemaphore> &signal, std::vector<uint64_t> &signalValues) const
     {
+        if (hostPipeline)
+            return;
         signal.push_back(vkUpdateCudaSemaphore);
+        signalValues.push_back(timelineSync ? frameValue() : 0);
     }
     // This function creates two Vulkan semaphores that are exportable to CUDA using an opaque file descriptor (FD).
     // These semaphores are used for synchronization between Vulkan and CUDA operations.
@@ -264,8 +806,12 @@ public:
         VkExportSemaphoreCreateInfoKHR vulkanExportSemaphoreCreateInfo = {};
         vulkanExportSemaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_EXPORT_SEMAPHORE_CREATE_INFO_KHR;
 
-        // 4. Set pNext to NULL (no further extension structures).
-        vulkanExportSemaphoreCreateInfo.pNext = NULL;
+        // 4. Chain the semaphore type when the semaphores are timelines; they start at 0, before the first frame.
+        VkSemaphoreTypeCreateInfo semaphoreTypeInfo = {};
+        semaphoreTypeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+        semaphoreTypeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+        semaphoreTypeInfo.initialValue = 0;
+        vulkanExportSemaphoreCreateInfo.pNext = timelineSync ? &semaphoreTypeInfo : NULL;
 
         // 5. Specify that the semaphore can be exported as an opaque file descriptor.
         vulkanExportSemaphoreCreateInfo.handleTypes = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_FD_BIT;
@@ -0,0 +1,185 @@
+#pragma once
+#ifndef __MNISTPREPROCESS_H__
+#define __MNISTPREPROCESS_H__
+
+// Math shared by the CUDA preprocessing kernels and their CPU reference. Everything here also compiles as plain C++,
+// so the reference can run on machines without a GPU.
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+#ifdef __CUDACC__
+#define MNIST_HD __host__ __device__
+#else
+#define MNIST_HD
+#endif
+
+constexpr int kMnistSize = 28;      // Network input edge
+constexpr int kMnistFitSize = 20;   // MNIST digits are fitted into a 20x20 box inside the 28x28 field
+constexpr int kMnistWorkSize = 112; // Edge of the grayscale image the bounding box and fit are computed on
+
+struct MnistPreprocessConfig
+{
+    bool enabled = true;     // false keeps the plain stretch of the whole frame to 28x28
+    bool invert = false;     // set for dark digits on a bright background
+    float threshold = 0.25f; // ink level that counts towards the bounding box
+    bool normalize = false;  // apply (x - mean) / stddev to the final image
+    float mean = 0.1307f;
+    float stddev = 0.3081f;
+};
+
+// Inclusive bounding box in work-image pixels. An empty image gives maxX < minX.
+struct MnistBox
+{
+    int minX, minY, maxX, maxY;
+};
+
+// First source texel of output bin i when `size` texels are split into `bins` bins. Every texel belongs to exactly one
+// bin, bins are 36 or 37 texels wide for a 1024 texel edge and 28 outputs.
+MNIST_HD inline int binStart(int i, int size, int bins)
+{
+    return (i * size + bins - 1) / bins;
+}
+
+MNIST_HD inline float toGray(float r, float g, float b)
+{
+    return 0.299f * r + 0.587f * g + 0.114f * b;
+}
+
+MNIST_HD inline float mnistInk(float value, const MnistPreprocessConfig &config)
+{
+    return config.invert ? 1.0f - value : value;
+}
+
+// Bilinear ink lookup at continuous pixel coordinates (pixel centres at +0.5). Outside the image there is no ink.
+MNIST_HD inline float sampleInk(const float *image, int width, int height, float x, float y, const MnistPreprocessConfig &config, bool applyInk)
+{
+    x -= 0.5f;
+    y -= 0.5f;
+    const int x0 = (int)floorf(x);
+    const int y0 = (int)floorf(y);
+    const float fx = x - x0;
+    const float fy = y - y0;
+
+    float taps[4];
+    for (int i = 0; i < 4; ++i)
+    {
+        const int xi = x0 + (i & 1);
+        const int yi = y0 + (i >> 1);
+        const bool inside = xi >= 0 && yi >= 0 && xi < width && yi < height;
+        const float value = inside ? image[yi * width + xi] : 0.0f;
+        taps[i] = inside && applyInk ? mnistInk(value, config) : value;
+    }
+    return (taps[0] * (1.0f - fx) + taps[1] * fx) * (1.0f - fy) + (taps[2] * (1.0f - fx) + taps[3] * fx) * fy;
+}
+
+// Pixel (x, y) of the 28x28 field with the bounding box scaled so its longer side spans 20 pixels and centred at
+// (14, 14). Each output pixel averages a 4x4 grid of taps across its footprint in the work image.
+MNIST_HD inline float fitPixel(const float *work, int size, const MnistBox &box, const MnistPreprocessConfig &config, int x, int y)
+{
+    if (box.maxX < box.minX || box.maxY < box.minY)
+    {
+        return 0.0f;
+    }
+    const int width = box.maxX - box.minX + 1;
+    const int height = box.maxY - box.minY + 1;
+    const float side = (float)(width > height ? width : height);
+    const float scale = kMnistFitSize / side; // output pixels per work pixel
+    const float centreX = (box.minX + box.maxX + 1) * 0.5f;
+    const float centreY = (box.minY + box.maxY + 1) * 0.5f;
+    const float wx = centreX + (x + 0.5f - kMnistSize * 0.5f) / scale;
+    const float wy = centreY + (y + 0.5f - kMnistSize * 0.5f) / scale;
+    const float step = 1.0f / (scale * 4.0f);
+
+    float sum = 0.0f;
+    for (int j = 0; j < 4; ++j)
+        for (int i = 0; i < 4; ++i)
+            sum += sampleInk(work, size, size, wx + (i - 1.5f) * step, wy + (j - 1.5f) * step, config, true);
+    return sum / 16.0f;
+}
+
+// Final value of pixel (x, y): the fitted image shifted so its centre of mass lands on (14, 14), then normalized.
+MNIST_HD inline float centrePixel(const float *fitted, float mass, float massX, float massY, const MnistPreprocessConfig &config, int x, int y)
+{
+    float dx = 0.0f, dy = 0.0f;
+    if (mass > 0.0f)
+    {
+        dx = massX / mass - kMnistSize * 0.5f;
+        dy = massY / mass - kMnistSize * 0.5f;
+    }
+    float value = sampleInk(fitted, kMnistSize, kMnistSize, x + 0.5f + dx, y + 0.5f + dy, config, false);
+    return config.normalize ? (value - config.mean) / config.stddev : value;
+}
+
+// CPU reference: area average of an RGBA8 image into an outWidth x outHeight grayscale image in [0, 1].
+inline void areaDownsampleReference(const unsigned char *rgba, int srcWidth, int srcHeight, float *out, int outWidth, int outHeight)
+{
+    for (int oy = 0; oy < outHeight; ++oy)
+    {
+        const int y0 = binStart(oy, srcHeight, outHeight), y1 = binStart(oy + 1, srcHeight, outHeight);
+        for (int ox = 0; ox < outWidth; ++ox)
+        {
+            const int x0 = binStart(ox, srcWidth, outWidth), x1 = binStart(ox + 1, srcWidth, outWidth);
+            double sum = 0.0;
+            for (int sy = y0; sy < y1; ++sy)
+            {
+                const unsigned char *row = rgba + (size_t(sy) * srcWidth) * 4;
+                for (int sx = x0; sx < x1; ++sx)
+                {
+                    const unsigned char *texel = row + sx * 4;
+                    sum += toGray(texel[0] / 255.0f, texel[1] / 255.0f, texel[2] / 255.0f);
+                }
+            }
+            out[oy * outWidth + ox] = float(sum / ((x1 - x0) * (y1 - y0)));
+        }
+    }
+}
+
+// CPU reference of the bounding box, fit and centre-of-mass stages on a size x size work image.
+inline void mnistPreprocessReference(const float *work, int size, const MnistPreprocessConfig &config, float *out)
+{
+    MnistBox box{size, size, -1, -1};
+    for (int y = 0; y < size; ++y)
+        for (int x = 0; x < size; ++x)
+            if (mnistInk(work[y * size + x], config) > config.threshold)
+            {
+                box.minX = std::min(box.minX, x);
+                box.minY = std::min(box.minY, y);
+                box.maxX = std::max(box.maxX, x);
+                box.maxY = std::max(box.maxY, y);
+            }
+
+    float fitted[kMnistSize * kMnistSize];
+    double mass = 0.0, massX = 0.0, massY = 0.0;
+    for (int y = 0; y < kMnistSize; ++y)
+        for (int x = 0; x < kMnistSize; ++x)
+        {
+            const float value = fitPixel(work, size, box, config, x, y);
+            fitted[y * kMnistSize + x] = value;
+            mass += value;
+            massX += value * (x + 0.5f);
+            massY += value * (y + 0.5f);
+        }
+
+    for (int y = 0; y < kMnistSize; ++y)
+        for (int x = 0; x < kMnistSize; ++x)
+            out[y * kMnistSize + x] = centrePixel(fitted, (float)mass, (float)massX, (float)massY, config, x, y);
+}
+
+// The whole preprocessing sequence of VulkanImageCuda::updateCuda on the CPU: RGBA8 texture in, 28x28 network input out.
+// work needs kMnistWorkSize^2 floats and is only touched when config.enabled is set.
+inline void mnistPreprocessHost(const unsigned char *rgba, int width, int height, const MnistPreprocessConfig &config, float *work, float *out)
+{
+    if (config.enabled)
+    {
+        areaDownsampleReference(rgba, width, height, work, kMnistWorkSize, kMnistWorkSize);
+        mnistPreprocessReference(work, kMnistWorkSize, config, out);
+    }
+    else
+    {
+        areaDownsampleReference(rgba, width, height, out, kMnistSize, kMnistSize);
+    }
+}
+
+#endif // __MNISTPREPROCESS_H__
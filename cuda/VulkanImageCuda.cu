@@ -1,29 +1,119 @@
 
 #include <algorithm>
+#include <cmath>
 
 #include "VulkanImageCuda.h"
-
-__global__ void convertTextureToMNIST(cudaTextureObject_t texObj, float *d_out, int width, int height)
+#include "CudaAllocations.h"
+#include "MnistPreprocess.h"
+
+// Area-averaging reduction of the whole texture to 28x28. One block per output pixel: the threads stride over the
+// pixel's footprint, convert each texel to gray as it is read and reduce the partial sums in shared memory, so every
+// source texel is fetched exactly once per frame.
+template <int BLOCK_DIM>
+__global__ void convertTextureToMNIST(cudaTextureObject_t texObj, float *d_out, int srcWidth, int srcHeight, int outWidth, int outHeight)
 {
-    int x = blockIdx.x * blockDim.x + threadIdx.x;
-    int y = blockIdx.y * blockDim.y + threadIdx.y;
+    __shared__ float partial[BLOCK_DIM * BLOCK_DIM];
 
-    if (x >= width || y >= height)
-        return;
+    const int x0 = binStart(blockIdx.x, srcWidth, outWidth);
+    const int x1 = binStart(blockIdx.x + 1, srcWidth, outWidth);
+    const int y0 = binStart(blockIdx.y, srcHeight, outHeight);
+    const int y1 = binStart(blockIdx.y + 1, srcHeight, outHeight);
+
+    float sum = 0.0f;
+    for (int sy = y0 + threadIdx.y; sy < y1; sy += BLOCK_DIM)
+    {
+        for (int sx = x0 + threadIdx.x; sx < x1; sx += BLOCK_DIM)
+        {
+            // Sampling a texel centre returns that texel unfiltered, even through the linear-filtered texture object.
+            float4 texColor = tex2D<float4>(texObj, (sx + 0.5f) / srcWidth, (sy + 0.5f) / srcHeight);
+            sum += toGray(texColor.x, texColor.y, texColor.z);
+        }
+    }
+
+    const int tid = threadIdx.y * BLOCK_DIM + threadIdx.x;
+    partial[tid] = sum;
+    __syncthreads();
+    for (int stride = BLOCK_DIM * BLOCK_DIM / 2; stride > 0; stride >>= 1)
+    {
+        if (tid < stride)
+            partial[tid] += partial[tid + stride];
+        __syncthreads();
+    }
 
-    // CUDA textures use normalized coordinates for linear interpolation
-    float u = (x + 0.5f) / width;
-    float v = (y + 0.5f) / height;
+    if (tid == 0)
+    {
+        // Store in row-major format
+        d_out[blockIdx.y * outWidth + blockIdx.x] = partial[0] / float((x1 - x0) * (y1 - y0));
+    }
+}
+
+// Bounding box of every work pixel whose ink exceeds the threshold. A single block strides over the work image and
+// reduces the per-thread extents in shared memory; the box stays on the device for the fit kernel.
+template <int BLOCK_SIZE>
+__global__ void mnistBoundingBox(const float *work, int size, MnistPreprocessConfig config, MnistBox *box)
+{
+    __shared__ int minX[BLOCK_SIZE], minY[BLOCK_SIZE], maxX[BLOCK_SIZE], maxY[BLOCK_SIZE];
 
-    // Assuming texture contains uchar4 or float4 data in [0, 255] or [0.0, 1.0]
-    float4 texColor = tex2D<float4>(texObj, u, v);
+    const int tid = threadIdx.x;
+    minX[tid] = size, minY[tid] = size, maxX[tid] = -1, maxY[tid] = -1;
+    for (int i = tid; i < size * size; i += BLOCK_SIZE)
+    {
+        if (mnistInk(work[i], config) > config.threshold)
+        {
+            const int x = i % size, y = i / size;
+            minX[tid] = min(minX[tid], x);
+            minY[tid] = min(minY[tid], y);
+            maxX[tid] = max(maxX[tid], x);
+            maxY[tid] = max(maxY[tid], y);
+        }
+    }
+    __syncthreads();
+    for (int stride = BLOCK_SIZE / 2; stride > 0; stride >>= 1)
+    {
+        if (tid < stride)
+        {
+            minX[tid] = min(minX[tid], minX[tid + stride]);
+            minY[tid] = min(minY[tid], minY[tid + stride]);
+            maxX[tid] = max(maxX[tid], maxX[tid + stride]);
+            maxY[tid] = max(maxY[tid], maxY[tid + stride]);
+        }
+        __syncthreads();
+    }
+    if (tid == 0)
+    {
+        *box = MnistBox{minX[0], minY[0], maxX[0], maxY[0]};
+    }
+}
 
-    // Convert RGB to grayscale using standard weights
-    float gray = 0.299f * texColor.x + 0.587f * texColor.y + 0.114f * texColor.z;
+// One thread per pixel of the 28x28 field: fit the bounding box into 20x20, reduce the moments of the fitted image in
+// shared memory, then shift by the centre of mass and normalize.
+__global__ void mnistFitAndCentre(const float *work, int size, MnistPreprocessConfig config, const MnistBox *box, float *d_out)
+{
+    constexpr int kPixels = kMnistSize * kMnistSize;
+    __shared__ float fitted[kPixels];
+    __shared__ float mass[kPixels], massX[kPixels], massY[kPixels];
+
+    const int x = threadIdx.x, y = threadIdx.y;
+    const int tid = y * kMnistSize + x;
+    const float value = fitPixel(work, size, *box, config, x, y);
+    fitted[tid] = value;
+    mass[tid] = value;
+    massX[tid] = value * (x + 0.5f);
+    massY[tid] = value * (y + 0.5f);
+    __syncthreads();
+
+    for (int stride = 512; stride > 0; stride >>= 1)
+    {
+        if (tid < stride && tid + stride < kPixels)
+        {
+            mass[tid] += mass[tid + stride];
+            massX[tid] += massX[tid + stride];
+            massY[tid] += massY[tid + stride];
+        }
+        __syncthreads();
+    }
 
-    // Store in row-major format
-    int idx = y * width + x;
-    d_out[idx] = gray; // Assume texColor channels are already [0.0, 1.0]
+    d_out[tid] = centrePixel(fitted, mass[0], massX[0], massY[0], config, x, y);
 }
 
 int VulkanImageCuda::initCuda(uint8_t *vkDeviceUUID, size_t UUID_SIZE)
@@ -60,6 +150,9 @@ int VulkanImageCuda::initCuda(uint8_t *vkDeviceUUID, size_t UUID_SIZE)
                        deviceProp.major,
                        deviceProp.minor);
 
+                // Scratch for the preprocessing stages, allocated up front so the per-frame work can be graph-captured.
+                checkCudaErrors(countedCudaMalloc(&d_work, kMnistWorkSize * kMnistWorkSize * sizeof(float)));
+                checkCudaErrors(countedCudaMalloc(&d_box, sizeof(MnistBox)));
                 return current_device;
             }
         }
@@ -86,12 +179,53 @@ void VulkanImageCuda::updateCuda(unsigned int imageWidth, unsigned int imageHeig
                                  cudaStream_t &stream)
 {
 
-    dim3 block(16, 16);
-    dim3 grid((28 + block.x - 1) / block.x, (28 + block.y - 1) / block.y);
+    constexpr int kBlockDim = 16;
+    dim3 block(kBlockDim, kBlockDim);
+
+    if (!preprocess.enabled)
+    {
+        convertTextureToMNIST<kBlockDim><<<dim3(kMnistSize, kMnistSize), block, 0, stream>>>(textureObjMipMapInput, d_mnistInput, imageWidth, imageHeight, kMnistSize, kMnistSize);
+        cudaGetLastError();
+        return;
+    }
 
-    convertTextureToMNIST<<<grid, block, 0, stream>>>(textureObjMipMapInput, d_mnistInput, 28, 28);
+    convertTextureToMNIST<kBlockDim><<<dim3(kMnistWorkSize, kMnistWorkSize), block, 0, stream>>>(textureObjMipMapInput, d_work, imageWidth, imageHeight, kMnistWorkSize, kMnistWorkSize);
+    mnistBoundingBox<256><<<1, 256, 0, stream>>>(d_work, kMnistWorkSize, preprocess, d_box);
+    mnistFitAndCentre<<<1, dim3(kMnistSize, kMnistSize), 0, stream>>>(d_work, kMnistWorkSize, preprocess, d_box, d_mnistInput);
 
     cudaGetLastError(); 
 }
 
-VulkanImageCuda::~VulkanImageCuda() {}
+float VulkanImageCuda::checkParity(unsigned int imageWidth, unsigned int imageHeight,
+                                   cudaTextureObject_t textureObjMipMapInput, cudaStream_t &stream)
+{
+    // Read level 0 of the array behind the texture object back, so the reference sees exactly what the kernel sees.
+    cudaResourceDesc resDesc;
+    checkCudaErrors(cudaGetTextureObjectResourceDesc(&resDesc, textureObjMipMapInput));
+    cudaArray_t levelArray;
+    checkCudaErrors(cudaGetMipmappedArrayLevel(&levelArray, resDesc.res.mipmap.mipmap, 0));
+
+    std::vector<unsigned char> pixels(size_t(imageWidth) * imageHeight * 4);
+    checkCudaErrors(cudaMemcpy2DFromArray(pixels.data(), imageWidth * 4, levelArray, 0, 0, imageWidth * 4, imageHeight, cudaMemcpyDeviceToHost));
+
+    float *d_out = nullptr;
+    std::vector<float> gpu(kMnistSize * kMnistSize), reference(kMnistSize * kMnistSize);
+    checkCudaErrors(countedCudaMalloc(&d_out, gpu.size() * sizeof(float)));
+    updateCuda(imageWidth, imageHeight, d_out, textureObjMipMapInput, stream);
+    checkCudaErrors(cudaMemcpyAsync(gpu.data(), d_out, gpu.size() * sizeof(float), cudaMemcpyDeviceToHost, stream));
+    checkCudaErrors(cudaStreamSynchronize(stream));
+    checkCudaErrors(cudaFree(d_out));
+
+    std::vector<float> work(kMnistWorkSize * kMnistWorkSize);
+    mnistPreprocessHost(pixels.data(), imageWidth, imageHeight, preprocess, work.data(), reference.data());
+    float maxError = 0.0f;
+    for (size_t i = 0; i < gpu.size(); ++i)
+        maxError = std::max(maxError, std::abs(gpu[i] - reference[i]));
+    return maxError;
+}
+
+VulkanImageCuda::~VulkanImageCuda()
+{
+    cudaFree(d_work);
+    cudaFree(d_box);
+}
@@ -38,6 +38,7 @@
 #include <helper_math.h>
 
 #include "linmath.h"
+#include "MnistPreprocess.h"
 
 class VulkanImageCuda
 {
@@ -51,7 +52,16 @@ public:
     void updateCuda(unsigned int imageWidth, unsigned int imageHeight,
                                  float *d_mnistInput,  cudaTextureObject_t textureObjMipMapInput,
                                  cudaStream_t &stream);
+    // Runs the downsample kernel once and \returns its largest absolute deviation from the CPU reference.
+    float checkParity(unsigned int imageWidth, unsigned int imageHeight,
+                      cudaTextureObject_t textureObjMipMapInput, cudaStream_t &stream);
     size_t mipLevels_;
+    // Read when the kernels are launched, so captured CUDA graphs keep the values they were captured with.
+    MnistPreprocessConfig preprocess;
+
+private:
+    float *d_work = nullptr;    // kMnistWorkSize^2 grayscale image the bounding box and fit run on
+    MnistBox *d_box = nullptr;
 };
 
 #endif // __VULKANIMAGE_H__
@@ -0,0 +1,508 @@
+#include "CpuInferenceEngine.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <map>
+
+namespace
+{
+std::vector<int64_t> intsAttribute(const OnnxNode &node, const std::string &name, std::vector<int64_t> fallback)
+{
+    const OnnxAttribute *attr = node.attribute(name);
+    return attr && !attr->ints.empty() ? attr->ints : fallback;
+}
+
+std::string stringAttribute(const OnnxNode &node, const std::string &name, const std::string &fallback)
+{
+    const OnnxAttribute *attr = node.attribute(name);
+    return attr ? attr->s : fallback;
+}
+
+int argmax(const float *scores, size_t count)
+{
+    return int(std::max_element(scores, scores + count) - scores);
+}
+} // namespace
+
+CpuInferenceEngine::CpuInferenceEngine(Params params) : mParams(std::move(params))
+{
+}
+
+bool CpuInferenceEngine::build()
+{
+    auto tStart = Benchmark::Clock::now();
+    if (!loadOnnxModel(mParams.onnxFileName, mGraph) || !compile())
+    {
+        return false;
+    }
+    mInput.assign(size_t(mParams.maxBatch) * mSampleInputSize, 0.0f);
+    mOutput.assign(size_t(mParams.maxBatch) * mSampleOutputSize, 0.0f);
+    mPendingPredictions.reserve(mParams.maxBatch);
+    mPredictions.reserve(mParams.maxBatch);
+
+    std::cout << "CPU inference engine ready in " << Benchmark::elapsedMs(tStart) << " ms: " << mSteps.size()
+              << " steps, " << mConvKernelName << " convolutions, " << getWorkspaceBytes() / 1024 << " KB workspace\n";
+    return true;
+}
+
+bool CpuInferenceEngine::warmup(InferenceStream stream)
+{
+#ifdef ENABLE_BENCHMARKS
+    benchmarkThroughput();
+#endif
+    if (!enqueue(1, stream))
+        return false;
+    finish(stream);
+    return true;
+}
+
+bool CpuInferenceEngine::beginRequest(int32_t batchSize, InferenceStream)
+{
+    if (mSteps.empty() || batchSize < 1 || batchSize > mParams.maxBatch)
+        return false;
+    mPendingBatch = batchSize;
+    mSubmitted = Benchmark::Clock::now();
+    return true;
+}
+
+bool CpuInferenceEngine::enqueueNetwork(InferenceStream)
+{
+    mPendingPredictions.clear();
+    for (int32_t b = 0; b < mPendingBatch; ++b)
+    {
+        float *scores = mOutput.data() + size_t(b) * mSampleOutputSize;
+        runSample(mInput.data() + size_t(b) * mSampleInputSize, scores);
+        mPendingPredictions.push_back(argmax(scores, mSampleOutputSize));
+    }
+    return true;
+}
+
+bool CpuInferenceEngine::completeRequest(InferenceStream)
+{
+    mResultReady = true;
+    return true;
+}
+
+int CpuInferenceEngine::poll()
+{
+    if (!mResultReady)
+        return 0;
+    mResultReady = false;
+    mPredictions.swap(mPendingPredictions);
+    predictedDigit = mPredictions.front();
+    mLastLatencyMs = Benchmark::elapsedMs(mSubmitted);
+    return 1;
+}
+
+size_t CpuInferenceEngine::volume(const std::vector<int64_t> &dims)
+{
+    size_t v = 1;
+    for (int64_t d : dims)
+        v *= size_t(d);
+    return v;
+}
+
+int CpuInferenceEngine::tensorIndex(const std::string &name)
+{
+    auto it = std::find(mTensorNames.begin(), mTensorNames.end(), name);
+    if (it != mTensorNames.end())
+        return int(it - mTensorNames.begin());
+    mTensorNames.push_back(name);
+    mTensors.emplace_back();
+    return int(mTensors.size() - 1);
+}
+
+// Every arena slot is followed by kConvReadSlack floats so SIMD kernels may read whole vectors past a row end.
+size_t CpuInferenceEngine::allocate(size_t floats)
+{
+    size_t offset = mArena.size();
+    mArena.resize(offset + floats + kConvReadSlack, 0.0f);
+    return offset;
+}
+
+float *CpuInferenceEngine::data(int tensor)
+{
+    return mArena.data() + mTensors[tensor].offset;
+}
+
+const float *CpuInferenceEngine::constData(int tensor) const
+{
+    if (mTensors[tensor].graphInput)
+        return mCurrentInput;
+    if (mTensors[tensor].constant)
+        return mTensors[tensor].constant;
+    return mArena.data() + mTensors[tensor].offset;
+}
+
+bool CpuInferenceEngine::compile()
+{
+    mTensorNames.clear();
+    mTensors.clear();
+    mSteps.clear();
+    mArena.clear();
+
+    for (const OnnxTensor &init : mGraph.initializers)
+    {
+        Tensor &tensor = mTensors[tensorIndex(init.name)];
+        tensor.dims = init.dims;
+        tensor.constant = init.floatData.empty() ? nullptr : init.floatData.data();
+    }
+    mInputTensor = tensorIndex(mParams.inputTensorName);
+    mTensors[mInputTensor].dims = mParams.inputDims;
+    mTensors[mInputTensor].graphInput = true;
+    mSampleInputSize = volume(mParams.inputDims);
+
+    // Fusion is only legal when the intermediate result has no other reader.
+    std::map<std::string, int> readers;
+    for (const OnnxNode &node : mGraph.nodes)
+        for (const std::string &name : node.inputs)
+            readers[name]++;
+    for (const std::string &name : mGraph.outputs)
+        readers[name]++;
+
+    auto unsupported = [](const OnnxNode &node, const std::string &what)
+    {
+        std::cerr << "CPU inference engine: " << node.opType << " node " << node.name << " " << what << std::endl;
+        return false;
+    };
+
+    const std::vector<OnnxNode> &nodes = mGraph.nodes;
+    for (size_t n = 0; n < nodes.size(); ++n)
+    {
+        const OnnxNode &node = nodes[n];
+        const int input = tensorIndex(node.inputs[0]);
+        const std::vector<int64_t> inDims = mTensors[input].dims;
+        if (inDims.empty())
+        {
+            return unsupported(node, "reads a tensor of unknown shape");
+        }
+
+        if (node.opType == "Reshape")
+        {
+            const OnnxTensor *shape = mGraph.initializer(node.inputs[1]);
+            if (!shape)
+                return unsupported(node, "needs a constant shape");
+            std::vector<int64_t> dims = shape->int64Data;
+            int64_t known = 1;
+            int inferred = -1;
+            for (size_t i = 0; i < dims.size(); ++i)
+            {
+                if (dims[i] == 0)
+                    dims[i] = inDims[i];
+                if (dims[i] == -1)
+                    inferred = int(i);
+                else
+                    known *= dims[i];
+            }
+            if (inferred >= 0)
+                dims[inferred] = int64_t(volume(inDims)) / known;
+
+            // Reshape never moves data: the output aliases the input, whether that is a weight, an activation or the
+            // graph input, which is not in the arena and stays resolved through graphInput.
+            Tensor alias = mTensors[input];
+            alias.dims = dims;
+            mTensors[tensorIndex(node.outputs[0])] = alias;
+            continue;
+        }
+
+        Step step;
+        step.input = input;
+        std::string outputName = node.outputs[0];
+        std::vector<int64_t> outDims = inDims;
+
+        if (node.opType == "Conv")
+        {
+            const OnnxTensor *weights = mGraph.initializer(node.inputs[1]);
+            if (!weights || weights->dims.size() != 4 || inDims.size() != 4)
+                return unsupported(node, "needs constant 4-D weights and a 4-D input");
+            for (int64_t d : intsAttribute(node, "dilations", {1, 1}))
+                if (d != 1)
+                    return unsupported(node, "uses dilation");
+            if (node.attribute("group") && node.attribute("group")->i != 1)
+                return unsupported(node, "uses grouped convolution");
+
+            std::vector<int64_t> kernel = intsAttribute(node, "kernel_shape", {weights->dims[2], weights->dims[3]});
+            std::vector<int64_t> strides = intsAttribute(node, "strides", {1, 1});
+            std::vector<int64_t> pads = intsAttribute(node, "pads", {0, 0, 0, 0});
+            std::string autoPad = stringAttribute(node, "auto_pad", "NOTSET");
+
+            ConvShape &s = step.conv;
+            s.inC = int(inDims[1]);
+            s.outC = int(weights->dims[0]);
+            s.kH = int(kernel[0]);
+            s.kW = int(kernel[1]);
+            s.strideH = int(strides[0]);
+            s.strideW = int(strides[1]);
+            step.inH = int(inDims[2]);
+            step.inW = int(inDims[3]);
+            if (autoPad == "SAME_UPPER" || autoPad == "SAME_LOWER")
+            {
+                s.outH = (step.inH + s.strideH - 1) / s.strideH;
+                s.outW = (step.inW + s.strideW - 1) / s.strideW;
+                int padH = std::max((s.outH - 1) * s.strideH + s.kH - step.inH, 0);
+                int padW = std::max((s.outW - 1) * s.strideW + s.kW - step.inW, 0);
+                step.padTop = autoPad == "SAME_UPPER" ? padH / 2 : padH - padH / 2;
+                step.padLeft = autoPad == "SAME_UPPER" ? padW / 2 : padW - padW / 2;
+            }
+            else
+            {
+                if (autoPad == "VALID")
+                    pads = {0, 0, 0, 0};
+                step.padTop = int(pads[0]);
+                step.padLeft = int(pads[1]);
+                s.outH = (step.inH + int(pads[0] + pads[2]) - s.kH) / s.strideH + 1;
+                s.outW = (step.inW + int(pads[1] + pads[3]) - s.kW) / s.strideW + 1;
+            }
+            s.paddedH = std::max((s.outH - 1) * s.strideH + s.kH, step.padTop + step.inH);
+            s.paddedW = std::max((s.outW - 1) * s.strideW + s.kW, step.padLeft + step.inW);
+
+            step.type = StepType::kConv;
+            step.input2 = tensorIndex(node.inputs[1]);
+            step.paddedOffset = allocate(size_t(s.inC) * s.paddedH * s.paddedW);
+            step.convKernel = selectConvKernel(s, &mConvKernelName);
+            if (node.inputs.size() > 2)
+                step.bias = mGraph.initializer(node.inputs[2]) ? mGraph.initializer(node.inputs[2])->floatData.data() : nullptr;
+            outDims = {1, s.outC, s.outH, s.outW};
+
+            // Fold a following per-channel bias Add and ReLU into the convolution epilogue.
+            if (!step.bias && n + 1 < nodes.size() && nodes[n + 1].opType == "Add" && nodes[n + 1].inputs[0] == outputName &&
+                readers[outputName] == 1)
+            {
+                const OnnxTensor *bias = mGraph.initializer(nodes[n + 1].inputs[1]);
+                if (bias && volume(bias->dims) == size_t(s.outC))
+                {
+                    step.bias = bias->floatData.data();
+                    outputName = nodes[++n].outputs[0];
+                }
+            }
+            if (n + 1 < nodes.size() && nodes[n + 1].opType == "Relu" && nodes[n + 1].inputs[0] == outputName &&
+                readers[outputName] == 1)
+            {
+                step.relu = true;
+                outputName = nodes[++n].outputs[0];
+            }
+        }
+        else if (node.opType == "Add")
+        {
+            step.type = StepType::kAdd;
+            step.input2 = tensorIndex(node.inputs[1]);
+            const size_t otherSize = volume(mTensors[step.input2].dims);
+            if (otherSize != volume(inDims))
+            {
+                if (inDims.size() != 4 || otherSize != size_t(inDims[1]))
+                    return unsupported(node, "uses an unsupported broadcast");
+                step.perChannel = true;
+            }
+        }
+        else if (node.opType == "Relu")
+        {
+            step.type = StepType::kRelu;
+        }
+        else if (node.opType == "MaxPool")
+        {
+            if (inDims.size() != 4 || stringAttribute(node, "auto_pad", "NOTSET") != "NOTSET" ||
+                (node.attribute("ceil_mode") && node.attribute("ceil_mode")->i != 0))
+                return unsupported(node, "uses unsupported padding");
+            std::vector<int64_t> kernel = intsAttribute(node, "kernel_shape", {});
+            std::vector<int64_t> strides = intsAttribute(node, "strides", {1, 1});
+            std::vector<int64_t> pads = intsAttribute(node, "pads", {0, 0, 0, 0});
+            if (kernel.size() != 2)
+                return unsupported(node, "needs a 2-D kernel");
+            step.type = StepType::kMaxPool;
+            step.kH = int(kernel[0]);
+            step.kW = int(kernel[1]);
+            step.strideH = int(strides[0]);
+            step.strideW = int(strides[1]);
+            step.poolPadTop = int(pads[0]);
+            step.poolPadLeft = int(pads[1]);
+            step.inH = int(inDims[2]);
+            step.inW = int(inDims[3]);
+            outDims[2] = (inDims[2] + pads[0] + pads[2] - kernel[0]) / strides[0] + 1;
+            outDims[3] = (inDims[3] + pads[1] + pads[3] - kernel[1]) / strides[1] + 1;
+        }
+        else if (node.opType == "MatMul")
+        {
+            step.type = StepType::kMatMul;
+            step.input2 = tensorIndex(node.inputs[1]);
+            const std::vector<int64_t> &b = mTensors[step.input2].dims;
+            if (inDims.size() != 2 || b.size() != 2 || b[0] != inDims[1] || !mTensors[step.input2].constant)
+                return unsupported(node, "needs a 2-D input and constant 2-D weights");
+            outDims = {inDims[0], b[1]};
+        }
+        else
+        {
+            return unsupported(node, "is not supported");
+        }
+
+        step.output = tensorIndex(outputName);
+        mTensors[step.output].dims = outDims;
+        mTensors[step.output].offset = allocate(volume(outDims));
+        mSteps.push_back(step);
+    }
+
+    mOutputTensor = tensorIndex(mParams.outputTensorName);
+    if (mTensors[mOutputTensor].dims.empty() || mTensors[mOutputTensor].constant)
+    {
+        std::cerr << "CPU inference engine: output " << mParams.outputTensorName << " is not produced by the graph" << std::endl;
+        return false;
+    }
+    mSampleOutputSize = volume(mTensors[mOutputTensor].dims);
+    return true;
+}
+
+void CpuInferenceEngine::runSample(const float *input, float *output)
+{
+    mCurrentInput = input;
+    for (const Step &step : mSteps)
+    {
+        const float *in = constData(step.input);
+        float *out = data(step.output);
+        const size_t count = volume(mTensors[step.output].dims);
+        switch (step.type)
+        {
+        case StepType::kConv:
+        {
+            // Only the interior is written; the zero border was set when the arena was allocated and never changes.
+            const ConvShape &s = step.conv;
+            float *padded = mArena.data() + step.paddedOffset;
+            for (int c = 0; c < s.inC; ++c)
+                for (int y = 0; y < step.inH; ++y)
+                    std::memcpy(padded + (size_t(c) * s.paddedH + y + step.padTop) * s.paddedW + step.padLeft,
+                                in + (size_t(c) * step.inH + y) * step.inW, step.inW * sizeof(float));
+            step.convKernel(padded, constData(step.input2), step.bias, out, s, step.relu);
+            break;
+        }
+        case StepType::kAdd:
+        {
+            const float *other = constData(step.input2);
+            if (step.perChannel)
+            {
+                const size_t plane = count / mTensors[step.output].dims[1];
+                for (size_t i = 0; i < count; ++i)
+                    out[i] = in[i] + other[i / plane];
+            }
+            else
+            {
+                for (size_t i = 0; i < count; ++i)
+                    out[i] = in[i] + other[i];
+            }
+            break;
+        }
+        case StepType::kRelu:
+            for (size_t i = 0; i < count; ++i)
+                out[i] = std::max(in[i], 0.0f);
+            break;
+        case StepType::kMaxPool:
+        {
+            const std::vector<int64_t> &dims = mTensors[step.output].dims;
+            const int channels = int(dims[1]), outH = int(dims[2]), outW = int(dims[3]);
+            for (int c = 0; c < channels; ++c)
+                for (int oy = 0; oy < outH; ++oy)
+                    for (int ox = 0; ox < outW; ++ox)
+                    {
+                        float best = -std::numeric_limits<float>::infinity();
+                        for (int ky = 0; ky < step.kH; ++ky)
+                        {
+                            const int y = oy * step.strideH + ky - step.poolPadTop;
+                            if (y < 0 || y >= step.inH)
+                                continue;
+                            for (int kx = 0; kx < step.kW; ++kx)
+                            {
+                                const int x = ox * step.strideW + kx - step.poolPadLeft;
+                                if (x >= 0 && x < step.inW)
+                                    best = std::max(best, in[(size_t(c) * step.inH + y) * step.inW + x]);
+                            }
+                        }
+                        out[(size_t(c) * outH + oy) * outW + ox] = best;
+                    }
+            break;
+        }
+        case StepType::kMatMul:
+        {
+            const std::vector<int64_t> &a = mTensors[step.input].dims;
+            const int rows = int(a[0]), inner = int(a[1]), cols = int(mTensors[step.output].dims[1]);
+            const float *weights = constData(step.input2);
+            for (int r = 0; r < rows; ++r)
+            {
+                float *o = out + size_t(r) * cols;
+                std::fill(o, o + cols, 0.0f);
+                for (int k = 0; k < inner; ++k)
+                {
+                    const float value = in[size_t(r) * inner + k];
+                    const float *w = weights + size_t(k) * cols;
+                    for (int c = 0; c < cols; ++c)
+                        o[c] += value * w[c];
+                }
+            }
+            break;
+        }
+        }
+    }
+    std::memcpy(output, constData(mOutputTensor), mSampleOutputSize * sizeof(float));
+}
+
+bool CpuInferenceEngine::infer()
+{
+    if (mSteps.empty())
+        return false;
+    runSample(mInput.data(), mOutput.data());
+    predictedDigit = argmax(mOutput.data(), mSampleOutputSize);
+    return true;
+}
+
+bool CpuInferenceEngine::inferBatch(int32_t batchSize, std::vector<int> &predictions)
+{
+    if (mSteps.empty() || batchSize < 1 || batchSize > mParams.maxBatch)
+    {
+        std::cerr << "Unsupported batch size " << batchSize << " (max " << mParams.maxBatch << ")" << std::endl;
+        return false;
+    }
+    predictions.clear();
+    for (int32_t b = 0; b < batchSize; ++b)
+    {
+        float *scores = mOutput.data() + size_t(b) * mSampleOutputSize;
+        runSample(mInput.data() + size_t(b) * mSampleInputSize, scores);
+        predictions.push_back(argmax(scores, mSampleOutputSize));
+    }
+    predictedDigit = predictions.back();
+    return true;
+}
+
+bool CpuInferenceEngine::inferBatch(std::span<const float *const> inputs, std::vector<int> &predictions)
+{
+    if (mSteps.empty())
+        return false;
+    predictions.clear();
+    predictions.reserve(inputs.size());
+    for (size_t i = 0; i < inputs.size(); ++i)
+    {
+        float *scores = mOutput.data() + (i % mParams.maxBatch) * mSampleOutputSize;
+        runSample(inputs[i], scores);
+        predictions.push_back(argmax(scores, mSampleOutputSize));
+    }
+    if (!predictions.empty())
+        predictedDigit = predictions.back();
+    return true;
+}
+
+#ifdef ENABLE_BENCHMARKS
+// The engine is single threaded, so this is the throughput of one core.
+void CpuInferenceEngine::benchmarkThroughput()
+{
+    constexpr int kSamples = 2000;
+    std::vector<int> predictions;
+    predictions.reserve(mParams.maxBatch);
+    inferBatch(mParams.maxBatch, predictions); // warm-up
+
+    auto tStart = Benchmark::Clock::now();
+    for (int done = 0; done < kSamples; done += mParams.maxBatch)
+    {
+        predictions.clear();
+        inferBatch(std::min(mParams.maxBatch, kSamples - done), predictions);
+    }
+    double ms = Benchmark::elapsedMs(tStart);
+    std::cout << "[Benchmark] CPU engine (" << mConvKernelName << "): " << kSamples * 1000.0 / ms
+              << " images/s on one core, " << ms * 1000.0 / kSamples << " us per image" << std::endl;
+}
+#endif
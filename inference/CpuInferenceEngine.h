@@ -0,0 +1,138 @@
+#pragma once
+#ifndef __CPUINFERENCEENGINE_H__
+#define __CPUINFERENCEENGINE_H__
+
+#include "Benchmark.h"
+#include "CpuKernels.h"
+#include "InferenceEngine.h"
+#include "OnnxModel.h"
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+// Runs mnist.onnx on the CPU for machines without TensorRT or a GPU. The ONNX graph is compiled once into a list of
+// steps (Conv + bias + ReLU are fused, constant reshapes are folded) whose tensors live at fixed offsets in one
+// workspace arena, so inference never allocates. Samples are run one at a time through the arena, which keeps the
+// whole working set of this network in L2.
+class CpuInferenceEngine : public InferenceEngine
+{
+public:
+    struct Params
+    {
+        std::string onnxFileName = "tensorModels/mnist.onnx";
+        std::string inputTensorName = "Input3";
+        std::string outputTensorName = "Plus214_Output_0";
+        std::vector<int64_t> inputDims = {1, 1, 28, 28}; //!< Per-sample input shape, the model does not store it
+        int32_t maxBatch = 256;                            //!< Samples inputBuffer() has room for
+    };
+
+    CpuInferenceEngine() : CpuInferenceEngine(Params{}) {}
+    explicit CpuInferenceEngine(Params params);
+
+    bool build();
+
+    const char *name() const override { return "cpu"; }
+    bool load() override { return build(); }
+    bool warmup(InferenceStream stream) override;
+
+    InputLocation inputLocation() const override { return InputLocation::kHost; }
+    float *inputBuffer() override { return mInput.data(); }
+    int32_t maxBatchSize() const override { return mParams.maxBatch; }
+
+    // The network runs synchronously on the calling thread inside enqueueNetwork(); the stream is not used and the
+    // result is handed out by the next poll().
+    bool beginRequest(int32_t batchSize, InferenceStream stream) override;
+    bool enqueueNetwork(InferenceStream stream) override;
+    bool completeRequest(InferenceStream stream) override;
+    int poll() override;
+    void finish(InferenceStream) override { poll(); }
+
+    int getPrediction() const override { return predictedDigit; }
+    const std::vector<int> &getBatchPredictions() const override { return mPredictions; }
+    double getLastLatencyMs() const override { return mLastLatencyMs; }
+
+    //! Scores of the last inference, sampleOutputSize() floats per sample.
+    const float *getOutputBuffer() const { return mOutput.data(); }
+    size_t sampleInputSize() const { return mSampleInputSize; }
+    size_t sampleOutputSize() const { return mSampleOutputSize; }
+    size_t getWorkspaceBytes() const { return mArena.size() * sizeof(float); }
+    const char *getConvKernelName() const { return mConvKernelName; }
+
+    //! Classifies the sample at the start of inputBuffer().
+    bool infer();
+    //! Classifies the first batchSize samples of inputBuffer().
+    bool inferBatch(int32_t batchSize, std::vector<int> &predictions);
+    //! Classifies any number of host samples.
+    bool inferBatch(std::span<const float *const> inputs, std::vector<int> &predictions);
+
+#ifdef ENABLE_BENCHMARKS
+    void benchmarkThroughput();
+#endif
+
+private:
+    enum class StepType
+    {
+        kConv,
+        kAdd,
+        kRelu,
+        kMaxPool,
+        kMatMul,
+    };
+
+    struct Tensor
+    {
+        std::vector<int64_t> dims;
+        size_t offset = 0;              //!< Position in the arena for activations
+        const float *constant = nullptr; //!< Points into the model for initializers
+        bool graphInput = false;         //!< Reads the sample being classified: the graph input or a reshape of it
+    };
+
+    struct Step
+    {
+        StepType type;
+        int input = -1, input2 = -1, output = -1;
+        // Conv: the input is copied into a zero-padded plane at paddedOffset before the kernel runs.
+        ConvShape conv{};
+        ConvKernel convKernel = nullptr;
+        size_t paddedOffset = 0;
+        int padTop = 0, padLeft = 0, inH = 0, inW = 0;
+        const float *bias = nullptr;
+        bool relu = false;
+        // MaxPool
+        int kH = 0, kW = 0, strideH = 0, strideW = 0, poolPadTop = 0, poolPadLeft = 0;
+        // Add: input2 is either the same size as input or one value per channel
+        bool perChannel = false;
+    };
+
+    bool compile();
+    int tensorIndex(const std::string &name);
+    size_t allocate(size_t floats);
+    static size_t volume(const std::vector<int64_t> &dims);
+    float *data(int tensor);
+    const float *constData(int tensor) const;
+    void runSample(const float *input, float *output);
+
+    Params mParams;
+    OnnxGraph mGraph;
+    std::vector<std::string> mTensorNames;
+    std::vector<Tensor> mTensors;
+    std::vector<Step> mSteps;
+    std::vector<float> mArena;
+    std::vector<float> mInput;
+    std::vector<float> mOutput;
+    int mInputTensor = -1, mOutputTensor = -1;
+    size_t mSampleInputSize = 0, mSampleOutputSize = 0;
+    const float *mCurrentInput = nullptr;
+    const char *mConvKernelName = "none";
+    int predictedDigit = -1;
+    // Request state for the InferenceEngine path
+    int32_t mPendingBatch = 0;
+    bool mResultReady = false;
+    Benchmark::Clock::time_point mSubmitted;
+    std::vector<int> mPendingPredictions;
+    std::vector<int> mPredictions;
+    double mLastLatencyMs = 0.0;
+};
+
+#endif // __CPUINFERENCEENGINE_H__
@@ -0,0 +1,170 @@
+#include "CpuKernels.h"
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CPU_KERNELS_X86 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define CPU_KERNELS_NEON 1
+#endif
+
+void convScalar(const float *padded, const float *weights, const float *bias, float *out, const ConvShape &s, bool relu)
+{
+    for (int oc = 0; oc < s.outC; ++oc)
+    {
+        const float *w = weights + size_t(oc) * s.inC * s.kH * s.kW;
+        for (int y = 0; y < s.outH; ++y)
+        {
+            for (int x = 0; x < s.outW; ++x)
+            {
+                float acc = bias ? bias[oc] : 0.0f;
+                for (int ic = 0; ic < s.inC; ++ic)
+                    for (int ky = 0; ky < s.kH; ++ky)
+                    {
+                        const float *row = padded + (size_t(ic) * s.paddedH + y * s.strideH + ky) * s.paddedW + x * s.strideW;
+                        const float *wk = w + (size_t(ic) * s.kH + ky) * s.kW;
+                        for (int kx = 0; kx < s.kW; ++kx)
+                            acc += wk[kx] * row[kx];
+                    }
+                out[(size_t(oc) * s.outH + y) * s.outW + x] = relu ? std::max(acc, 0.0f) : acc;
+            }
+        }
+    }
+}
+
+#if CPU_KERNELS_X86
+// Stride-1 direct convolution, eight output columns per vector and OCB output channels per pass so every input load
+// feeds OCB fused multiply-adds. The last partial vector of a row is written with a masked store.
+template <int OCB>
+__attribute__((target("avx2,fma"))) static void convAvx2Block(const float *padded, const float *weights, const float *bias,
+                                                                 float *out, const ConvShape &s, bool relu, int oc0)
+{
+    const int tail = s.outW % 8;
+    alignas(32) int maskBits[8];
+    for (int i = 0; i < 8; ++i)
+        maskBits[i] = i < tail ? -1 : 0;
+    const __m256i tailMask = _mm256_load_si256(reinterpret_cast<const __m256i *>(maskBits));
+    const size_t filterSize = size_t(s.inC) * s.kH * s.kW;
+
+    for (int y = 0; y < s.outH; ++y)
+    {
+        for (int x0 = 0; x0 < s.outW; x0 += 8)
+        {
+            __m256 acc[OCB];
+            for (int b = 0; b < OCB; ++b)
+                acc[b] = _mm256_set1_ps(bias ? bias[oc0 + b] : 0.0f);
+
+            for (int ic = 0; ic < s.inC; ++ic)
+                for (int ky = 0; ky < s.kH; ++ky)
+                {
+                    const float *row = padded + (size_t(ic) * s.paddedH + y + ky) * s.paddedW + x0;
+                    const float *wk = weights + size_t(oc0) * filterSize + (size_t(ic) * s.kH + ky) * s.kW;
+                    for (int kx = 0; kx < s.kW; ++kx)
+                    {
+                        const __m256 in = _mm256_loadu_ps(row + kx);
+                        for (int b = 0; b < OCB; ++b)
+                            acc[b] = _mm256_fmadd_ps(_mm256_set1_ps(wk[b * filterSize + kx]), in, acc[b]);
+                    }
+                }
+
+            for (int b = 0; b < OCB; ++b)
+            {
+                __m256 value = relu ? _mm256_max_ps(acc[b], _mm256_setzero_ps()) : acc[b];
+                float *o = out + (size_t(oc0 + b) * s.outH + y) * s.outW + x0;
+                if (x0 + 8 <= s.outW)
+                    _mm256_storeu_ps(o, value);
+                else
+                    _mm256_maskstore_ps(o, tailMask, value);
+            }
+        }
+    }
+}
+
+__attribute__((target("avx2,fma"))) static void convAvx2(const float *padded, const float *weights, const float *bias,
+                                                            float *out, const ConvShape &s, bool relu)
+{
+    int oc = 0;
+    for (; oc + 4 <= s.outC; oc += 4)
+        convAvx2Block<4>(padded, weights, bias, out, s, relu, oc);
+    for (; oc < s.outC; ++oc)
+        convAvx2Block<1>(padded, weights, bias, out, s, relu, oc);
+}
+#endif
+
+#if CPU_KERNELS_NEON
+// Same blocking as the AVX2 kernel with four columns per vector; the partial vector goes through a stack copy.
+template <int OCB>
+static void convNeonBlock(const float *padded, const float *weights, const float *bias, float *out, const ConvShape &s,
+                          bool relu, int oc0)
+{
+    const size_t filterSize = size_t(s.inC) * s.kH * s.kW;
+    for (int y = 0; y < s.outH; ++y)
+    {
+        for (int x0 = 0; x0 < s.outW; x0 += 4)
+        {
+            float32x4_t acc[OCB];
+            for (int b = 0; b < OCB; ++b)
+                acc[b] = vdupq_n_f32(bias ? bias[oc0 + b] : 0.0f);
+
+            for (int ic = 0; ic < s.inC; ++ic)
+                for (int ky = 0; ky < s.kH; ++ky)
+                {
+                    const float *row = padded + (size_t(ic) * s.paddedH + y + ky) * s.paddedW + x0;
+                    const float *wk = weights + size_t(oc0) * filterSize + (size_t(ic) * s.kH + ky) * s.kW;
+                    for (int kx = 0; kx < s.kW; ++kx)
+                    {
+                        const float32x4_t in = vld1q_f32(row + kx);
+                        for (int b = 0; b < OCB; ++b)
+                            acc[b] = vfmaq_n_f32(acc[b], in, wk[b * filterSize + kx]);
+                    }
+                }
+
+            for (int b = 0; b < OCB; ++b)
+            {
+                float32x4_t value = relu ? vmaxq_f32(acc[b], vdupq_n_f32(0.0f)) : acc[b];
+                float *o = out + (size_t(oc0 + b) * s.outH + y) * s.outW + x0;
+                if (x0 + 4 <= s.outW)
+                {
+                    vst1q_f32(o, value);
+                }
+                else
+                {
+                    float lanes[4];
+                    vst1q_f32(lanes, value);
+                    std::copy(lanes, lanes + (s.outW - x0), o);
+                }
+            }
+        }
+    }
+}
+
+static void convNeon(const float *padded, const float *weights, const float *bias, float *out, const ConvShape &s, bool relu)
+{
+    int oc = 0;
+    for (; oc + 4 <= s.outC; oc += 4)
+        convNeonBlock<4>(padded, weights, bias, out, s, relu, oc);
+    for (; oc < s.outC; ++oc)
+        convNeonBlock<1>(padded, weights, bias, out, s, relu, oc);
+}
+#endif
+
+ConvKernel selectConvKernel(const ConvShape &shape, const char **name)
+{
+    const bool unitStride = shape.strideH == 1 && shape.strideW == 1;
+#if CPU_KERNELS_X86
+    if (unitStride && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        *name = "avx2";
+        return convAvx2;
+    }
+#elif CPU_KERNELS_NEON
+    if (unitStride)
+    {
+        *name = "neon";
+        return convNeon;
+    }
+#endif
+    *name = "scalar";
+    return convScalar;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#ifndef __CPUKERNELS_H__
+#define __CPUKERNELS_H__
+
+// Convolution kernels of the CPU inference engine. The input is a zero-padded CHW image, so the kernels never branch on
+// borders. SIMD variants load full vectors past the end of a row: callers keep kConvReadSlack floats of addressable
+// memory after every padded input.
+
+constexpr int kConvReadSlack = 16;
+
+struct ConvShape
+{
+    int inC, outC;
+    int kH, kW;
+    int strideH, strideW;
+    int paddedH, paddedW; //!< Dimensions of the padded input plane
+    int outH, outW;
+};
+
+//! out[oc][y][x] = bias[oc] + sum(weights[oc][ic][ky][kx] * padded[ic][y * strideH + ky][x * strideW + kx]),
+//! followed by max(0, .) when relu is set. bias may be null.
+using ConvKernel = void (*)(const float *padded, const float *weights, const float *bias, float *out, const ConvShape &shape, bool relu);
+
+void convScalar(const float *padded, const float *weights, const float *bias, float *out, const ConvShape &shape, bool relu);
+
+//! \returns the fastest kernel this CPU supports for \p shape and stores its name in \p name.
+ConvKernel selectConvKernel(const ConvShape &shape, const char **name);
+
+#endif // __CPUKERNELS_H__
@@ -0,0 +1,67 @@
+#pragma once
+#ifndef __INFERENCEENGINE_H__
+#define __INFERENCEENGINE_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct CUstream_st;
+using InferenceStream = CUstream_st *; // Same type as cudaStream_t, without pulling the CUDA headers into every backend
+
+// Common interface of the digit classifiers, so the frame loop does not care whether the network runs in TensorRT,
+// on the CPU or not at all. A request is split in three steps so the GPU backend can keep enqueueNetwork() inside a
+// captured CUDA graph; enqueue() runs all three.
+class InferenceEngine
+{
+public:
+    enum class InputLocation
+    {
+        kHost,
+        kDevice,
+    };
+
+    virtual ~InferenceEngine() = default;
+
+    virtual const char *name() const = 0;
+
+    //! Parses or deserializes the model and allocates every buffer inference will use.
+    virtual bool load() = 0;
+    //! Runs the network once so the first real request does not pay for lazy initialization.
+    virtual bool warmup(InferenceStream stream) = 0;
+
+    //! Where inputBuffer() lives. Host engines need their input copied out of device memory before enqueueNetwork().
+    virtual InputLocation inputLocation() const = 0;
+    //! maxBatchSize() samples of 1x28x28 floats, back to back.
+    virtual float *inputBuffer() = 0;
+    virtual int32_t maxBatchSize() const = 0;
+    //! Makes the network read its input from \p device, caller-owned device memory with room for \p capacity samples
+    //! laid out like inputBuffer(), which then returns it. \returns false for engines that cannot read device memory.
+    virtual bool bindInputBuffer(float * /*device*/, int32_t /*capacity*/) { return false; }
+
+    //! Queues inference of the first batchSize samples of inputBuffer() without waiting for the result.
+    bool enqueue(int32_t batchSize, InferenceStream stream)
+    {
+        return beginRequest(batchSize, stream) && enqueueNetwork(stream) && completeRequest(stream);
+    }
+    virtual bool beginRequest(int32_t batchSize, InferenceStream stream) = 0;
+    virtual bool enqueueNetwork(InferenceStream stream) = 0;
+    virtual bool completeRequest(InferenceStream stream) = 0;
+    //! True when enqueueNetwork() only issues stream work and may be recorded into a CUDA graph.
+    virtual bool supportsGraphCapture() const { return false; }
+
+    //! Picks up finished requests without blocking. \returns how many finished.
+    virtual int poll() = 0;
+    //! Blocks until every enqueued request has finished and has been polled.
+    virtual void finish(InferenceStream stream) = 0;
+
+    //! Prediction for the first sample of the most recent finished request.
+    virtual int getPrediction() const = 0;
+    //! Predictions for every sample of the most recent finished request.
+    virtual const std::vector<int> &getBatchPredictions() const = 0;
+    //! Enqueue-to-result time of the most recent finished request, as seen by the host.
+    virtual double getLastLatencyMs() const = 0;
+    virtual float getLastGpuMs() const { return 0.0f; }
+};
+
+#endif // __INFERENCEENGINE_H__
@@ -0,0 +1,38 @@
+#pragma once
+#ifndef __INFERENCEENGINEFACTORY_H__
+#define __INFERENCEENGINEFACTORY_H__
+
+#include "CpuInferenceEngine.h"
+#include "InferenceEngine.h"
+#include "MockInferenceEngine.h"
+#include "Options.h"
+#include "TensorRTManager.h"
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+
+namespace InferenceEngineFactory
+{
+//! \returns the backend called \p name ("tensorrt", "cpu" or "mock"), not yet loaded, or nullptr for unknown names.
+inline std::unique_ptr<InferenceEngine> create(const std::string &name)
+{
+    if (name == "tensorrt")
+    {
+        return std::make_unique<TensorRTManager>();
+    }
+    if (name == "cpu")
+    {
+        return std::make_unique<CpuInferenceEngine>();
+    }
+    if (name == "mock")
+    {
+        const auto latency = std::chrono::duration<double, std::milli>(Options::settings().mockLatencyMs);
+        return std::make_unique<MockInferenceEngine>(std::chrono::duration_cast<std::chrono::microseconds>(latency));
+    }
+    std::cerr << "Unknown inference engine \"" << name << "\", expected tensorrt, cpu or mock" << std::endl;
+    return nullptr;
+}
+} // namespace InferenceEngineFactory
+
+#endif // __INFERENCEENGINEFACTORY_H__
@@ -0,0 +1,116 @@
+#pragma once
+#ifndef __MOCKINFERENCEENGINE_H__
+#define __MOCKINFERENCEENGINE_H__
+
+#include "Benchmark.h"
+#include "InferenceEngine.h"
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <vector>
+
+// Stand-in classifier for exercising the frame loop without a model or a GPU. The prediction is a hash of the input
+// bytes, so the same frames always give the same answers, and results only become visible after a configurable
+// latency to mimic an asynchronous device.
+class MockInferenceEngine : public InferenceEngine
+{
+public:
+    explicit MockInferenceEngine(std::chrono::microseconds latency = std::chrono::microseconds(0), int32_t maxBatch = 256)
+        : mLatency(latency), mMaxBatch(maxBatch)
+    {
+    }
+
+    const char *name() const override { return "mock"; }
+
+    bool load() override
+    {
+        mInput.assign(size_t(mMaxBatch) * kSampleSize, 0.0f);
+        return true;
+    }
+    bool warmup(InferenceStream stream) override
+    {
+        if (!enqueue(1, stream))
+            return false;
+        finish(stream);
+        return true;
+    }
+
+    InputLocation inputLocation() const override { return InputLocation::kHost; }
+    float *inputBuffer() override { return mInput.data(); }
+    int32_t maxBatchSize() const override { return mMaxBatch; }
+
+    bool beginRequest(int32_t batchSize, InferenceStream) override
+    {
+        if (batchSize < 1 || batchSize > mMaxBatch)
+            return false;
+        mPendingBatch = batchSize;
+        mPending = Request{Benchmark::Clock::now(), {}};
+        return true;
+    }
+    bool enqueueNetwork(InferenceStream) override
+    {
+        mPending.predictions.reserve(mPendingBatch);
+        for (int32_t b = 0; b < mPendingBatch; ++b)
+            mPending.predictions.push_back(int(hashSample(mInput.data() + size_t(b) * kSampleSize) % 10));
+        return true;
+    }
+    bool completeRequest(InferenceStream) override
+    {
+        mInFlight.push_back(std::move(mPending));
+        return true;
+    }
+
+    int poll() override
+    {
+        int finished = 0;
+        while (!mInFlight.empty() && Benchmark::Clock::now() - mInFlight.front().submitted >= mLatency)
+        {
+            mLastLatencyMs = Benchmark::elapsedMs(mInFlight.front().submitted);
+            mPredictions = std::move(mInFlight.front().predictions);
+            mInFlight.pop_front();
+            finished++;
+        }
+        return finished;
+    }
+    void finish(InferenceStream) override
+    {
+        while (!mInFlight.empty())
+            poll();
+    }
+
+    int getPrediction() const override { return mPredictions.empty() ? -1 : mPredictions.front(); }
+    const std::vector<int> &getBatchPredictions() const override { return mPredictions; }
+    double getLastLatencyMs() const override { return mLastLatencyMs; }
+
+private:
+    static constexpr size_t kSampleSize = 28 * 28;
+
+    struct Request
+    {
+        Benchmark::Clock::time_point submitted;
+        std::vector<int> predictions;
+    };
+
+    static uint64_t hashSample(const float *sample)
+    {
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        const auto *bytes = reinterpret_cast<const uint8_t *>(sample);
+        for (size_t i = 0; i < kSampleSize * sizeof(float); ++i)
+        {
+            hash ^= bytes[i];
+            hash *= 0x100000001b3ULL;
+        }
+        return hash;
+    }
+
+    std::chrono::microseconds mLatency;
+    int32_t mMaxBatch;
+    std::vector<float> mInput;
+    int32_t mPendingBatch = 0;
+    Request mPending;
+    std::deque<Request> mInFlight;
+    std::vector<int> mPredictions;
+    double mLastLatencyMs = 0.0;
+};
+
+#endif // __MOCKINFERENCEENGINE_H__
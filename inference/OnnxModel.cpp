@@ -0,0 +1,283 @@
+#include "OnnxModel.h"
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+namespace
+{
+// Protobuf wire format: every field is a varint key (field number << 3 | wire type) followed by its payload.
+enum WireType
+{
+    kVarint = 0,
+    kFixed64 = 1,
+    kLengthDelimited = 2,
+    kFixed32 = 5,
+};
+
+class WireReader
+{
+public:
+    WireReader(const char *data, size_t size) : mData(reinterpret_cast<const uint8_t *>(data)), mSize(size) {}
+
+    bool done() const { return mPos >= mSize; }
+
+    uint64_t varint()
+    {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7)
+        {
+            require(1);
+            uint8_t byte = mData[mPos++];
+            value |= uint64_t(byte & 0x7f) << shift;
+            if (byte < 0x80)
+                return value;
+        }
+        throw std::runtime_error("varint too long");
+    }
+
+    // Reads the next key, \returns the field number and stores the wire type.
+    uint32_t field(uint32_t &wireType)
+    {
+        uint64_t key = varint();
+        wireType = key & 7;
+        return uint32_t(key >> 3);
+    }
+
+    WireReader message()
+    {
+        size_t size = varint();
+        require(size);
+        WireReader sub(reinterpret_cast<const char *>(mData + mPos), size);
+        mPos += size;
+        return sub;
+    }
+
+    std::string string()
+    {
+        WireReader sub = message();
+        return std::string(reinterpret_cast<const char *>(sub.mData), sub.mSize);
+    }
+
+    float fixed32Float()
+    {
+        require(4);
+        float value;
+        std::memcpy(&value, mData + mPos, 4);
+        mPos += 4;
+        return value;
+    }
+
+    void skip(uint32_t wireType)
+    {
+        switch (wireType)
+        {
+        case kVarint:
+            varint();
+            break;
+        case kFixed64:
+            require(8);
+            mPos += 8;
+            break;
+        case kLengthDelimited:
+            message();
+            break;
+        case kFixed32:
+            require(4);
+            mPos += 4;
+            break;
+        default:
+            throw std::runtime_error("unsupported wire type " + std::to_string(wireType));
+        }
+    }
+
+    // Repeated scalars may be packed into one length-delimited field or written one key at a time.
+    void int64s(uint32_t wireType, std::vector<int64_t> &out)
+    {
+        if (wireType == kLengthDelimited)
+        {
+            WireReader packed = message();
+            while (!packed.done())
+                out.push_back(int64_t(packed.varint()));
+        }
+        else
+        {
+            out.push_back(int64_t(varint()));
+        }
+    }
+
+    void floats(uint32_t wireType, std::vector<float> &out)
+    {
+        if (wireType == kLengthDelimited)
+        {
+            WireReader packed = message();
+            while (!packed.done())
+                out.push_back(packed.fixed32Float());
+        }
+        else
+        {
+            out.push_back(fixed32Float());
+        }
+    }
+
+    const uint8_t *data() const { return mData; }
+    size_t size() const { return mSize; }
+
+private:
+    void require(size_t bytes) const
+    {
+        if (mPos + bytes > mSize)
+            throw std::runtime_error("truncated message");
+    }
+
+    const uint8_t *mData;
+    size_t mSize;
+    size_t mPos = 0;
+};
+
+OnnxAttribute parseAttribute(WireReader reader)
+{
+    OnnxAttribute attr;
+    uint32_t wireType;
+    while (!reader.done())
+    {
+        switch (reader.field(wireType))
+        {
+        case 1: attr.name = reader.string(); break;
+        case 2: attr.f = reader.fixed32Float(); break;
+        case 3: attr.i = int64_t(reader.varint()); break;
+        case 4: attr.s = reader.string(); break;
+        case 7: reader.floats(wireType, attr.floats); break;
+        case 8: reader.int64s(wireType, attr.ints); break;
+        default: reader.skip(wireType); break;
+        }
+    }
+    return attr;
+}
+
+OnnxNode parseNode(WireReader reader)
+{
+    OnnxNode node;
+    uint32_t wireType;
+    while (!reader.done())
+    {
+        switch (reader.field(wireType))
+        {
+        case 1: node.inputs.push_back(reader.string()); break;
+        case 2: node.outputs.push_back(reader.string()); break;
+        case 3: node.name = reader.string(); break;
+        case 4: node.opType = reader.string(); break;
+        case 5: node.attributes.push_back(parseAttribute(reader.message())); break;
+        default: reader.skip(wireType); break;
+        }
+    }
+    return node;
+}
+
+OnnxTensor parseTensor(WireReader reader)
+{
+    OnnxTensor tensor;
+    std::string rawData;
+    uint32_t wireType;
+    while (!reader.done())
+    {
+        switch (reader.field(wireType))
+        {
+        case 1: reader.int64s(wireType, tensor.dims); break;
+        case 2: tensor.dataType = int32_t(reader.varint()); break;
+        case 4: reader.floats(wireType, tensor.floatData); break;
+        case 7: reader.int64s(wireType, tensor.int64Data); break;
+        case 8: tensor.name = reader.string(); break;
+        case 9: rawData = reader.string(); break;
+        default: reader.skip(wireType); break;
+        }
+    }
+    // raw_data is little-endian, like every platform this runs on.
+    if (!rawData.empty() && tensor.dataType == 1)
+    {
+        tensor.floatData.resize(rawData.size() / sizeof(float));
+        std::memcpy(tensor.floatData.data(), rawData.data(), tensor.floatData.size() * sizeof(float));
+    }
+    else if (!rawData.empty() && tensor.dataType == 7)
+    {
+        tensor.int64Data.resize(rawData.size() / sizeof(int64_t));
+        std::memcpy(tensor.int64Data.data(), rawData.data(), tensor.int64Data.size() * sizeof(int64_t));
+    }
+    return tensor;
+}
+
+// ValueInfoProto: only the name is needed, shapes are inferred from the initializers.
+std::string parseValueInfoName(WireReader reader)
+{
+    uint32_t wireType;
+    while (!reader.done())
+    {
+        if (reader.field(wireType) == 1)
+            return reader.string();
+        reader.skip(wireType);
+    }
+    return {};
+}
+
+void parseGraph(WireReader reader, OnnxGraph &graph)
+{
+    uint32_t wireType;
+    while (!reader.done())
+    {
+        switch (reader.field(wireType))
+        {
+        case 1: graph.nodes.push_back(parseNode(reader.message())); break;
+        case 2: graph.name = reader.string(); break;
+        case 5: graph.initializers.push_back(parseTensor(reader.message())); break;
+        case 11: graph.inputs.push_back(parseValueInfoName(reader.message())); break;
+        case 12: graph.outputs.push_back(parseValueInfoName(reader.message())); break;
+        default: reader.skip(wireType); break;
+        }
+    }
+}
+} // namespace
+
+bool loadOnnxModel(const std::string &fileName, OnnxGraph &graph)
+{
+    std::ifstream file(fileName, std::ios::in | std::ios::binary | std::ios::ate);
+    if (!file)
+    {
+        std::cerr << "Could not open ONNX model " << fileName << std::endl;
+        return false;
+    }
+    std::vector<char> contents(size_t(file.tellg()));
+    file.seekg(0, std::ios::beg);
+    file.read(contents.data(), contents.size());
+
+    try
+    {
+        graph = OnnxGraph{};
+        WireReader model(contents.data(), contents.size());
+        uint32_t wireType;
+        bool hasGraph = false;
+        while (!model.done())
+        {
+            // ModelProto.graph is field 7, everything else (producer, opset imports, metadata) is skipped.
+            if (model.field(wireType) == 7 && wireType == kLengthDelimited)
+            {
+                parseGraph(model.message(), graph);
+                hasGraph = true;
+            }
+            else
+            {
+                model.skip(wireType);
+            }
+        }
+        if (!hasGraph)
+        {
+            std::cerr << "ONNX model " << fileName << " has no graph" << std::endl;
+            return false;
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Malformed ONNX model " << fileName << ": " << e.what() << std::endl;
+        return false;
+    }
+    return true;
+}
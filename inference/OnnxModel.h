@@ -0,0 +1,67 @@
+#pragma once
+#ifndef __ONNXMODEL_H__
+#define __ONNXMODEL_H__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Just enough of the ONNX protobuf schema to load small inference graphs without linking protobuf: nodes with their
+// attributes, initializers with float or int64 data, and the graph's inputs and outputs.
+struct OnnxTensor
+{
+    std::string name;
+    std::vector<int64_t> dims;
+    int32_t dataType = 0; //!< onnx.TensorProto.DataType, 1 = FLOAT and 7 = INT64 are the only ones decoded
+    std::vector<float> floatData;
+    std::vector<int64_t> int64Data;
+};
+
+struct OnnxAttribute
+{
+    std::string name;
+    int64_t i = 0;
+    float f = 0.0f;
+    std::string s;
+    std::vector<int64_t> ints;
+    std::vector<float> floats;
+};
+
+struct OnnxNode
+{
+    std::string name;
+    std::string opType;
+    std::vector<std::string> inputs;
+    std::vector<std::string> outputs;
+    std::vector<OnnxAttribute> attributes;
+
+    const OnnxAttribute *attribute(const std::string &attributeName) const
+    {
+        for (const OnnxAttribute &attr : attributes)
+            if (attr.name == attributeName)
+                return &attr;
+        return nullptr;
+    }
+};
+
+struct OnnxGraph
+{
+    std::string name;
+    std::vector<OnnxNode> nodes;
+    std::vector<OnnxTensor> initializers;
+    std::vector<std::string> inputs;  //!< Includes the initializers for models exported with IR version < 4
+    std::vector<std::string> outputs;
+
+    const OnnxTensor *initializer(const std::string &tensorName) const
+    {
+        for (const OnnxTensor &tensor : initializers)
+            if (tensor.name == tensorName)
+                return &tensor;
+        return nullptr;
+    }
+};
+
+//! \brief Parses an .onnx file. \returns false and reports the reason on std::cerr if the file is missing or malformed.
+bool loadOnnxModel(const std::string &fileName, OnnxGraph &graph);
+
+#endif // __ONNXMODEL_H__
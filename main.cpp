@@ -4,11 +4,18 @@
 
 
 #include "Window.h"
+#include "Options.h"
 #include <memory>
 
 using namespace std;
-int main()
+int main(int argc, char **argv)
 {
+    Options::parse(argc, argv);
+    if (Options::settings().headless)
+    {
+        Renderer renderer(VkExtent2D{640, 640});
+        return renderer.runHeadless(Options::settings().frames) ? 0 : 1;
+    }
     std::unique_ptr<Window> window = std::make_unique<Window>();
 
     window->init(640,640);
@@ -1,3 +1,6 @@
-/usr/bin/glslc shader.frag -o shader.frag.spv
-/usr/bin/glslc shader.vert -o shader.vert.spv
-
+# Compiles every shader next to its source, for running from the source tree; the CMake build does the same into the
+# build directory.
+cd "$(dirname "$0")" || exit 1
+for source in *.vert *.frag *.comp; do
+    glslc "$source" -o "$source.spv" || exit 1
+done
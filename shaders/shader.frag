@@ -2,7 +2,15 @@
 #extension GL_ARB_separate_shader_objects : enable
 #extension GL_NV_gpu_shader5 : enable
 
-layout (binding = 1) uniform sampler2D samplerColor;
+// Every digit texture is bound at once; the push constant picks the one to draw, so switching digits needs no
+// descriptor set change. The array size is set from the renderer's texture count at pipeline creation.
+layout (constant_id = 0) const uint TEXTURE_COUNT = 10;
+layout (binding = 1) uniform sampler2D samplerColor[TEXTURE_COUNT];
+
+layout (push_constant) uniform PushConstants
+{
+        uint textureIndex;
+} pushConstants;
 
 layout (location = 0) in vec2 inUV;
 layout (location = 1) in float inLodBias;
@@ -14,7 +22,7 @@ layout (location = 0) out vec4 outFragColor;
 
 void main()
 {
-        vec4 color = texture(samplerColor, inUV);
+        vec4 color = texture(samplerColor[pushConstants.textureIndex], inUV);
 
 
         outFragColor = color;
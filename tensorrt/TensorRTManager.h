@@ -2,7 +2,20 @@
 #include "NvInferRuntime.h"   // For runtime APIs
 #include "NvOnnxParser.h"     // If parsing ONNX model (optional)
 #include "cuda_runtime_api.h" // For CUDA memory operations
+#include <algorithm>
+#include <cassert>
+#include <filesystem>
+#include <iostream>
 #include <memory>
+#include <span>
+#include <string>
+#include <vector>
+#include "engineCache.h"
+#include "CudaAllocations.h"
+#include "timingCache.h"
+#include "Benchmark.h"
+#include "InferenceEngine.h"
+#include "Options.h"
 using namespace nvinfer1;
 
 class Logger : public ILogger
@@ -14,11 +27,13 @@ class Logger : public ILogger
     }
 };
 
-class TensorRTManager
+class TensorRTManager : public InferenceEngine
 {
 public:
     int predictedDigit = -1;
-    int getPrediction() const {return predictedDigit;}
+    // Most recent finished result, never waits for the GPU. Call poll() to pick up completed requests.
+    int getPrediction() const override {return predictedDigit;}
+    const std::vector<int> &getBatchPredictions() const override { return mPredictions; }
 
 
     Logger logger;
@@ -28,79 +43,280 @@ public:
         std::vector<std::string> outputTensorNames;
     };
 
+    enum class TimingCacheMode
+    {
+        kDISABLED,   //!< Every build times all tactics from scratch
+        kREAD_ONLY,  //!< Reuse timings from the cache file but never write it
+        kREAD_WRITE, //!< Reuse timings and merge newly timed tactics back into the cache file
+    };
+
     struct OnnxSampleParams : public SampleParams
     {
-        std::string onnxFileName; //!< Filename of ONNX file of a network
+        std::string onnxFileName;    //!< Filename of ONNX file of a network
+        std::string engineCacheDir;  //!< Directory for serialized plans, empty disables the engine cache
+        bool fp16{false};            //!< Build with FP16 kernels when the platform has fast FP16
+        std::string timingCacheFile; //!< Tactic timing cache shared by all builds and worker processes
+        TimingCacheMode timingCacheMode{TimingCacheMode::kREAD_WRITE};
+        int32_t minBatch{1};         //!< Smallest batch the optimization profile accepts
+        int32_t optBatch{16};        //!< Batch size the builder picks tactics for
+        int32_t maxBatch{256};       //!< Largest batch a single enqueueV3 accepts, also sizes the I/O buffers
+        int32_t resultSlots{3};      //!< Requests that may be in flight before beginRequest() waits for the oldest one
     };
 
     OnnxSampleParams mParams;
-    nvinfer1::Dims mInputDims;                    //!< The dimensions of the input to the network.
-    nvinfer1::Dims mOutputDims;                   //!< The dimensions of the output to the network.
+    nvinfer1::Dims mInputDims;                    //!< The dimensions of the input to the network, batch is -1.
+    nvinfer1::Dims mOutputDims;                   //!< The dimensions of the output to the network, batch is -1.
     std::shared_ptr<nvinfer1::IRuntime> mRuntime; //!< The TensorRT runtime used to deserialize the engine
     std::shared_ptr<nvinfer1::ICudaEngine> mEngine;
     std::shared_ptr<nvinfer1::IExecutionContext> mContext;
 
-    TensorRTManager(cudaStream_t &stream)
+    TensorRTManager()
     {
         mParams.onnxFileName = "tensorModels/mnist.onnx";
+        mParams.engineCacheDir = "engineCache";
+        mParams.timingCacheFile = "engineCache/mnist.timing";
+        mParams.timingCacheMode = parseTimingCacheMode(Options::settings().timingCache);
         mParams.inputTensorNames.push_back("Input3");
         mParams.outputTensorNames.push_back("Plus214_Output_0");
+    }
 
-        build();
+    const char *name() const override { return "tensorrt"; }
 
+    bool load() override
+    {
+        if (!build())
+        {
+            return false;
+        }
+        createResultRing();
         std::cout << "TensorRTManager is initialized...\n";
+        return true;
+    }
+
+    bool warmup(InferenceStream stream) override
+    {
+#ifdef ENABLE_BENCHMARKS
+        benchmarkStartup();
+        benchmarkBatchThroughput(stream);
+#endif
+        if (!enqueue(1, stream))
+        {
+            return false;
+        }
+        finish(stream);
+        return true;
     }
 
     ~TensorRTManager()
     {
-        // Cleanup if needed
+        for (ResultSlot &slot : mResultSlots)
+        {
+            cudaEventSynchronize(slot.done);
+            cudaEventDestroy(slot.start);
+            cudaEventDestroy(slot.done);
+            cudaFreeHost(slot.hostScores);
+        }
+        mContext.reset();
+        if (mOwnsInput)
+        {
+            cudaFree(mDeviceInput);
+        }
+        cudaFree(mDeviceOutput);
     }
     bool build()
+    {
+        auto tStart = Benchmark::Clock::now();
+        mRuntime = std::shared_ptr<nvinfer1::IRuntime>(createInferRuntime(logger));
+        if (!mRuntime)
+        {
+            return false;
+        }
+
+        // A warm start skips parsing and building entirely and goes straight to deserializeCudaEngine.
+        std::string cacheKey, cacheFile;
+        if (!mParams.engineCacheDir.empty())
+        {
+            cacheKey = engineCacheKey();
+            cacheFile = nvinfer1::utils::engineCacheFileName(mParams.engineCacheDir, "mnist", cacheKey);
+            std::vector<char> cachedPlan = nvinfer1::utils::loadEngineCacheFile(logger, cacheFile, cacheKey);
+            if (!cachedPlan.empty() && createEngine(cachedPlan.data(), cachedPlan.size()))
+            {
+                std::cout << "TensorRT engine ready in " << Benchmark::elapsedMs(tStart) << " ms (warm start from " << cacheFile << ")\n";
+                return true;
+            }
+        }
+
+        std::shared_ptr<IHostMemory> plan = buildSerializedPlan();
+        if (!plan)
+        {
+            return false;
+        }
+        if (!cacheFile.empty())
+        {
+            nvinfer1::utils::saveEngineCacheFile(logger, cacheFile, cacheKey, plan->data(), plan->size());
+        }
+        if (!createEngine(plan->data(), plan->size()))
+        {
+            return false;
+        }
+        std::cout << "TensorRT engine ready in " << Benchmark::elapsedMs(tStart) << " ms (cold build)\n";
+        return true;
+    }
+
+    std::shared_ptr<IHostMemory> buildSerializedPlan()
     {
         auto builder = std::shared_ptr<nvinfer1::IBuilder>(nvinfer1::createInferBuilder(logger));
         if (!builder)
         {
-            return false;
+            return nullptr;
         }
 
         auto network = std::shared_ptr<nvinfer1::INetworkDefinition>(builder->createNetworkV2(0));
         if (!network)
         {
-            return false;
+            return nullptr;
         }
 
         auto config = std::shared_ptr<nvinfer1::IBuilderConfig>(builder->createBuilderConfig());
         if (!config)
         {
-            return false;
+            return nullptr;
         }
 
         auto parser = std::shared_ptr<nvonnxparser::IParser>(nvonnxparser::createParser(*network, logger));
         if (!parser)
         {
-            return false;
+            return nullptr;
         }
         if (!parser->parseFromFile(mParams.onnxFileName.c_str(), static_cast<int>(nvinfer1::ILogger::Severity::kWARNING)))
         {
             std::cerr << "ERROR: could not parse ONNX model." << std::endl;
-            return false;
+            return nullptr;
+        }
+        assert(network->getNbInputs() == 1);
+        assert(network->getNbOutputs() == 1);
+
+        if (!makeBatchDynamic(*network))
+        {
+            std::cerr << "ERROR: could not make the network batch dimension dynamic." << std::endl;
+            return nullptr;
+        }
+
+        nvinfer1::IOptimizationProfile *profile = builder->createOptimizationProfile();
+        const char *inputName = network->getInput(0)->getName();
+        profile->setDimensions(inputName, OptProfileSelector::kMIN, Dims4{mParams.minBatch, 1, 28, 28});
+        profile->setDimensions(inputName, OptProfileSelector::kOPT, Dims4{mParams.optBatch, 1, 28, 28});
+        profile->setDimensions(inputName, OptProfileSelector::kMAX, Dims4{mParams.maxBatch, 1, 28, 28});
+        config->addOptimizationProfile(profile);
+
+        if (mParams.fp16 && builder->platformHasFastFp16())
+        {
+            config->setFlag(BuilderFlag::kFP16);
+        }
+
+        // Tactic timings are shared through the timing cache file, so a build only times tactics that no earlier
+        // build (in this or any other worker process) has timed yet.
+        std::unique_ptr<nvinfer1::ITimingCache> timingCache;
+        int64_t cachedTactics = 0;
+        if (mParams.timingCacheMode != TimingCacheMode::kDISABLED)
+        {
+            std::filesystem::path timingCachePath(mParams.timingCacheFile);
+            if (timingCachePath.has_parent_path())
+            {
+                std::filesystem::create_directories(timingCachePath.parent_path());
+            }
+            timingCache = nvinfer1::utils::buildTimingCacheFromFile(logger, *config, mParams.timingCacheFile);
+            if (timingCache)
+            {
+                cachedTactics = timingCache->queryKeys(nullptr, 0);
+            }
         }
-        auto timingCache = std::shared_ptr<nvinfer1::ITimingCache>();
 
+        auto tBuild = Benchmark::Clock::now();
         std::shared_ptr<IHostMemory> plan{builder->buildSerializedNetwork(*network, *config)};
-        if (!plan)
+        double buildMs = Benchmark::elapsedMs(tBuild);
+
+        if (plan && timingCache)
         {
-            return false;
+            int64_t timedTactics = timingCache->queryKeys(nullptr, 0) - cachedTactics;
+            reportTimingCacheUse(buildMs, cachedTactics, timedTactics);
+            if (mParams.timingCacheMode == TimingCacheMode::kREAD_WRITE && timedTactics > 0)
+            {
+                nvinfer1::utils::updateTimingCacheFile(logger, mParams.timingCacheFile, timingCache.get(), *builder);
+            }
         }
+        return plan;
+    }
 
-        mRuntime = std::shared_ptr<nvinfer1::IRuntime>(createInferRuntime(logger));
-        if (!mRuntime)
+    static TimingCacheMode parseTimingCacheMode(const std::string &mode)
+    {
+        if (mode == "off")
+        {
+            return TimingCacheMode::kDISABLED;
+        }
+        if (mode == "read")
+        {
+            return TimingCacheMode::kREAD_ONLY;
+        }
+        if (mode != "readwrite")
+        {
+            std::cerr << "Unknown timing cache mode " << mode << ", using readwrite" << std::endl;
+        }
+        return TimingCacheMode::kREAD_WRITE;
+    }
+
+    // TensorRT does not count timing cache hits, and the file may hold entries of other networks and configurations,
+    // so only what the cache itself shows is reported: its size before the build and the timings the build added.
+    void reportTimingCacheUse(double buildMs, int64_t cachedTactics, int64_t timedTactics)
+    {
+        std::cout << "Engine build took " << buildMs << " ms: " << timedTactics << " tactic timings newly measured, "
+                  << cachedTactics << " cached in " << mParams.timingCacheFile << " before the build, "
+                  << cachedTactics + timedTactics << " after";
+        if (timedTactics == 0 && cachedTactics > 0)
+        {
+            std::cout << " (every timing came from the cache)";
+        }
+        std::cout << "\n";
+    }
+
+    // The exported model is fixed to batch 1: the input is [1,1,28,28] and the flatten before the dense layer reshapes
+    // to a constant [1,256]. Both are rewritten so the batch dimension flows through the whole network.
+    static bool makeBatchDynamic(nvinfer1::INetworkDefinition &network)
+    {
+        nvinfer1::ITensor *input = network.getInput(0);
+        nvinfer1::Dims inputDims = input->getDimensions();
+        if (inputDims.nbDims != 4)
         {
             return false;
         }
+        inputDims.d[0] = -1;
+        input->setDimensions(inputDims);
+
+        int32_t patched = 0;
+        for (int32_t i = 0; i < network.getNbLayers(); ++i)
+        {
+            nvinfer1::ILayer *layer = network.getLayer(i);
+            if (layer->getType() != LayerType::kSHUFFLE || layer->getNbInputs() != 1)
+            {
+                continue;
+            }
+            // Only reshapes of activations carry the batch; the weight reshape feeding the MatMul is left alone.
+            auto *shuffle = static_cast<nvinfer1::IShuffleLayer *>(layer);
+            nvinfer1::Dims reshapeDims = shuffle->getReshapeDimensions();
+            if (layer->getInput(0)->getDimensions().d[0] == -1 && reshapeDims.nbDims > 0 && reshapeDims.d[0] == 1)
+            {
+                reshapeDims.d[0] = -1;
+                shuffle->setReshapeDimensions(reshapeDims);
+                patched++;
+            }
+        }
+        return patched > 0;
+    }
 
-        mEngine = std::shared_ptr<nvinfer1::ICudaEngine>(
-            mRuntime->deserializeCudaEngine(plan->data(), plan->size()));
+    bool createEngine(const void *planData, size_t planSize)
+    {
+        mContext.reset();
+        mEngine = std::shared_ptr<nvinfer1::ICudaEngine>(mRuntime->deserializeCudaEngine(planData, planSize));
         if (!mEngine)
         {
             return false;
@@ -112,51 +328,354 @@ public:
             std::cerr << "Failed to create execution context!" << std::endl;
             return false;
         }
-        assert(network->getNbInputs() == 1);
-        mInputDims = network->getInput(0)->getDimensions();
+        assert(mEngine->getNbIOTensors() == 2);
+        mInputDims = mEngine->getTensorShape(mParams.inputTensorNames[0].c_str());
         assert(mInputDims.nbDims == 4);
 
-        assert(network->getNbOutputs() == 1);
-        mOutputDims = network->getOutput(0)->getDimensions();
+        mOutputDims = mEngine->getTensorShape(mParams.outputTensorNames[0].c_str());
         assert(mOutputDims.nbDims == 2);
 
+        nvinfer1::Dims maxDims = mEngine->getProfileShape(mParams.inputTensorNames[0].c_str(), 0, OptProfileSelector::kMAX);
+        mMaxBatch = maxDims.d[0];
+        mCurrentBatch = 0;
+
+        return allocateIOBuffers() && setBatchSize(1);
+    }
+
+    // Everything that changes the serialized plan has to be part of this string, otherwise a stale plan is reused.
+    std::string builderConfigFingerprint() const
+    {
+        return "fp16=" + std::to_string(mParams.fp16) + ";batch=" + std::to_string(mParams.minBatch) + "/" +
+               std::to_string(mParams.optBatch) + "/" + std::to_string(mParams.maxBatch);
+    }
+
+    std::string engineCacheKey() const
+    {
+        int device = 0;
+        cudaDeviceProp deviceProp;
+        cudaGetDevice(&device);
+        cudaGetDeviceProperties(&deviceProp, device);
+
+        std::vector<char> onnxContents = nvinfer1::utils::readBinaryFile(mParams.onnxFileName);
+        return nvinfer1::utils::computeEngineCacheKey(onnxContents, getInferLibVersion(), builderConfigFingerprint(),
+                                                      reinterpret_cast<const uint8_t *>(deviceProp.uuid.bytes), sizeof(deviceProp.uuid.bytes));
+    }
+
+#ifdef ENABLE_BENCHMARKS
+    // Compares a full parse + build against a load from the on-disk engine cache.
+    void benchmarkStartup()
+    {
+        if (mParams.engineCacheDir.empty())
+        {
+            return;
+        }
+        auto tStart = Benchmark::Clock::now();
+        std::shared_ptr<IHostMemory> plan = buildSerializedPlan();
+        bool coldOk = plan && createEngine(plan->data(), plan->size());
+        double coldMs = Benchmark::elapsedMs(tStart);
+
+        tStart = Benchmark::Clock::now();
+        std::string cacheKey = engineCacheKey();
+        std::string cacheFile = nvinfer1::utils::engineCacheFileName(mParams.engineCacheDir, "mnist", cacheKey);
+        std::vector<char> cachedPlan = nvinfer1::utils::loadEngineCacheFile(logger, cacheFile, cacheKey);
+        bool warmOk = !cachedPlan.empty() && createEngine(cachedPlan.data(), cachedPlan.size());
+        double warmMs = Benchmark::elapsedMs(tStart);
+
+        std::cout << "[Benchmark] TensorRT startup: cold build " << coldMs << " ms" << (coldOk ? "" : " (failed)")
+                  << ", warm cache load " << warmMs << " ms" << (warmOk ? "" : " (failed)") << std::endl;
+    }
+
+    // Images per second for each power-of-two batch size up to the profile maximum, timed with CUDA events.
+    void benchmarkBatchThroughput(cudaStream_t stream)
+    {
+        constexpr int kIterations = 50;
+        cudaEvent_t start, stop;
+        cudaEventCreate(&start);
+        cudaEventCreate(&stop);
+        cudaMemsetAsync(mDeviceInput, 0, mMaxBatch * sampleVolume(mInputDims) * sizeof(float), stream);
+
+        std::vector<int> predictions;
+        for (int32_t batch = 1; batch <= mMaxBatch; batch *= 2)
+        {
+            inferBatch(batch, stream, predictions); // warm-up, also applies the new input shape
+            cudaEventRecord(start, stream);
+            for (int i = 0; i < kIterations; ++i)
+            {
+                mContext->enqueueV3(stream);
+            }
+            cudaEventRecord(stop, stream);
+            cudaEventSynchronize(stop);
+
+            float ms = 0.0f;
+            cudaEventElapsedTime(&ms, start, stop);
+            double perBatchMs = ms / kIterations;
+            std::cout << "[Benchmark] batch " << batch << ": " << perBatchMs << " ms per enqueueV3, "
+                      << (batch * 1000.0 / perBatchMs) << " images/s" << std::endl;
+        }
+        setBatchSize(1);
+
+        cudaEventDestroy(start);
+        cudaEventDestroy(stop);
+    }
+#endif
+
+    // The I/O buffers are allocated once and bound to every execution context, so the per-frame path never touches
+    // the CUDA allocator (DeviceAllocations checks that).
+    bool allocateIOBuffers()
+    {
+        if (mDeviceInput == nullptr)
+        {
+            if (countedCudaMalloc(&mDeviceInput, mMaxBatch * sampleVolume(mInputDims) * sizeof(float)) != cudaSuccess)
+            {
+                return false;
+            }
+        }
+        if (mDeviceOutput == nullptr)
+        {
+            if (countedCudaMalloc(&mDeviceOutput, mMaxBatch * sampleVolume(mOutputDims) * sizeof(float)) != cudaSuccess)
+            {
+                return false;
+            }
+        }
+        return mContext->setTensorAddress(mParams.inputTensorNames[0].c_str(), mDeviceInput) &&
+               mContext->setTensorAddress(mParams.outputTensorNames[0].c_str(), mDeviceOutput);
+    }
+
+    // Volume of a single sample, i.e. every dimension except the leading batch.
+    static int64_t sampleVolume(const nvinfer1::Dims &dims)
+    {
+        int64_t v = 1;
+        for (int i = 1; i < dims.nbDims; ++i)
+            v *= dims.d[i];
+        return v;
+    }
+
+    // The input shape is only pushed to the context when the batch size actually changes.
+    bool setBatchSize(int32_t batch)
+    {
+        if (batch == mCurrentBatch)
+        {
+            return true;
+        }
+        if (batch < 1 || batch > maxBatchSize() ||
+            !mContext->setInputShape(mParams.inputTensorNames[0].c_str(), Dims4{batch, 1, 28, 28}))
+        {
+            std::cerr << "Unsupported batch size " << batch << " (max " << maxBatchSize() << ")" << std::endl;
+            return false;
+        }
+        mCurrentBatch = batch;
         return true;
     }
 
-    bool infer(float *d_input, cudaStream_t &stream)
+    //! Device buffer the preprocessing kernel writes the 28x28 input into. It holds maxBatchSize() samples back to
+    //! back, so batched producers can write sample i at offset i * 28 * 28.
+    InputLocation inputLocation() const override { return InputLocation::kDevice; }
+    float *inputBuffer() override { return mDeviceInput; }
+    int32_t maxBatchSize() const override { return mOwnsInput ? mMaxBatch : std::min(mMaxBatch, mInputCapacity); }
+    //! Binds memory another API writes the input into (e.g. an imported Vulkan buffer) and frees the engine's own.
+    //! The address is baked into captured CUDA graphs, so bind before capturing.
+    bool bindInputBuffer(float *device, int32_t capacity) override
     {
-        float *d_output;
-        cudaMalloc(&d_output, 10 * sizeof(float));
+        if (device == nullptr || capacity < 1 || !mContext->setTensorAddress(mParams.inputTensorNames[0].c_str(), device))
+        {
+            return false;
+        }
+        if (mOwnsInput)
+        {
+            cudaFree(mDeviceInput);
+            mOwnsInput = false;
+        }
+        mDeviceInput = device;
+        mInputCapacity = capacity;
+        return true;
+    }
+    bool supportsGraphCapture() const override { return true; }
 
-        // Print tensor names and modes
-        for (int i = 0, e = mEngine->getNbIOTensors(); i < e; ++i)
+    // Page-locked output slots, so the device-to-host copy of each request is truly asynchronous.
+    void createResultRing()
+    {
+        mResultSlots.resize(std::max(mParams.resultSlots, 1));
+        for (ResultSlot &slot : mResultSlots)
         {
-            const char *tensorName = mEngine->getIOTensorName(i);
-            nvinfer1::TensorIOMode mode = mEngine->getTensorIOMode(tensorName);
-            if (mode == nvinfer1::TensorIOMode::kINPUT)
-                mContext->setTensorAddress("Input3", d_input);
-            else
-                mContext->setTensorAddress("Plus214_Output_0", d_output);
+            countedCudaMallocHost(&slot.hostScores, mMaxBatch * sampleVolume(mOutputDims) * sizeof(float));
+            cudaEventCreate(&slot.start);
+            cudaEventCreate(&slot.done);
         }
+        mPredictions.reserve(mMaxBatch);
+    }
 
+    // A request never waits for the GPU: beginRequest() claims a ring slot and sets the input shape, enqueueNetwork()
+    // is the part that may be captured into a graph, completeRequest() copies the scores into the slot. Only when
+    // every slot is still in flight does beginRequest() block, on the oldest request.
+    bool beginRequest(int32_t batchSize, InferenceStream stream) override
+    {
+        ResultSlot &slot = mResultSlots[mNextSlot];
+        if (slot.inFlight)
+        {
+            cudaEventSynchronize(slot.done);
+            poll();
+        }
+        if (!setBatchSize(batchSize))
+        {
+            return false;
+        }
+        slot.batchSize = batchSize;
+        slot.submitted = Benchmark::Clock::now();
+        cudaEventRecord(slot.start, stream);
+        return true;
+    }
+
+    bool enqueueNetwork(InferenceStream stream) override
+    {
         if (!mContext->enqueueV3(stream))
         {
             std::cerr << "Failed to run inference!" << std::endl;
             return false;
         }
+        return true;
+    }
+
+    bool completeRequest(InferenceStream stream) override
+    {
+        ResultSlot &slot = mResultSlots[mNextSlot];
+        cudaMemcpyAsync(slot.hostScores, mDeviceOutput, slot.batchSize * sampleVolume(mOutputDims) * sizeof(float), cudaMemcpyDeviceToHost, stream);
+        cudaEventRecord(slot.done, stream);
+        slot.inFlight = true;
+        mNextSlot = (mNextSlot + 1) % mResultSlots.size();
+        return true;
+    }
+
+    // Harvests finished requests in submission order without blocking. \returns the number of results picked up.
+    int poll() override
+    {
+        int finished = 0;
+        const int64_t classes = sampleVolume(mOutputDims);
+        while (mResultSlots[mOldestSlot].inFlight && cudaEventQuery(mResultSlots[mOldestSlot].done) == cudaSuccess)
+        {
+            ResultSlot &slot = mResultSlots[mOldestSlot];
+            mPredictions.clear();
+            for (int32_t b = 0; b < slot.batchSize; ++b)
+            {
+                const float *scores = slot.hostScores + b * classes;
+                int maxIdx = 0;
+                for (int i = 1; i < classes; ++i)
+                    if (scores[i] > scores[maxIdx])
+                        maxIdx = i;
+                mPredictions.push_back(maxIdx);
+            }
+            predictedDigit = mPredictions.front();
 
-        float h_output[10];
+            // Host latency is measured when the result is observed, so it includes up to one poll interval.
+            mLastLatencyMs = Benchmark::elapsedMs(slot.submitted);
+            cudaEventElapsedTime(&mLastGpuMs, slot.start, slot.done);
+            slot.inFlight = false;
+            mOldestSlot = (mOldestSlot + 1) % mResultSlots.size();
+            finished++;
+        }
+        return finished;
+    }
 
-        cudaMemcpyAsync(h_output, d_output, 10 * sizeof(float), cudaMemcpyDeviceToHost, stream);
+    void finish(InferenceStream stream) override
+    {
         cudaStreamSynchronize(stream);
+        poll();
+    }
+
+    //! Submit-to-result latency of the most recent finished request, as seen by the host.
+    double getLastLatencyMs() const override { return mLastLatencyMs; }
+    //! GPU time between the start of the request and its scores reaching pinned memory.
+    float getLastGpuMs() const override { return mLastGpuMs; }
 
-        int maxIdx = 0;
-        for (int i = 1; i < 10; ++i)
-            if (h_output[i] > h_output[maxIdx])
-                maxIdx = i;
-        
-        predictedDigit = maxIdx; 
-        cudaFree(d_output);
+    // Blocking variant for callers that need the result of this exact request.
+    bool infer(cudaStream_t &stream)
+    {
+        if (!enqueue(1, stream))
+        {
+            return false;
+        }
+        finish(stream);
         return true;
     }
+
+    // Classifies the first batchSize samples already written to inputBuffer() with a single enqueueV3. Like the span
+    // overload, predictions holds exactly this batch's results afterwards.
+    bool inferBatch(int32_t batchSize, cudaStream_t &stream, std::vector<int> &predictions)
+    {
+        predictions.clear();
+        return appendBatchPredictions(batchSize, stream, predictions);
+    }
+
+    // Classifies any number of 28x28 crops. Each pointer may be host or device memory (cudaMemcpyDefault resolves it
+    // through UVA); crops are packed into the bound input buffer and run in chunks of at most maxBatchSize().
+    bool inferBatch(std::span<const float *const> inputs, cudaStream_t &stream, std::vector<int> &predictions)
+    {
+        predictions.clear();
+        predictions.reserve(inputs.size());
+        const int64_t sampleSize = sampleVolume(mInputDims);
+        const int32_t maxBatch = maxBatchSize();
+        for (size_t first = 0; first < inputs.size(); first += maxBatch)
+        {
+            int32_t batch = static_cast<int32_t>(std::min<size_t>(maxBatch, inputs.size() - first));
+            for (int32_t b = 0; b < batch; ++b)
+            {
+                cudaMemcpyAsync(mDeviceInput + b * sampleSize, inputs[first + b], sampleSize * sizeof(float),
+                                cudaMemcpyDefault, stream);
+            }
+            if (!appendBatchPredictions(batch, stream, predictions))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    // Runs one enqueueV3 on the first batchSize samples of the input buffer and appends their digits to predictions.
+    bool appendBatchPredictions(int32_t batchSize, cudaStream_t &stream, std::vector<int> &predictions)
+    {
+        if (!setBatchSize(batchSize) || !mContext->enqueueV3(stream))
+        {
+            std::cerr << "Failed to run batched inference!" << std::endl;
+            return false;
+        }
+
+        const int64_t classes = sampleVolume(mOutputDims);
+        std::vector<float> h_output(batchSize * classes);
+        cudaMemcpyAsync(h_output.data(), mDeviceOutput, h_output.size() * sizeof(float), cudaMemcpyDeviceToHost, stream);
+        cudaStreamSynchronize(stream);
+
+        for (int32_t b = 0; b < batchSize; ++b)
+        {
+            const float *scores = h_output.data() + b * classes;
+            int maxIdx = 0;
+            for (int i = 1; i < classes; ++i)
+                if (scores[i] > scores[maxIdx])
+                    maxIdx = i;
+            predictions.push_back(maxIdx);
+        }
+        return true;
+    }
+
+    struct ResultSlot
+    {
+        float *hostScores = nullptr; //!< Pinned copy of the network output
+        cudaEvent_t start = nullptr;
+        cudaEvent_t done = nullptr;  //!< Recorded after the copy, so a completed query means the scores are readable
+        int32_t batchSize = 1;
+        Benchmark::Clock::time_point submitted;
+        bool inFlight = false;
+    };
+
+    float *mDeviceInput = nullptr;
+    bool mOwnsInput = true;      //!< False once bindInputBuffer() replaced mDeviceInput
+    int32_t mInputCapacity = 0;  //!< Samples a bound input buffer holds
+    float *mDeviceOutput = nullptr;
+    int32_t mMaxBatch = 1;
+    int32_t mCurrentBatch = 0;
+    std::vector<ResultSlot> mResultSlots;
+    std::vector<int> mPredictions;
+    size_t mNextSlot = 0;
+    size_t mOldestSlot = 0;
+    double mLastLatencyMs = 0.0;
+    float mLastGpuMs = 0.0f;
 };
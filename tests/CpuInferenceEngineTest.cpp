@@ -0,0 +1,119 @@
+// The CPU engine on the bundled model and digit textures, and its SIMD convolution against the scalar one.
+#include "TestCheck.h"
+#include "CpuInferenceEngine.h"
+#include "CpuKernels.h"
+#include "MnistPreprocess.h"
+#include "PnmLoader.h"
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+constexpr int kDigits = 10;
+constexpr size_t kSampleSize = kMnistSize * kMnistSize;
+
+// textures/digit_rgba<d>.ppm shows digit d; the renderer preprocesses it with the default settings.
+bool loadDigit(int digit, float *sample)
+{
+    const std::string path = "textures/digit_rgba" + std::to_string(digit) + ".ppm";
+    Pnm::Image image;
+    std::string error;
+    if (!image.open(path, error))
+    {
+        std::fprintf(stderr, "%s: %s\n", path.c_str(), error.c_str());
+        return false;
+    }
+    std::vector<unsigned char> rgba(image.rgbaSize());
+    image.decodeRgba(rgba.data());
+    std::vector<float> work(size_t(kMnistWorkSize) * kMnistWorkSize);
+    mnistPreprocessHost(rgba.data(), int(image.width()), int(image.height()), MnistPreprocessConfig{}, work.data(), sample);
+    return true;
+}
+
+void testBundledDigits()
+{
+    CpuInferenceEngine engine;
+    CHECK(engine.build());
+    CHECK(engine.sampleInputSize() == kSampleSize);
+    CHECK(engine.sampleOutputSize() == kDigits);
+
+    float *input = engine.inputBuffer();
+    for (int digit = 0; digit < kDigits; ++digit)
+    {
+        CHECK(loadDigit(digit, input + digit * kSampleSize));
+    }
+
+    std::vector<int> predictions;
+    CHECK(engine.inferBatch(kDigits, predictions));
+    CHECK(predictions.size() == size_t(kDigits));
+    for (size_t digit = 0; digit < predictions.size(); ++digit)
+    {
+        if (predictions[digit] != int(digit))
+        {
+            std::fprintf(stderr, "digit_rgba%zu.ppm classified as %d\n", digit, predictions[digit]);
+            TestCheck::failures()++;
+        }
+    }
+
+    // A single sample goes through the same arena: the last digit alone gives the same answer.
+    std::copy(input + (kDigits - 1) * kSampleSize, input + kDigits * kSampleSize, input);
+    CHECK(engine.infer());
+    CHECK(engine.getPrediction() == kDigits - 1);
+}
+
+// Runs shape through the kernel selectConvKernel() picks and through convScalar(), on the same random data.
+void compareConv(const ConvShape &shape, bool relu)
+{
+    std::mt19937 random(shape.inC * 131 + shape.outC * 17 + shape.outW);
+    std::uniform_real_distribution<float> value(-1.0f, 1.0f);
+    std::vector<float> padded(size_t(shape.inC) * shape.paddedH * shape.paddedW + kConvReadSlack);
+    std::vector<float> weights(size_t(shape.outC) * shape.inC * shape.kH * shape.kW);
+    std::vector<float> bias(shape.outC);
+    for (float &v : padded)
+        v = value(random);
+    for (float &v : weights)
+        v = value(random);
+    for (float &v : bias)
+        v = value(random);
+
+    const char *name = nullptr;
+    ConvKernel kernel = selectConvKernel(shape, &name);
+    const size_t outSize = size_t(shape.outC) * shape.outH * shape.outW;
+    // One guard value past the output catches a tail store running over.
+    std::vector<float> out(outSize + 1, 1234.0f), reference(outSize);
+    kernel(padded.data(), weights.data(), bias.data(), out.data(), shape, relu);
+    convScalar(padded.data(), weights.data(), bias.data(), reference.data(), shape, relu);
+
+    float maxError = 0.0f;
+    for (size_t i = 0; i < outSize; ++i)
+        maxError = std::max(maxError, std::fabs(out[i] - reference[i]));
+    // Accumulation order differs (FMA, vector lanes); a few ulps of a sum of up to inC * 25 terms.
+    if (maxError > 1e-4f)
+    {
+        std::fprintf(stderr, "%s conv %dx%d -> %dx%dx%d: max error %g\n", name, shape.inC, shape.paddedW, shape.outC, shape.outH,
+                     shape.outW, maxError);
+        TestCheck::failures()++;
+    }
+    CHECK(out[outSize] == 1234.0f);
+}
+
+void testConvKernels()
+{
+    // The two convolutions of mnist.onnx: 5x5 "same" on 1x28x28 and 8x14x14.
+    compareConv({1, 8, 5, 5, 1, 1, 32, 32, 28, 28}, true);
+    compareConv({8, 16, 5, 5, 1, 1, 18, 18, 14, 14}, true);
+    // Widths that leave a partial vector, an output channel count that is not a multiple of the block, no ReLU.
+    compareConv({3, 6, 3, 3, 1, 1, 15, 15, 13, 13}, false);
+    compareConv({2, 5, 5, 5, 1, 1, 9, 11, 5, 7}, true);
+}
+} // namespace
+
+int main()
+{
+    testBundledDigits();
+    testConvKernels();
+    return TestCheck::failures();
+}
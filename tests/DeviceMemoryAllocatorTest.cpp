@@ -0,0 +1,208 @@
+// DeviceMemoryAllocator on a backend that hands out host memory, so block placement can be checked without a GPU.
+#include "TestCheck.h"
+#include "DeviceMemoryAllocator.h"
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+constexpr VkDeviceSize kBlockSize = VkDeviceSize(1) << 20;
+constexpr uint32_t kDeviceLocal = 0;
+constexpr uint32_t kHostVisible = 1;
+
+class HostMemoryBackend : public DeviceMemoryBackend
+{
+public:
+    VkResult allocate(const VkMemoryAllocateInfo &allocateInfo, VkDeviceMemory &memory) override
+    {
+        void *data = std::malloc(allocateInfo.allocationSize);
+        if (data == nullptr)
+            return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+        // Every byte handed out is written, so an allocation running past its memory shows up under a sanitizer.
+        std::memset(data, 0xcd, allocateInfo.allocationSize);
+        memory = (VkDeviceMemory)(uintptr_t)data;
+        live++;
+        return VK_SUCCESS;
+    }
+    void free(VkDeviceMemory memory) override
+    {
+        std::free((void *)(uintptr_t)memory);
+        live--;
+    }
+    VkResult map(VkDeviceMemory memory, void **data) override
+    {
+        *data = (void *)(uintptr_t)memory;
+        return VK_SUCCESS;
+    }
+
+    uint32_t live = 0;
+};
+
+VkPhysicalDeviceMemoryProperties memoryProperties()
+{
+    VkPhysicalDeviceMemoryProperties properties{};
+    properties.memoryHeapCount = 2;
+    properties.memoryHeaps[0].size = VkDeviceSize(1) << 30;
+    properties.memoryHeaps[1].size = VkDeviceSize(1) << 30;
+    properties.memoryTypeCount = 2;
+    properties.memoryTypes[kDeviceLocal] = {VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0};
+    properties.memoryTypes[kHostVisible] = {VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 1};
+    return properties;
+}
+
+VkMemoryRequirements requirements(VkDeviceSize size, VkDeviceSize alignment)
+{
+    return VkMemoryRequirements{size, alignment, 0x3};
+}
+
+void testBuddySplitAndMerge()
+{
+    HostMemoryBackend backend;
+    DeviceMemoryAllocator allocator(backend, memoryProperties(), DeviceMemoryAllocator::Limits{}, kBlockSize);
+    CHECK(allocator.blockSizeFor(kDeviceLocal) == kBlockSize);
+
+    MemoryAllocation a = allocator.allocate(requirements(256, 256), kDeviceLocal);
+    MemoryAllocation b = allocator.allocate(requirements(200, 4), kDeviceLocal);
+    MemoryAllocation c = allocator.allocate(requirements(1000, 16), kDeviceLocal);
+    CHECK(a.offset == 0 && a.size == 256);
+    CHECK(b.offset == 256 && b.size == 256); // Rounded up to the smallest buddy
+    CHECK(c.offset == 1024 && c.size == 1024);
+    CHECK(a.memory == b.memory && b.memory == c.memory);
+    CHECK(allocator.stats().blocks == 1 && allocator.stats().deviceAllocations == 1);
+
+    // A large alignment is met by taking a buddy of at least that size.
+    MemoryAllocation aligned = allocator.allocate(requirements(256, 4096), kDeviceLocal);
+    CHECK(aligned.offset % 4096 == 0 && aligned.size == 4096);
+
+    // The two 256 byte buddies merge back into the 512 byte one they were split from.
+    allocator.free(a);
+    allocator.free(b);
+    CHECK(!a && !b);
+    MemoryAllocation merged = allocator.allocate(requirements(512, 1), kDeviceLocal);
+    CHECK(merged.offset == 0);
+
+    // With everything freed the block is whole again and the last block of the pool is kept.
+    allocator.free(merged);
+    allocator.free(c);
+    allocator.free(aligned);
+    CHECK(allocator.stats().blocks == 1 && allocator.stats().bytesUsed == 0);
+    MemoryAllocation lower = allocator.allocate(requirements(kBlockSize / 2, 1), kDeviceLocal);
+    MemoryAllocation upper = allocator.allocate(requirements(kBlockSize / 2, 1), kDeviceLocal);
+    CHECK(lower.offset == 0 && upper.offset == kBlockSize / 2 && lower.memory == upper.memory);
+
+    // A full block makes room with a second one, which goes back to the device once it is empty.
+    MemoryAllocation spill = allocator.allocate(requirements(256, 1), kDeviceLocal);
+    CHECK(spill.memory != lower.memory && spill.block != lower.block);
+    CHECK(allocator.stats().blocks == 2 && backend.live == 2);
+    allocator.free(spill);
+    CHECK(allocator.stats().blocks == 1 && backend.live == 1);
+    allocator.free(lower);
+    allocator.free(upper);
+    CHECK(allocator.stats().allocations == 0);
+}
+
+void testLinearRewind()
+{
+    HostMemoryBackend backend;
+    DeviceMemoryAllocator allocator(backend, memoryProperties(), DeviceMemoryAllocator::Limits{}, kBlockSize);
+    const auto linear = DeviceMemoryAllocator::Strategy::Linear;
+
+    MemoryAllocation a = allocator.allocate(requirements(1000, 16), kHostVisible, linear);
+    MemoryAllocation b = allocator.allocate(requirements(100, 256), kHostVisible, linear);
+    CHECK(a.offset == 0 && a.size == 1000);
+    CHECK(b.offset == 1024 && b.size == 100);
+    char *const base = static_cast<char *>(a.mapped);
+    CHECK(base != nullptr && static_cast<char *>(b.mapped) == base + 1024);
+    std::memset(b.mapped, 0, b.size);
+
+    // Freeing part of the block does not move the head back...
+    allocator.free(a);
+    MemoryAllocation c = allocator.allocate(requirements(16, 16), kHostVisible, linear);
+    CHECK(c.offset == 1136);
+    // ...emptying it does.
+    allocator.free(b);
+    allocator.free(c);
+    MemoryAllocation d = allocator.allocate(requirements(16, 16), kHostVisible, linear);
+    CHECK(d.offset == 0 && d.mapped == base);
+    CHECK(allocator.stats().blocks == 1 && backend.live == 1);
+    allocator.free(d);
+}
+
+void testDedicatedThreshold()
+{
+    HostMemoryBackend backend;
+    DeviceMemoryAllocator allocator(backend, memoryProperties(), DeviceMemoryAllocator::Limits{}, kBlockSize);
+
+    MemoryAllocation half = allocator.allocate(requirements(kBlockSize / 2, 256), kDeviceLocal);
+    CHECK(half.block >= 0);
+    CHECK(allocator.stats().dedicated == 0);
+
+    MemoryAllocation large = allocator.allocate(requirements(kBlockSize / 2 + 1, 256), kDeviceLocal);
+    CHECK(large.block == -1 && large.offset == 0 && large.size == kBlockSize / 2 + 1);
+    CHECK(large.memory != half.memory);
+    CHECK(allocator.stats().dedicated == 1 && allocator.stats().deviceAllocations == 2);
+
+    allocator.free(large);
+    CHECK(allocator.stats().dedicated == 0 && backend.live == 1);
+    allocator.free(half);
+}
+
+void testAllocationCountLimit()
+{
+    HostMemoryBackend backend;
+    DeviceMemoryAllocator::Limits limits;
+    limits.maxMemoryAllocationCount = 2;
+    DeviceMemoryAllocator allocator(backend, memoryProperties(), limits, kBlockSize);
+
+    MemoryAllocation first = allocator.allocate(requirements(kBlockSize, 1), kDeviceLocal);
+    MemoryAllocation second = allocator.allocate(requirements(kBlockSize, 1), kDeviceLocal);
+    bool threw = false;
+    try
+    {
+        allocator.allocate(requirements(256, 1), kHostVisible);
+    }
+    catch (const std::runtime_error &)
+    {
+        threw = true;
+    }
+    CHECK(threw);
+    CHECK(backend.live == 2 && allocator.stats().deviceAllocations == 2);
+
+    allocator.free(first);
+    MemoryAllocation third = allocator.allocate(requirements(256, 1), kHostVisible);
+    CHECK(third);
+    allocator.free(second);
+    allocator.free(third);
+}
+
+void testAlignmentLargerThanBlock()
+{
+    HostMemoryBackend backend;
+    DeviceMemoryAllocator allocator(backend, memoryProperties(), DeviceMemoryAllocator::Limits{}, kBlockSize);
+
+    bool threw = false;
+    try
+    {
+        allocator.allocate(requirements(256, kBlockSize * 2), kDeviceLocal);
+    }
+    catch (const std::runtime_error &)
+    {
+        threw = true;
+    }
+    CHECK(threw);
+    // The block created for it is released again.
+    CHECK(backend.live == 0);
+    CHECK(allocator.stats().deviceAllocations == 0 && allocator.stats().blocks == 0 && allocator.stats().bytesReserved == 0);
+}
+} // namespace
+
+int main()
+{
+    testBuddySplitAndMerge();
+    testLinearRewind();
+    testDedicatedThreshold();
+    testAllocationCountLimit();
+    testAlignmentLargerThanBlock();
+    return TestCheck::failures();
+}
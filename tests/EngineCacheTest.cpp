@@ -0,0 +1,116 @@
+// Engine cache key and file format, exercised with fake plan blobs; no GPU or TensorRT runtime involved.
+#include "TestCheck.h"
+#include "engineCache.h"
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace nvinfer1::utils;
+
+namespace
+{
+class QuietLogger : public nvinfer1::ILogger
+{
+    void log(Severity, char const*) noexcept override {}
+};
+
+void writeFile(std::string const& fileName, std::vector<char> const& content)
+{
+    std::ofstream(fileName, std::ios::binary | std::ios::trunc).write(content.data(), content.size());
+}
+
+void testKey()
+{
+    std::vector<char> const onnx = {'o', 'n', 'n', 'x', 1, 2, 3};
+    uint8_t const uuid[16] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16};
+    std::string const key = computeEngineCacheKey(onnx, 100300, "fp32;batch=1", uuid, sizeof(uuid));
+
+    CHECK(key == computeEngineCacheKey(onnx, 100300, "fp32;batch=1", uuid, sizeof(uuid)));
+    CHECK(key.find_first_not_of("0123456789abcdef_") == std::string::npos);
+
+    std::vector<char> otherOnnx = onnx;
+    otherOnnx.back() = 4;
+    uint8_t otherUuid[16];
+    std::copy(std::begin(uuid), std::end(uuid), otherUuid);
+    otherUuid[15] = 0;
+    CHECK(key != computeEngineCacheKey(otherOnnx, 100300, "fp32;batch=1", uuid, sizeof(uuid)));
+    CHECK(key != computeEngineCacheKey(onnx, 100301, "fp32;batch=1", uuid, sizeof(uuid)));
+    CHECK(key != computeEngineCacheKey(onnx, 100300, "fp16;batch=1", uuid, sizeof(uuid)));
+    CHECK(key != computeEngineCacheKey(onnx, 100300, "fp32;batch=1", otherUuid, sizeof(otherUuid)));
+}
+
+void testRoundTrip(std::filesystem::path const& dir)
+{
+    QuietLogger logger;
+    std::string const fileName = engineCacheFileName(dir.string(), "mnist", "k1");
+    std::vector<char> const plan = {'p', 'l', 'a', 'n', 0, 1, 2, 3, 4};
+
+    CHECK(loadEngineCacheFile(logger, fileName, "k1").empty());
+    CHECK(saveEngineCacheFile(logger, fileName, "k1", plan.data(), plan.size()));
+    CHECK(loadEngineCacheFile(logger, fileName, "k1") == plan);
+    // A file written for another key, or one of the same length, is a miss.
+    CHECK(loadEngineCacheFile(logger, fileName, "k2").empty());
+    CHECK(loadEngineCacheFile(logger, fileName, "k10").empty());
+}
+
+void testCorruptFiles(std::filesystem::path const& dir)
+{
+    QuietLogger logger;
+    std::string const fileName = engineCacheFileName(dir.string(), "mnist", "key");
+    std::vector<char> const plan(64, 'x');
+    CHECK(saveEngineCacheFile(logger, fileName, "key", plan.data(), plan.size()));
+    std::vector<char> const content = readBinaryFile(fileName);
+    CHECK(content.size() > plan.size());
+
+    std::vector<char> truncated(content.begin(), content.end() - 1);
+    writeFile(fileName, truncated);
+    CHECK(loadEngineCacheFile(logger, fileName, "key").empty());
+
+    std::vector<char> headerOnly(content.begin(), content.begin() + 10);
+    writeFile(fileName, headerOnly);
+    CHECK(loadEngineCacheFile(logger, fileName, "key").empty());
+
+    std::vector<char> badMagic = content;
+    badMagic[0] ^= 0x20;
+    writeFile(fileName, badMagic);
+    CHECK(loadEngineCacheFile(logger, fileName, "key").empty());
+
+    writeFile(fileName, content);
+    CHECK(loadEngineCacheFile(logger, fileName, "key") == plan);
+}
+
+void testTemporaryFile(std::filesystem::path const& dir)
+{
+    QuietLogger logger;
+    std::string const fileName = engineCacheFileName((dir / "nested").string(), "mnist", "key");
+    std::string const tmpFileName = fileName + ".tmp";
+    std::vector<char> const first(16, 'a');
+    std::vector<char> const second(32, 'b');
+
+    // Creates missing directories, and leaves no temporary file behind once the plan is in place.
+    CHECK(saveEngineCacheFile(logger, fileName, "key", first.data(), first.size()));
+    CHECK(!std::filesystem::exists(tmpFileName));
+
+    // A temporary file left behind by a writer that died is overwritten, and the rename replaces the old plan.
+    writeFile(tmpFileName, {'s', 't', 'a', 'l', 'e'});
+    CHECK(saveEngineCacheFile(logger, fileName, "key", second.data(), second.size()));
+    CHECK(!std::filesystem::exists(tmpFileName));
+    CHECK(loadEngineCacheFile(logger, fileName, "key") == second);
+}
+} // namespace
+
+int main()
+{
+    std::filesystem::path const dir = std::filesystem::temp_directory_path() / "engine_cache_test";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+
+    testKey();
+    testRoundTrip(dir);
+    testCorruptFiles(dir);
+    testTemporaryFile(dir);
+
+    std::filesystem::remove_all(dir);
+    return TestCheck::failures();
+}
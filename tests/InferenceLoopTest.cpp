@@ -0,0 +1,51 @@
+// The frame loop's use of an engine, enqueue then poll, repeated for 10k frames on the host engines: no CUDA
+// allocation may happen and every request has to come back.
+#include "TestCheck.h"
+#include "CpuInferenceEngine.h"
+#include "DeviceAllocations.h"
+#include "MockInferenceEngine.h"
+#include <cstdio>
+
+namespace
+{
+constexpr int kFrames = 10000;
+
+void runFrames(InferenceEngine &engine)
+{
+    CHECK(engine.load());
+    CHECK(engine.warmup(nullptr));
+    const size_t allocations = DeviceAllocations::count();
+
+    int finished = 0;
+    for (int frame = 0; frame < kFrames; ++frame)
+    {
+        // A different input every frame, as the texture switcher would give.
+        engine.inputBuffer()[(frame * 29) % (28 * 28)] = float(frame % 10) / 10.0f;
+        if (!engine.enqueue(1, nullptr))
+        {
+            std::fprintf(stderr, "%s: enqueue failed at frame %d\n", engine.name(), frame);
+            TestCheck::failures()++;
+            return;
+        }
+        finished += engine.poll();
+    }
+    engine.finish(nullptr);
+    finished += engine.poll();
+
+    CHECK(finished == kFrames);
+    CHECK(engine.getBatchPredictions().size() == 1);
+    CHECK(engine.getPrediction() >= 0 && engine.getPrediction() < 10);
+    CHECK(DeviceAllocations::count() == allocations);
+}
+} // namespace
+
+int main()
+{
+    MockInferenceEngine mock;
+    runFrames(mock);
+
+    CpuInferenceEngine cpu;
+    runFrames(cpu);
+
+    return TestCheck::failures();
+}
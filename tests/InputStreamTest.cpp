@@ -0,0 +1,157 @@
+// InputStream on file: and dir: sources in a temporary directory, consumed slower than they are produced: the queue
+// may never hold more than its capacity and the host memory held for frames may not grow with the frames that pass.
+#include "TestCheck.h"
+#include "InputStream.h"
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+namespace
+{
+constexpr uint32_t kWidth = 8;
+constexpr uint32_t kHeight = 8;
+constexpr size_t kFrameBytes = kWidth * kHeight * 4;
+constexpr size_t kCapacity = 3;
+
+void writeFile(const std::filesystem::path &path, const std::string &contents)
+{
+    std::ofstream file(path, std::ios::binary);
+    file.write(contents.data(), std::streamsize(contents.size()));
+}
+
+std::string ppm(uint32_t width, uint32_t height, unsigned char value)
+{
+    return "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n" + std::string(size_t(width) * height * 3, char(value));
+}
+
+// Pops frames until count have been seen or the stream stops producing, checking the bounds after every pop.
+std::vector<InputStream::Frame> drain(InputStream &stream, size_t count, size_t hostBytes)
+{
+    std::vector<InputStream::Frame> frames;
+    InputStream::Frame frame;
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (frames.size() < count && std::chrono::steady_clock::now() < deadline)
+    {
+        const InputStream::Metrics metrics = stream.metrics();
+        CHECK(metrics.depth <= kCapacity && metrics.maxDepth <= kCapacity);
+        CHECK(stream.hostBytes() <= hostBytes);
+        if (metrics.finished)
+        {
+            break;
+        }
+        // A slow consumer: the producer fills the queue between pops.
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        if (stream.pop(frame))
+        {
+            CHECK(frame.pixels.size() == kFrameBytes);
+            frames.push_back(frame);
+        }
+    }
+    return frames;
+}
+
+void testFileSource(const std::filesystem::path &dir)
+{
+    // 20 raw frames, each filled with its index, and half a frame that has to be rejected.
+    constexpr size_t kFrames = 20;
+    std::string contents;
+    for (size_t i = 0; i < kFrames; ++i)
+    {
+        contents += std::string(kFrameBytes, char(i));
+    }
+    contents += std::string(kFrameBytes / 2, char(0xff));
+    const std::filesystem::path path = dir / "frames.rgba";
+    writeFile(path, contents);
+
+    std::unique_ptr<InputStream> stream = InputStream::open("file:" + path.string(), kWidth, kHeight, kCapacity);
+    CHECK(stream != nullptr);
+    if (!stream)
+    {
+        return;
+    }
+    const size_t hostBytes = stream->hostBytes();
+    CHECK(hostBytes == (kCapacity + 1) * kFrameBytes);
+
+    // Unconsumed, the producer stops at a full queue.
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    CHECK(stream->metrics().depth == kCapacity);
+    CHECK(stream->metrics().received == kCapacity);
+
+    const std::vector<InputStream::Frame> frames = drain(*stream, kFrames + 1, hostBytes);
+    CHECK(frames.size() == kFrames);
+    for (size_t i = 0; i < frames.size(); ++i)
+    {
+        CHECK(frames[i].pixels[0] == i && frames[i].pixels[kFrameBytes - 1] == i);
+    }
+    const InputStream::Metrics metrics = stream->metrics();
+    CHECK(metrics.finished);
+    CHECK(metrics.received == kFrames && metrics.consumed == kFrames && metrics.rejected == 1);
+    CHECK(metrics.maxDepth == kCapacity);
+    CHECK(stream->hostBytes() == hostBytes);
+}
+
+void testDirectorySource(const std::filesystem::path &dir)
+{
+    // Written in name order, so modification time and name order agree. Odd sizes are scaled through the scratch
+    // image; a file that is not an image and one wider than kMaxSourceEdge are skipped.
+    const std::filesystem::path input = dir / "input";
+    std::filesystem::create_directory(input);
+    writeFile(input / "a.ppm", ppm(kWidth, kHeight, 1));
+    writeFile(input / "b.ppm", ppm(3, 5, 2));
+    writeFile(input / "c.ppm", "P6\n8 8\n255\n");
+    writeFile(input / "d.pgm", "P5\n4097 1\n255\n" + std::string(4097, char(4)));
+    writeFile(input / "e.ppm", ppm(2 * kWidth, 2 * kHeight, 5));
+    writeFile(input / "f.txt", "not an image");
+    for (unsigned char i = 0; i < 10; ++i)
+    {
+        writeFile(input / ("g" + std::to_string(i) + ".ppm"), ppm(kWidth, kHeight, 10 + i));
+    }
+
+    std::unique_ptr<InputStream> stream = InputStream::open("dir:" + input.string(), kWidth, kHeight, kCapacity);
+    CHECK(stream != nullptr);
+    if (!stream)
+    {
+        return;
+    }
+    // The pool, plus the scratch image while e.ppm, four frames' worth, is decoded.
+    const size_t pool = (kCapacity + 1) * kFrameBytes;
+    const std::vector<InputStream::Frame> frames = drain(*stream, 13, pool + 4 * kFrameBytes);
+    CHECK(frames.size() == 13);
+    const unsigned char expected[] = {1, 2, 5, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19};
+    for (size_t i = 0; i < frames.size() && i < 13; ++i)
+    {
+        CHECK(frames[i].pixels[0] == expected[i]);
+    }
+    // The scratch image taken for e.ppm, larger than a frame, has been released again.
+    CHECK(stream->hostBytes() == pool);
+    const InputStream::Metrics metrics = stream->metrics();
+    CHECK(metrics.received == 13 && metrics.rejected == 2);
+    CHECK(metrics.maxDepth <= kCapacity);
+    CHECK(!metrics.finished);
+}
+
+void testUnknownSource(const std::filesystem::path &dir)
+{
+    CHECK(InputStream::open("tcp:1234", kWidth, kHeight, kCapacity) == nullptr);
+    CHECK(InputStream::open("dir:" + (dir / "missing").string(), kWidth, kHeight, kCapacity) == nullptr);
+    CHECK(InputStream::open("file:" + (dir / "missing").string(), kWidth, kHeight, kCapacity) == nullptr);
+}
+} // namespace
+
+int main()
+{
+    const std::filesystem::path dir = std::filesystem::temp_directory_path() / ("InputStreamTest." + std::to_string(::getpid()));
+    std::filesystem::create_directories(dir);
+
+    testFileSource(dir);
+    testDirectorySource(dir);
+    testUnknownSource(dir);
+
+    std::filesystem::remove_all(dir);
+    return TestCheck::failures();
+}
@@ -0,0 +1,178 @@
+// CPU reference of the texture preprocessing on synthetic RGBA images; the CUDA kernels and the compute pass are
+// checked against this reference at runtime.
+#include "TestCheck.h"
+#include "MnistPreprocess.h"
+#include <cmath>
+#include <vector>
+
+namespace
+{
+std::vector<unsigned char> solidImage(int width, int height, unsigned char r, unsigned char g, unsigned char b)
+{
+    std::vector<unsigned char> rgba(size_t(width) * height * 4);
+    for (size_t i = 0; i < rgba.size(); i += 4)
+    {
+        rgba[i] = r;
+        rgba[i + 1] = g;
+        rgba[i + 2] = b;
+        rgba[i + 3] = 255;
+    }
+    return rgba;
+}
+
+void testConstantImage()
+{
+    const std::vector<unsigned char> rgba = solidImage(1024, 1024, 200, 120, 40);
+    const float expected = toGray(200 / 255.0f, 120 / 255.0f, 40 / 255.0f);
+    for (int outSize : {kMnistSize, kMnistWorkSize})
+    {
+        std::vector<float> out(size_t(outSize) * outSize);
+        areaDownsampleReference(rgba.data(), 1024, 1024, out.data(), outSize, outSize);
+        for (float value : out)
+        {
+            CHECK(std::fabs(value - expected) < 1e-5f);
+        }
+    }
+}
+
+void testBinCoverage()
+{
+    // 1024 texels into 28 bins: contiguous, 36 or 37 texels wide, nothing left over.
+    CHECK(binStart(0, 1024, kMnistSize) == 0);
+    CHECK(binStart(kMnistSize, 1024, kMnistSize) == 1024);
+    for (int i = 0; i < kMnistSize; ++i)
+    {
+        const int width = binStart(i + 1, 1024, kMnistSize) - binStart(i, 1024, kMnistSize);
+        CHECK(width == 36 || width == 37);
+    }
+
+    // Every source texel counts exactly once: the bin averages weighted by bin area add up to the image's total.
+    const int size = 1024;
+    std::vector<unsigned char> rgba(size_t(size) * size * 4, 255);
+    double total = 0.0;
+    for (int y = 0; y < size; ++y)
+        for (int x = 0; x < size; ++x)
+        {
+            unsigned char *texel = rgba.data() + (size_t(y) * size + x) * 4;
+            texel[0] = texel[1] = texel[2] = static_cast<unsigned char>((x * 7 + y * 13) % 256);
+            total += toGray(texel[0] / 255.0f, texel[1] / 255.0f, texel[2] / 255.0f);
+        }
+    std::vector<float> out(kMnistSize * kMnistSize);
+    areaDownsampleReference(rgba.data(), size, size, out.data(), kMnistSize, kMnistSize);
+    double binned = 0.0;
+    for (int oy = 0; oy < kMnistSize; ++oy)
+        for (int ox = 0; ox < kMnistSize; ++ox)
+        {
+            const int area = (binStart(ox + 1, size, kMnistSize) - binStart(ox, size, kMnistSize)) *
+                             (binStart(oy + 1, size, kMnistSize) - binStart(oy, size, kMnistSize));
+            binned += double(out[oy * kMnistSize + ox]) * area;
+        }
+    CHECK(std::fabs(binned - total) < 1e-3 * total);
+}
+
+// A bright rectangle on black, or its negative, away from the image centre.
+std::vector<unsigned char> rectangleImage(int size, int x0, int y0, int x1, int y1, bool darkOnBright)
+{
+    const unsigned char background = darkOnBright ? 255 : 0;
+    std::vector<unsigned char> rgba = solidImage(size, size, background, background, background);
+    for (int y = y0; y < y1; ++y)
+        for (int x = x0; x < x1; ++x)
+        {
+            unsigned char *texel = rgba.data() + (size_t(y) * size + x) * 4;
+            texel[0] = texel[1] = texel[2] = 255 - background;
+        }
+    return rgba;
+}
+
+std::vector<float> preprocess(const std::vector<unsigned char> &rgba, int size, const MnistPreprocessConfig &config)
+{
+    std::vector<float> work(size_t(kMnistWorkSize) * kMnistWorkSize);
+    std::vector<float> out(kMnistSize * kMnistSize);
+    mnistPreprocessHost(rgba.data(), size, size, config, work.data(), out.data());
+    return out;
+}
+
+void testFitAndCentre()
+{
+    // 200x300 texels in the lower left of a 1024 image: the taller side is fitted to 20 pixels.
+    const std::vector<float> out = preprocess(rectangleImage(1024, 100, 600, 300, 900, false), 1024, MnistPreprocessConfig{});
+
+    int minX = kMnistSize, minY = kMnistSize, maxX = -1, maxY = -1;
+    double mass = 0.0, massX = 0.0, massY = 0.0;
+    for (int y = 0; y < kMnistSize; ++y)
+        for (int x = 0; x < kMnistSize; ++x)
+        {
+            const float value = out[y * kMnistSize + x];
+            CHECK(value >= 0.0f && value <= 1.0f);
+            if (value > 0.5f)
+            {
+                minX = std::min(minX, x);
+                minY = std::min(minY, y);
+                maxX = std::max(maxX, x);
+                maxY = std::max(maxY, y);
+            }
+            mass += value;
+            massX += value * (x + 0.5);
+            massY += value * (y + 0.5);
+        }
+    const int height = maxY - minY + 1;
+    const int width = maxX - minX + 1;
+    CHECK(height >= kMnistFitSize - 1 && height <= kMnistFitSize + 1);
+    CHECK(width >= 12 && width <= 15); // 200 / 300 * 20
+    CHECK(mass > 0.0);
+    CHECK(std::fabs(massX / mass - kMnistSize * 0.5) < 0.25);
+    CHECK(std::fabs(massY / mass - kMnistSize * 0.5) < 0.25);
+}
+
+void testEmptyImage()
+{
+    for (bool enabled : {true, false})
+    {
+        MnistPreprocessConfig config;
+        config.enabled = enabled;
+        for (float value : preprocess(solidImage(256, 256, 0, 0, 0), 256, config))
+        {
+            CHECK(value == 0.0f);
+        }
+    }
+}
+
+void testInvert()
+{
+    // A dark digit on white with invert set gives the same input as the bright digit on black.
+    const std::vector<float> bright = preprocess(rectangleImage(512, 300, 40, 400, 200, false), 512, MnistPreprocessConfig{});
+    MnistPreprocessConfig config;
+    config.invert = true;
+    const std::vector<float> inverted = preprocess(rectangleImage(512, 300, 40, 400, 200, true), 512, config);
+    for (size_t i = 0; i < bright.size(); ++i)
+    {
+        CHECK(std::fabs(bright[i] - inverted[i]) < 1e-4f);
+    }
+}
+
+void testNormalize()
+{
+    const std::vector<unsigned char> rgba = rectangleImage(512, 100, 100, 250, 300, false);
+    MnistPreprocessConfig config;
+    const std::vector<float> plain = preprocess(rgba, 512, config);
+    config.normalize = true;
+    const std::vector<float> normalized = preprocess(rgba, 512, config);
+    for (size_t i = 0; i < plain.size(); ++i)
+    {
+        CHECK(std::fabs(normalized[i] - (plain[i] - config.mean) / config.stddev) < 1e-4f);
+    }
+    // The background of an MNIST digit ends up at -mean / stddev.
+    CHECK(std::fabs(normalized[0] + config.mean / config.stddev) < 1e-4f);
+}
+} // namespace
+
+int main()
+{
+    testConstantImage();
+    testBinCoverage();
+    testFitAndCentre();
+    testEmptyImage();
+    testInvert();
+    testNormalize();
+    return TestCheck::failures();
+}
@@ -0,0 +1,158 @@
+// Pnm header parsing on hand-written headers, rejection of files that do not hold the pixels their header promises,
+// and the SSSE3 expansion against the scalar one.
+#include "TestCheck.h"
+#include "PnmLoader.h"
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+namespace
+{
+bool parse(const std::string &file, Pnm::Header &header, std::string &error)
+{
+    return Pnm::parseHeader(reinterpret_cast<const unsigned char *>(file.data()), file.size(), header, error);
+}
+
+bool parses(const std::string &file)
+{
+    Pnm::Header header;
+    std::string error;
+    return parse(file, header, error);
+}
+
+void testHeaders()
+{
+    Pnm::Header header;
+    std::string error;
+
+    CHECK(parse("P6\n3 2\n255\n" + std::string(3 * 2 * 3, 'x'), header, error));
+    CHECK(header.width == 3 && header.height == 2 && header.channels == 3 && header.dataOffset == 11);
+
+    CHECK(parse("P5\n3 2\n255\n" + std::string(3 * 2, 'x'), header, error));
+    CHECK(header.width == 3 && header.height == 2 && header.channels == 1 && header.dataOffset == 11);
+
+    // Comments and any run of whitespace between the fields, including a comment right after the magic number.
+    const std::string commented = "P6# written by a test\n  7\t\r\n# a comment line\n# and another\n5 \n\n  255\n";
+    CHECK(parse(commented + std::string(7 * 5 * 3, 'x'), header, error));
+    CHECK(header.width == 7 && header.height == 5 && header.channels == 3 && header.dataOffset == commented.size());
+
+    // Exactly one whitespace character after maxval; the pixels may start with what looks like whitespace.
+    CHECK(parse("P5 1 2 255\n\n\n", header, error));
+    CHECK(header.dataOffset == 11);
+
+    // Trailing data after the pixels is ignored.
+    CHECK(parses("P5\n2 2\n255\n" + std::string(10, 'x')));
+}
+
+void testRejected()
+{
+    const std::string pixels(64, 'x');
+    // Not a binary PPM or PGM.
+    CHECK(!parses(""));
+    CHECK(!parses("P"));
+    CHECK(!parses("P3\n2 2\n255\n" + pixels));
+    CHECK(!parses("GIF89a"));
+    // Truncated in the header, or short of the pixels it announces by a single byte.
+    CHECK(!parses("P6\n2 2"));
+    CHECK(!parses("P6\n2 2\n255"));
+    CHECK(!parses("P6\n2 2\n255\n" + std::string(2 * 2 * 3 - 1, 'x')));
+    CHECK(!parses("P5\n2 2\n255\n" + std::string(2 * 2 - 1, 'x')));
+    // Fields that are missing, zero, or do not fit 32 bits.
+    CHECK(!parses("P6\n2\n255\n" + pixels));
+    CHECK(!parses("P6\n0 2\n255\n" + pixels));
+    CHECK(!parses("P6\n2 0\n255\n" + pixels));
+    CHECK(!parses("P6\n-2 2\n255\n" + pixels));
+    CHECK(!parses("P6\n4294967296 1\n255\n" + pixels));
+    CHECK(!parses("P6\n99999999999999999999999 1\n255\n" + pixels));
+    // More than 8 bits per channel.
+    CHECK(!parses("P6\n2 2\n256\n" + pixels));
+    CHECK(!parses("P6\n2 2\n65535\n" + pixels));
+    // Dimensions whose pixel count overflows 32 bits are measured against the file in 64 bits, and P6 byte counts
+    // that would wrap around 64 bits (here to 41258) are not computed at all.
+    CHECK(!parses("P6\n4294967295 4294967295\n255\n" + pixels));
+    CHECK(!parses("P5\n65536 65536\n255\n" + pixels));
+    CHECK(!parses("P6\n4294853786 1431693603\n255\n" + std::string(41258, 'x')));
+}
+
+void testFiles()
+{
+    const std::filesystem::path dir = std::filesystem::temp_directory_path() / ("PnmLoaderTest." + std::to_string(::getpid()));
+    std::filesystem::create_directories(dir);
+    auto write = [&dir](const std::string &name, const std::string &contents) {
+        std::ofstream file(dir / name, std::ios::binary);
+        file.write(contents.data(), std::streamsize(contents.size()));
+        return (dir / name).string();
+    };
+
+    Pnm::Image image;
+    std::string error;
+    CHECK(image.open(write("gray.pgm", "P5\n# gray\n3 1\n255\n\x01\x02\x03"), error));
+    CHECK(image.width() == 3 && image.height() == 1 && image.rgbaSize() == 12);
+    unsigned char rgba[12];
+    image.decodeRgba(rgba);
+    const unsigned char expected[12] = {1, 1, 1, Pnm::kAlpha, 2, 2, 2, Pnm::kAlpha, 3, 3, 3, Pnm::kAlpha};
+    CHECK(std::memcmp(rgba, expected, sizeof(rgba)) == 0);
+
+    CHECK(!image.open(write("empty.ppm", ""), error));
+    CHECK(!image.open(write("short.ppm", "P6\n4 4\n255\n" + std::string(47, 'x')), error));
+    CHECK(error.find("shorter") != std::string::npos);
+    CHECK(!image.open((dir / "missing.ppm").string(), error));
+
+    std::filesystem::remove_all(dir);
+}
+
+// Odd widths leave a tail of fewer than 16 pixels in every row, and an image size that is no multiple of 16 leaves
+// one after the last SSSE3 iteration, which the scalar loop finishes.
+void testSsse3MatchesScalar()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (!__builtin_cpu_supports("ssse3"))
+    {
+        std::printf("SSSE3 not available, comparing expandToRgba with itself\n");
+    }
+#endif
+    for (uint32_t channels : {1u, 3u})
+    {
+        for (uint32_t width : {1u, 15u, 17u, 33u, 101u})
+        {
+            const uint32_t height = 3;
+            const size_t pixels = size_t(width) * height;
+            std::vector<unsigned char> src(pixels * channels);
+            for (size_t i = 0; i < src.size(); ++i)
+            {
+                src[i] = static_cast<unsigned char>(i * 131 + 7);
+            }
+            // One guard byte past the end catches stores beyond the last texel.
+            std::vector<unsigned char> scalar(pixels * 4 + 1, 0xa5);
+            std::vector<unsigned char> expanded(pixels * 4 + 1, 0xa5);
+            Pnm::expandScalar(src.data(), scalar.data(), pixels, channels);
+            Pnm::expandToRgba(src.data(), expanded.data(), pixels, channels);
+            CHECK(expanded == scalar);
+            CHECK(expanded.back() == 0xa5);
+#if defined(__x86_64__) || defined(__i386__)
+            if (__builtin_cpu_supports("ssse3"))
+            {
+                std::vector<unsigned char> simd(pixels * 4 + 1, 0xa5);
+                const size_t done = Pnm::expandSsse3(src.data(), simd.data(), pixels, channels);
+                CHECK(done == pixels / 16 * 16);
+                CHECK(std::memcmp(simd.data(), scalar.data(), done * 4) == 0);
+                CHECK(simd[done * 4] == 0xa5);
+            }
+#endif
+        }
+    }
+}
+} // namespace
+
+int main()
+{
+    testHeaders();
+    testRejected();
+    testFiles();
+    testSsse3MatchesScalar();
+    return TestCheck::failures();
+}
@@ -0,0 +1,189 @@
+// StagingBatches on a fake queue that records which regions each batch reads, so ring placement and the number of
+// submissions can be checked without a GPU.
+#include "TestCheck.h"
+#include "StagingBatches.h"
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+struct Range
+{
+    uint64_t offset;
+    uint64_t size;
+};
+
+class FakeQueue : public StagingBatchBackend
+{
+public:
+    explicit FakeQueue(uint64_t capacity) : capacity(capacity) {}
+
+    void begin(size_t batch) override
+    {
+        CHECK(!recording[batch] && inFlight[batch].empty());
+        recording[batch] = true;
+    }
+    void submit(size_t batch) override
+    {
+        CHECK(recording[batch]);
+        recording[batch] = false;
+        inFlight[batch].swap(recorded[batch]);
+        submits++;
+    }
+    void wait(size_t batch) override
+    {
+        CHECK(!recording[batch]);
+        inFlight[batch].clear();
+        waits++;
+    }
+
+    // A copy out of the region, recorded into the batch. The region must not overlap anything a batch still reads.
+    void record(size_t batch, uint64_t offset, uint64_t size)
+    {
+        CHECK(recording[batch]);
+        CHECK(offset + size <= capacity);
+        for (size_t i = 0; i < StagingBatches::kBatches; ++i)
+        {
+            for (const std::vector<Range> *ranges : {&recorded[i], &inFlight[i]})
+            {
+                for (const Range &range : *ranges)
+                {
+                    CHECK(offset + size <= range.offset || range.offset + range.size <= offset);
+                }
+            }
+        }
+        recorded[batch].push_back({offset, size});
+    }
+
+    uint32_t submits = 0;
+    uint32_t waits = 0;
+
+private:
+    uint64_t capacity;
+    bool recording[StagingBatches::kBatches] = {};
+    std::vector<Range> recorded[StagingBatches::kBatches];
+    std::vector<Range> inFlight[StagingBatches::kBatches];
+};
+
+// What a texture upload does: reserve the region, then record the copy out of it.
+uint64_t upload(StagingBatches &ring, FakeQueue &queue, uint64_t size)
+{
+    const uint64_t offset = ring.allocate(size, 16);
+    queue.record(ring.recordingBatch(), offset, size);
+    return offset;
+}
+
+void testWraparound()
+{
+    FakeQueue queue(1024);
+    StagingBatches ring(queue);
+    ring.reset(1024);
+
+    CHECK(upload(ring, queue, 400) == 0);
+    CHECK(upload(ring, queue, 400) == 400);
+    ring.submit();
+    CHECK(upload(ring, queue, 200) == 800);
+    CHECK(!ring.hasRoom(400, 16));
+
+    // 400 bytes do not fit behind the third region, so the region skips the end of the buffer and starts over at 0
+    // once the batch reading [0, 800) has been waited for.
+    CHECK(upload(ring, queue, 400) == 0);
+    CHECK(queue.waits == 1 && queue.submits == 1);
+    CHECK(ring.inFlight() == 624);
+    // The freed space right behind it is used up to the last byte.
+    CHECK(ring.hasRoom(400, 16));
+    CHECK(upload(ring, queue, 400) == 400);
+    CHECK(ring.inFlight() == 1024);
+
+    // Everything in use belongs to the batch being recorded, which is submitted and waited for to make room.
+    CHECK(upload(ring, queue, 16) == 0);
+    CHECK(queue.submits == 2 && ring.submissions() == 2);
+    ring.finish();
+    CHECK(ring.inFlight() == 0);
+    CHECK(ring.uploads() == 6);
+}
+
+void testReuseAfterRetire()
+{
+    FakeQueue queue(1024);
+    StagingBatches ring(queue);
+    ring.reset(1024);
+
+    // An empty ring starts again at the beginning of the buffer.
+    CHECK(upload(ring, queue, 512) == 0);
+    ring.finish();
+    CHECK(ring.hasRoom(1024, 16));
+    CHECK(upload(ring, queue, 256) == 0);
+    ring.submit();
+    CHECK(upload(ring, queue, 256) == 256);
+    ring.submit();
+    CHECK(upload(ring, queue, 512) == 512);
+    const uint32_t waits = queue.waits;
+
+    // The next region waits for the oldest batch only, and takes exactly the space that batch read.
+    CHECK(upload(ring, queue, 256) == 0);
+    CHECK(queue.waits == waits + 1);
+    // The second batch is still pending, so its space is not handed out.
+    CHECK(!ring.hasRoom(16, 16));
+    ring.finish();
+    CHECK(ring.inFlight() == 0);
+}
+
+void testOversizedUpload()
+{
+    FakeQueue queue(1024);
+    StagingBatches ring(queue);
+    ring.reset(1024);
+
+    bool threw = false;
+    try
+    {
+        ring.allocate(1025, 16);
+    }
+    catch (const std::runtime_error &)
+    {
+        threw = true;
+    }
+    CHECK(threw);
+    CHECK(!ring.hasRoom(1025, 16));
+    CHECK(queue.submits == 0 && ring.uploads() == 0);
+}
+
+// Loading submits once at the end; the ring only adds a submission for every ring's worth of data.
+uint32_t submissionsFor(uint32_t textures, uint64_t textureSize)
+{
+    const uint64_t capacity = uint64_t(32) << 20;
+    FakeQueue queue(capacity);
+    StagingBatches ring(queue);
+    ring.reset(capacity);
+    for (uint32_t i = 0; i < textures; ++i)
+    {
+        upload(ring, queue, textureSize);
+    }
+    ring.submit();
+    CHECK(ring.uploads() == textures);
+    CHECK(queue.submits == ring.submissions());
+    return ring.submissions();
+}
+
+void testSubmitCount()
+{
+    // 28x28 RGBA digits: ten thousand of them fit the ring at once.
+    const uint64_t digit = 28 * 28 * 4;
+    CHECK(submissionsFor(10, digit) == 1);
+    CHECK(submissionsFor(10000, digit) == 1);
+    // 1024x1024 RGBA textures, eight to a ring.
+    const uint64_t texture = 1024 * 1024 * 4;
+    CHECK(submissionsFor(10, texture) == 2);
+    CHECK(submissionsFor(10000, texture) == 1250);
+}
+} // namespace
+
+int main()
+{
+    testWraparound();
+    testReuseAfterRetire();
+    testOversizedUpload();
+    testSubmitCount();
+    return TestCheck::failures();
+}
@@ -0,0 +1,27 @@
+#ifndef TESTCHECK_H
+#define TESTCHECK_H
+
+#include <cstdio>
+
+// Minimal checks for the CPU-only tests: a failed CHECK prints its location and the test's main() returns the
+// number of failures, which ctest reports as a failed test.
+namespace TestCheck
+{
+inline int &failures()
+{
+    static int count = 0;
+    return count;
+}
+} // namespace TestCheck
+
+#define CHECK(condition)                                                                      \
+    do                                                                                        \
+    {                                                                                         \
+        if (!(condition))                                                                     \
+        {                                                                                     \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            TestCheck::failures()++;                                                          \
+        }                                                                                     \
+    } while (0)
+
+#endif // TESTCHECK_H
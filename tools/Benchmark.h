@@ -0,0 +1,75 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+// Small timing helpers shared by the startup and throughput reports.
+// The heavier benchmarks only run when the project is configured with -DENABLE_BENCHMARKS=ON.
+namespace Benchmark
+{
+using Clock = std::chrono::high_resolution_clock;
+
+inline double elapsedMs(const Clock::time_point &start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// Frame-to-frame times in 0.5 ms buckets up to 50 ms; slower frames land in the last bucket.
+struct FrameTimeHistogram
+{
+    static constexpr int kBuckets = 100;
+    static constexpr float kBucketMs = 0.5f;
+
+    std::array<float, kBuckets> counts{}; // float so ImGui::PlotHistogram can draw it directly
+    uint64_t frames = 0;
+    double totalMs = 0.0;
+    double maxMs = 0.0;
+
+    void record(double ms)
+    {
+        const int bucket = std::min(kBuckets - 1, std::max(0, (int)(ms / kBucketMs)));
+        counts[bucket] += 1.0f;
+        ++frames;
+        totalMs += ms;
+        maxMs = std::max(maxMs, ms);
+    }
+
+    void reset()
+    {
+        *this = FrameTimeHistogram{};
+    }
+
+    double meanMs() const
+    {
+        return frames ? totalMs / frames : 0.0;
+    }
+
+    // Upper edge of the bucket holding the given fraction of frames, e.g. 0.99 for the 99th percentile.
+    double percentileMs(double fraction) const
+    {
+        const double target = fraction * frames;
+        double seen = 0.0;
+        for (int i = 0; i < kBuckets; ++i)
+        {
+            seen += counts[i];
+            if (seen >= target && seen > 0.0)
+            {
+                return (i + 1) * kBucketMs;
+            }
+        }
+        return kBuckets * kBucketMs;
+    }
+
+    void print(std::ostream &os, const char *label) const
+    {
+        os << label << ": " << frames << " frames, mean " << meanMs() << " ms, p50 " << percentileMs(0.5)
+           << " ms, p99 " << percentileMs(0.99) << " ms, max " << maxMs << " ms" << std::endl;
+    }
+};
+} // namespace Benchmark
+
+#endif // BENCHMARK_H
@@ -0,0 +1,30 @@
+#ifndef DEVICEALLOCATIONS_H
+#define DEVICEALLOCATIONS_H
+
+#include <atomic>
+#include <cstddef>
+
+// Process-wide count of CUDA allocations. Every cudaMalloc and cudaMallocHost of CudaManager, VulkanImageCuda and the
+// inference engines goes through the wrappers in cuda/CudaAllocations.h, which count here. All of them happen before
+// the first frame, so a count that moves while frames run is an allocation in the frame path. Kept free of CUDA
+// headers so host-only code and the tests can read it.
+namespace DeviceAllocations
+{
+inline std::atomic<size_t> &counter()
+{
+    static std::atomic<size_t> allocations{0};
+    return allocations;
+}
+
+inline size_t count()
+{
+    return counter().load(std::memory_order_relaxed);
+}
+
+inline void record()
+{
+    counter().fetch_add(1, std::memory_order_relaxed);
+}
+} // namespace DeviceAllocations
+
+#endif // DEVICEALLOCATIONS_H
@@ -0,0 +1,151 @@
+#ifndef FRAMEPACER_H
+#define FRAMEPACER_H
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <thread>
+
+// Decides how long the render loop idles between frames.
+//   Uncapped  - never waits; the loop runs as fast as the GPU and the inference engine allow.
+//   TargetFps - sleeps most of the frame budget and spins the last stretch, because sleep_for routinely overshoots by
+//               a scheduler tick while spinning alone burns a whole core.
+//   Present   - never waits either; the swap chain present mode (FIFO blocks on vblank) sets the rate.
+// Every call to wait() also records the interval since the previous one, so the pacing quality can be reported.
+class FramePacer
+{
+public:
+    enum class Mode
+    {
+        Uncapped,
+        TargetFps,
+        Present
+    };
+    using Clock = std::chrono::steady_clock;
+
+    FramePacer(Mode mode, double targetFps) : mode(mode)
+    {
+        setTargetFps(targetFps);
+    }
+
+    static Mode parseMode(const std::string &name)
+    {
+        if (name == "uncapped")
+            return Mode::Uncapped;
+        if (name == "fps")
+            return Mode::TargetFps;
+        return Mode::Present;
+    }
+
+    static const char *modeName(Mode mode)
+    {
+        switch (mode)
+        {
+        case Mode::Uncapped:
+            return "uncapped";
+        case Mode::TargetFps:
+            return "fps";
+        default:
+            return "present";
+        }
+    }
+
+    Mode getMode() const { return mode; }
+    double getTargetFps() const { return targetFps; }
+
+    void setTargetFps(double fps)
+    {
+        targetFps = fps > 0.0 ? fps : 60.0;
+        period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / targetFps));
+    }
+
+    // Called once per frame, after the frame has been submitted.
+    void wait()
+    {
+        if (mode == Mode::TargetFps)
+        {
+            const auto now = Clock::now();
+            deadline += period;
+            if (deadline < now - period)
+            {
+                // More than a frame behind (startup, a resize, a debugger break): restart the schedule instead of
+                // rushing out a burst of frames to catch up.
+                deadline = now;
+            }
+            if (deadline - now > kSpinWindow)
+            {
+                std::this_thread::sleep_for(deadline - now - kSpinWindow);
+            }
+            while (Clock::now() < deadline)
+            {
+                std::this_thread::yield();
+            }
+        }
+        record(Clock::now());
+    }
+
+    // Standard deviation of the recent frame intervals around their mean.
+    double jitterMs() const
+    {
+        const size_t count = sampleCount < kSamples ? sampleCount : kSamples;
+        if (count < 2)
+            return 0.0;
+        double mean = 0.0;
+        for (size_t i = 0; i < count; ++i)
+            mean += samples[i];
+        mean /= count;
+        double variance = 0.0;
+        for (size_t i = 0; i < count; ++i)
+            variance += (samples[i] - mean) * (samples[i] - mean);
+        return std::sqrt(variance / (count - 1));
+    }
+
+    // Largest distance of a recent interval from the target period (TargetFps) or from the mean interval (otherwise).
+    double worstErrorMs() const
+    {
+        const size_t count = sampleCount < kSamples ? sampleCount : kSamples;
+        if (count == 0)
+            return 0.0;
+        double reference = 0.0;
+        if (mode == Mode::TargetFps)
+        {
+            reference = 1000.0 / targetFps;
+        }
+        else
+        {
+            for (size_t i = 0; i < count; ++i)
+                reference += samples[i];
+            reference /= count;
+        }
+        double worst = 0.0;
+        for (size_t i = 0; i < count; ++i)
+            worst = std::max(worst, std::abs(samples[i] - reference));
+        return worst;
+    }
+
+private:
+    static constexpr size_t kSamples = 240;
+    static constexpr auto kSpinWindow = std::chrono::microseconds(1500);
+
+    void record(Clock::time_point now)
+    {
+        if (lastWake.time_since_epoch().count() != 0)
+        {
+            samples[sampleCount % kSamples] = std::chrono::duration<double, std::milli>(now - lastWake).count();
+            ++sampleCount;
+        }
+        lastWake = now;
+    }
+
+    Mode mode;
+    double targetFps = 60.0;
+    Clock::duration period{};
+    Clock::time_point deadline{};
+    Clock::time_point lastWake{};
+    std::array<double, kSamples> samples{};
+    size_t sampleCount = 0;
+};
+
+#endif // FRAMEPACER_H
@@ -0,0 +1,408 @@
+#ifndef INPUTSTREAM_H
+#define INPUTSTREAM_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include "PnmLoader.h"
+
+// Streams RGBA8 images from outside the process into the renderer, replacing the fixed set of digit textures.
+// A producer thread decodes frames into a fixed pool of buffers and queues them; the render thread pops at most one
+// per frame. The pool is allocated up front, so memory does not grow with the number of images that flow through:
+// when every buffer is queued the producer blocks until the renderer catches up.
+//
+// Sources (--input):
+//   dir:<path>  - watches a directory for .ppm and .pgm files, oldest first. Writers should create files under another name
+//                 and rename them into place, so a half-written image is never picked up.
+//   file:<path> - raw RGBA8 frames of exactly width x height pixels, back to back, until end of file.
+//   stdin       - the same raw frames on standard input.
+// Images of another size, up to kMaxSourceEdge on each side, are scaled to width x height (nearest texel); raw frames
+// have to match it.
+class InputStream
+{
+public:
+    struct Frame
+    {
+        std::vector<unsigned char> pixels; // width * height * 4 bytes
+        std::string name;
+    };
+
+    struct Metrics
+    {
+        uint64_t received = 0; // Frames decoded and queued
+        uint64_t consumed = 0; // Frames handed to the renderer
+        uint64_t rejected = 0; // Unreadable files and short raw frames
+        size_t depth = 0;      // Frames waiting in the queue
+        size_t maxDepth = 0;
+        size_t capacity = 0;
+        double framesPerSecond = 0.0; // Consumed frames over the last full second
+        bool finished = false;        // The source has ended and the queue is empty
+    };
+
+    // Returns nullptr for an unknown source or one that cannot be opened.
+    static std::unique_ptr<InputStream> open(const std::string &spec, uint32_t width, uint32_t height, size_t capacity)
+    {
+        std::unique_ptr<InputStream> stream(new InputStream(width, height, capacity));
+        if (spec.rfind("dir:", 0) == 0)
+        {
+            stream->directory = spec.substr(4);
+            std::error_code error;
+            if (!std::filesystem::is_directory(stream->directory, error))
+            {
+                std::cerr << "Input directory " << stream->directory << " does not exist" << std::endl;
+                return nullptr;
+            }
+        }
+        else if (spec.rfind("file:", 0) == 0)
+        {
+            stream->fd = ::open(spec.substr(5).c_str(), O_RDONLY);
+            if (stream->fd < 0)
+            {
+                std::cerr << "Could not open input file " << spec.substr(5) << std::endl;
+                return nullptr;
+            }
+            stream->ownsFd = true;
+        }
+        else if (spec == "stdin")
+        {
+            stream->fd = STDIN_FILENO;
+        }
+        else
+        {
+            std::cerr << "Unknown input source '" << spec << "', expected dir:<path>, file:<path> or stdin" << std::endl;
+            return nullptr;
+        }
+        stream->source = spec;
+        stream->producer = std::thread(&InputStream::produce, stream.get());
+        return stream;
+    }
+
+    ~InputStream()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        bufferAvailable.notify_all();
+        if (producer.joinable())
+        {
+            producer.join();
+        }
+        if (ownsFd)
+        {
+            ::close(fd);
+        }
+    }
+
+    InputStream(const InputStream &) = delete;
+    InputStream &operator=(const InputStream &) = delete;
+
+    // Moves the oldest queued frame into frame without blocking. The buffer frame held before goes back to the pool,
+    // so the caller keeps exactly one buffer between calls.
+    bool pop(Frame &frame)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (queue.empty())
+        {
+            return false;
+        }
+        if (frame.pixels.size() == frameBytes)
+        {
+            freeBuffers.push_back(std::move(frame.pixels));
+        }
+        frame = std::move(queue.front());
+        queue.pop_front();
+        ++consumed;
+        bufferAvailable.notify_one();
+
+        const auto now = std::chrono::steady_clock::now();
+        ++windowFrames;
+        const double windowMs = std::chrono::duration<double, std::milli>(now - windowStart).count();
+        if (windowMs >= 1000.0)
+        {
+            rate = windowFrames * 1000.0 / windowMs;
+            windowFrames = 0;
+            windowStart = now;
+        }
+        return true;
+    }
+
+    Metrics metrics() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Metrics m;
+        m.received = received;
+        m.consumed = consumed;
+        m.rejected = rejected;
+        m.depth = queue.size();
+        m.maxDepth = maxDepth;
+        m.capacity = capacity;
+        // A stalled stream has no consumption to refresh the window, so the rate decays to zero after a quiet second.
+        const double idleMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - windowStart).count();
+        m.framesPerSecond = idleMs < 2000.0 ? rate : 0.0;
+        m.finished = ended && queue.empty();
+        return m;
+    }
+
+    // Host memory held for frames: the buffer pool plus the scratch image odd-sized files are decoded into, which is at
+    // most one frame between images.
+    size_t hostBytes() const { return (capacity + 1) * frameBytes + scratchBytes; }
+
+    const std::string &name() const { return source; }
+    uint32_t getWidth() const { return width; }
+    uint32_t getHeight() const { return height; }
+
+    // Nearest-texel scaling of an RGBA8 image into dst, which holds dstWidth x dstHeight texels.
+    static void resample(const unsigned char *src, uint32_t srcWidth, uint32_t srcHeight, unsigned char *dst, uint32_t dstWidth, uint32_t dstHeight)
+    {
+        for (uint32_t y = 0; y < dstHeight; ++y)
+        {
+            const uint32_t sy = uint32_t(uint64_t(y) * srcHeight / dstHeight);
+            const unsigned char *srcRow = src + size_t(sy) * srcWidth * 4;
+            unsigned char *dstRow = dst + size_t(y) * dstWidth * 4;
+            for (uint32_t x = 0; x < dstWidth; ++x)
+            {
+                const uint32_t sx = uint32_t(uint64_t(x) * srcWidth / dstWidth);
+                std::memcpy(dstRow + x * 4, srcRow + sx * 4, 4);
+            }
+        }
+    }
+
+private:
+    static constexpr auto kPollInterval = std::chrono::milliseconds(50);
+    // Larger images are rejected rather than decoded at full size just to be scaled down to a texture.
+    static constexpr uint32_t kMaxSourceEdge = 4096;
+
+    InputStream(uint32_t width, uint32_t height, size_t capacity)
+        : width(width), height(height), capacity(std::max<size_t>(capacity, 1)), frameBytes(size_t(width) * height * 4)
+    {
+        // One buffer more than the queue holds: the renderer keeps the frame it popped last.
+        for (size_t i = 0; i <= this->capacity; ++i)
+        {
+            freeBuffers.emplace_back(frameBytes);
+        }
+        windowStart = std::chrono::steady_clock::now();
+    }
+
+    // Blocks until a buffer is free and the queue has room. Returns an empty vector once the stream is shutting down.
+    std::vector<unsigned char> acquireBuffer()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        bufferAvailable.wait(lock, [this] { return stopping || (!freeBuffers.empty() && queue.size() < capacity); });
+        if (stopping)
+        {
+            return {};
+        }
+        std::vector<unsigned char> buffer = std::move(freeBuffers.back());
+        freeBuffers.pop_back();
+        return buffer;
+    }
+
+    void push(Frame &&frame)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(std::move(frame));
+        ++received;
+        maxDepth = std::max(maxDepth, queue.size());
+    }
+
+    void release(std::vector<unsigned char> &&buffer, bool reject)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        freeBuffers.push_back(std::move(buffer));
+        rejected += reject;
+    }
+
+    bool isStopping()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stopping;
+    }
+
+    void produce()
+    {
+        if (directory.empty())
+        {
+            produceRaw();
+        }
+        else
+        {
+            watchDirectory();
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        ended = true;
+    }
+
+    // Reads frameBytes into buffer, waking up regularly to notice shutdown. False at end of input.
+    bool readFrame(unsigned char *buffer)
+    {
+        size_t filled = 0;
+        while (filled < frameBytes)
+        {
+            pollfd request{fd, POLLIN, 0};
+            const int ready = ::poll(&request, 1, int(kPollInterval.count()));
+            if (isStopping())
+            {
+                return false;
+            }
+            if (ready <= 0)
+            {
+                continue;
+            }
+            const ssize_t count = ::read(fd, buffer + filled, frameBytes - filled);
+            if (count <= 0)
+            {
+                if (filled != 0)
+                {
+                    std::cerr << "Input " << source << " ended inside a frame, " << filled << " of " << frameBytes << " bytes" << std::endl;
+                    std::lock_guard<std::mutex> lock(mutex);
+                    ++rejected;
+                }
+                return false;
+            }
+            filled += size_t(count);
+        }
+        return true;
+    }
+
+    void produceRaw()
+    {
+        for (uint64_t index = 0;; ++index)
+        {
+            std::vector<unsigned char> buffer = acquireBuffer();
+            if (buffer.empty())
+            {
+                return;
+            }
+            if (!readFrame(buffer.data()))
+            {
+                release(std::move(buffer), false);
+                return;
+            }
+            push(Frame{std::move(buffer), source + "#" + std::to_string(index)});
+        }
+    }
+
+    bool decodeImage(const std::filesystem::path &path, unsigned char *buffer, std::string &error)
+    {
+        Pnm::Image file;
+        if (!file.open(path.string(), error))
+        {
+            return false;
+        }
+        if (file.width() == width && file.height() == height)
+        {
+            file.decodeRgba(buffer);
+            return true;
+        }
+        if (file.width() > kMaxSourceEdge || file.height() > kMaxSourceEdge)
+        {
+            error = std::to_string(file.width()) + "x" + std::to_string(file.height()) + " is larger than " +
+                    std::to_string(kMaxSourceEdge) + "x" + std::to_string(kMaxSourceEdge);
+            return false;
+        }
+        // Only odd-sized images go through the scratch buffer. It is kept for images up to the size of a frame, so
+        // a stream of small images does not reallocate, and released after anything larger.
+        scratch.resize(std::max(scratch.size(), file.rgbaSize()));
+        scratchBytes = scratch.size();
+        file.decodeRgba(scratch.data());
+        resample(scratch.data(), file.width(), file.height(), buffer, width, height);
+        if (scratch.size() > frameBytes)
+        {
+            scratch.clear();
+            scratch.shrink_to_fit();
+            scratchBytes = 0;
+        }
+        return true;
+    }
+
+    // Picks up files in modification time order. Only the position of the last file taken is remembered, not the
+    // names of all files seen, so a long-running watch stays at constant memory.
+    void watchDirectory()
+    {
+        using FileTime = std::filesystem::file_time_type;
+        FileTime lastTime = FileTime::min();
+        std::string lastName;
+        while (!isStopping())
+        {
+            std::vector<std::pair<FileTime, std::filesystem::path>> pending;
+            std::error_code error;
+            for (const auto &entry : std::filesystem::directory_iterator(directory, error))
+            {
+                const std::filesystem::path &path = entry.path();
+                if (!entry.is_regular_file(error) || (path.extension() != ".ppm" && path.extension() != ".pgm"))
+                {
+                    continue;
+                }
+                const FileTime time = entry.last_write_time(error);
+                if (!error && (time > lastTime || (time == lastTime && path.filename().string() > lastName)))
+                {
+                    pending.emplace_back(time, path);
+                }
+            }
+            std::sort(pending.begin(), pending.end());
+
+            for (const auto &[time, path] : pending)
+            {
+                std::vector<unsigned char> buffer = acquireBuffer();
+                if (buffer.empty())
+                {
+                    return;
+                }
+                lastTime = time;
+                lastName = path.filename().string();
+                std::string decodeError;
+                if (decodeImage(path, buffer.data(), decodeError))
+                {
+                    push(Frame{std::move(buffer), lastName});
+                }
+                else
+                {
+                    std::cerr << "Skipping input image " << path << ": " << decodeError << std::endl;
+                    release(std::move(buffer), true);
+                }
+            }
+            std::this_thread::sleep_for(kPollInterval);
+        }
+    }
+
+    const uint32_t width, height;
+    const size_t capacity;
+    const size_t frameBytes;
+    std::string source;
+    std::filesystem::path directory; // dir: sources
+    std::vector<unsigned char> scratch;
+    std::atomic<size_t> scratchBytes{0};
+    int fd = -1;                     // file: and stdin sources
+    bool ownsFd = false;
+    std::thread producer;
+
+    mutable std::mutex mutex;
+    std::condition_variable bufferAvailable;
+    std::deque<Frame> queue;
+    std::vector<std::vector<unsigned char>> freeBuffers;
+    bool stopping = false;
+    bool ended = false;
+    uint64_t received = 0, consumed = 0, rejected = 0;
+    size_t maxDepth = 0;
+    std::chrono::steady_clock::time_point windowStart;
+    uint64_t windowFrames = 0;
+    double rate = 0.0;
+};
+
+#endif // INPUTSTREAM_H
@@ -0,0 +1,42 @@
+#ifndef MEMORYREPORT_H
+#define MEMORYREPORT_H
+
+#include <cstdint>
+#include <cstdio>
+#include <ostream>
+#include <unistd.h>
+
+// Where the process keeps its image data, so growth can be attributed. Each subsystem adds what it owns; the
+// resident set size comes from the kernel and covers everything else too (driver allocations, mapped files).
+struct MemoryReport
+{
+    uint64_t hostBytes = 0;           // Pixel copies and decode buffers owned by the application
+    uint64_t deviceBytes = 0;         // Vulkan device memory handed out by the allocator
+    uint64_t deviceReservedBytes = 0; // Vulkan device memory held, including unused block space
+    uint64_t cudaBytes = 0;           // CUDA allocations outside the imported memory
+    uint32_t externalImports = 0;     // Vulkan allocations imported into CUDA
+    uint64_t externalBytes = 0;
+    uint64_t residentBytes = 0;
+
+    // VmRSS of this process, 0 where /proc is not available.
+    static uint64_t residentSetBytes()
+    {
+        FILE *statm = std::fopen("/proc/self/statm", "r");
+        if (!statm)
+            return 0;
+        unsigned long long pages = 0, residentPages = 0;
+        const bool ok = std::fscanf(statm, "%llu %llu", &pages, &residentPages) == 2;
+        std::fclose(statm);
+        return ok ? residentPages * uint64_t(sysconf(_SC_PAGESIZE)) : 0;
+    }
+
+    void print(std::ostream &os, const char *label) const
+    {
+        os << label << ": host " << (hostBytes >> 10) << " KiB, Vulkan device " << (deviceBytes >> 10) << " of "
+           << (deviceReservedBytes >> 10) << " KiB, CUDA " << (cudaBytes >> 10) << " KiB, " << externalImports
+           << " external imports (" << (externalBytes >> 10) << " KiB), resident " << (residentBytes >> 10) << " KiB"
+           << std::endl;
+    }
+};
+
+#endif // MEMORYREPORT_H
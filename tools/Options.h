@@ -0,0 +1,158 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+
+// Runtime switches. Each option can be given on the command line as --name or --name=value, or through the
+// environment as MNIST_<NAME>; the command line wins.
+namespace Options
+{
+struct Settings
+{
+    bool cudaGraphs = false; // Replay the per-frame CUDA work from captured graphs instead of issuing it eagerly
+    bool mnistFit = true; // Fit the digit's bounding box into 20x20 and centre it by mass, as in MNIST
+    bool mnistInvert = false; // The textures show a dark digit on a bright background
+    bool mnistNormalize = false; // Standardize the network input with the MNIST mean and deviation
+    std::string engine = "tensorrt"; // Inference backend: tensorrt, cpu or mock
+    double mockLatencyMs = 0.0; // Delay before a mock engine result becomes visible, to mimic an asynchronous device
+    bool serializeFrames = false; // Wait for the graphics queue to drain after every present, as before frames overlapped
+    std::string pacing = "present"; // Frame pacing: uncapped, fps (targetFps) or present (the swap chain sets the rate)
+    double targetFps = 60.0;
+    std::string presentMode = "mailbox"; // Preferred present mode with pacing=present: mailbox, immediate, fifo, fifo-relaxed
+    bool headless = false; // Render into an offscreen image ring: no window, surface or swap chain
+    uint64_t frames = 0; // Stop after this many frames, 0 runs until interrupted (headless only)
+    bool cudaInterop = true; // false preprocesses on the CPU and needs a host engine (cpu or mock), e.g. under lavapipe
+    std::string pipelineCache = "engineCache/pipeline.vkcache"; // Persistent VkPipelineCache file, empty keeps it in memory
+    bool timelineSemaphores = true; // Order Vulkan and CUDA frames by value on timeline semaphores instead of binary ping-pong
+    bool transferQueue = true; // Upload on a dedicated transfer queue when the device has one
+    std::string input; // Stream images from dir:<path>, file:<path> or stdin instead of cycling the digit textures
+    size_t inputQueue = 4; // Decoded images the input stream buffers ahead of the renderer
+    std::string preprocess = "cuda"; // Who turns the texture into the network input: cuda kernels or a vulkan compute pass
+    std::string timingCache = "readwrite"; // TensorRT timing cache file use when building engines: off, read or readwrite
+};
+
+inline Settings &settings()
+{
+    static Settings instance;
+    return instance;
+}
+
+inline bool toBool(const std::string &value)
+{
+    return value.empty() || value == "1" || value == "true" || value == "on" || value == "yes";
+}
+
+inline bool lookup(int argc, char **argv, const std::string &name, const std::string &envName, std::string &value)
+{
+    const std::string flag = "--" + name;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == flag)
+        {
+            value.clear();
+            return true;
+        }
+        if (arg.rfind(flag + "=", 0) == 0)
+        {
+            value = arg.substr(flag.size() + 1);
+            return true;
+        }
+    }
+    if (const char *env = std::getenv(envName.c_str()))
+    {
+        value = env;
+        return true;
+    }
+    return false;
+}
+
+inline void parse(int argc, char **argv)
+{
+    std::string value;
+    if (lookup(argc, argv, "cuda-graphs", "MNIST_CUDA_GRAPHS", value))
+    {
+        settings().cudaGraphs = toBool(value);
+    }
+    if (lookup(argc, argv, "mnist-fit", "MNIST_MNIST_FIT", value))
+    {
+        settings().mnistFit = toBool(value);
+    }
+    if (lookup(argc, argv, "mnist-invert", "MNIST_MNIST_INVERT", value))
+    {
+        settings().mnistInvert = toBool(value);
+    }
+    if (lookup(argc, argv, "mnist-normalize", "MNIST_MNIST_NORMALIZE", value))
+    {
+        settings().mnistNormalize = toBool(value);
+    }
+    if (lookup(argc, argv, "engine", "MNIST_ENGINE", value))
+    {
+        settings().engine = value;
+    }
+    if (lookup(argc, argv, "mock-latency-ms", "MNIST_MOCK_LATENCY_MS", value))
+    {
+        settings().mockLatencyMs = std::strtod(value.c_str(), nullptr);
+    }
+    if (lookup(argc, argv, "serialize-frames", "MNIST_SERIALIZE_FRAMES", value))
+    {
+        settings().serializeFrames = toBool(value);
+    }
+    if (lookup(argc, argv, "pacing", "MNIST_PACING", value))
+    {
+        settings().pacing = value;
+    }
+    if (lookup(argc, argv, "target-fps", "MNIST_TARGET_FPS", value))
+    {
+        settings().targetFps = std::strtod(value.c_str(), nullptr);
+    }
+    if (lookup(argc, argv, "present-mode", "MNIST_PRESENT_MODE", value))
+    {
+        settings().presentMode = value;
+    }
+    if (lookup(argc, argv, "headless", "MNIST_HEADLESS", value))
+    {
+        settings().headless = toBool(value);
+    }
+    if (lookup(argc, argv, "frames", "MNIST_FRAMES", value))
+    {
+        settings().frames = std::strtoull(value.c_str(), nullptr, 10);
+    }
+    if (lookup(argc, argv, "cuda-interop", "MNIST_CUDA_INTEROP", value))
+    {
+        settings().cudaInterop = toBool(value);
+    }
+    if (lookup(argc, argv, "pipeline-cache", "MNIST_PIPELINE_CACHE", value))
+    {
+        settings().pipelineCache = value;
+    }
+    if (lookup(argc, argv, "timeline-semaphores", "MNIST_TIMELINE_SEMAPHORES", value))
+    {
+        settings().timelineSemaphores = toBool(value);
+    }
+    if (lookup(argc, argv, "transfer-queue", "MNIST_TRANSFER_QUEUE", value))
+    {
+        settings().transferQueue = toBool(value);
+    }
+    if (lookup(argc, argv, "input", "MNIST_INPUT", value))
+    {
+        settings().input = value;
+    }
+    if (lookup(argc, argv, "input-queue", "MNIST_INPUT_QUEUE", value))
+    {
+        settings().inputQueue = std::strtoull(value.c_str(), nullptr, 10);
+    }
+    if (lookup(argc, argv, "preprocess", "MNIST_PREPROCESS", value))
+    {
+        settings().preprocess = value;
+    }
+    if (lookup(argc, argv, "timing-cache", "MNIST_TIMING_CACHE", value))
+    {
+        settings().timingCache = value;
+    }
+}
+} // namespace Options
+
+#endif // OPTIONS_H
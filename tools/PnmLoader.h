@@ -0,0 +1,233 @@
+#ifndef PNMLOADER_H
+#define PNMLOADER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// Binary PPM (P6) and PGM (P5) reader for the texture startup path and the input stream. The file is mapped instead of
+// read through stdio, the header is parsed in place and the pixels are expanded to RGBA8 straight into the caller's
+// memory (usually a staging ring region), with SSSE3 where the CPU has it. Pure CPU code without Vulkan or CUDA
+// dependencies; images with more than 8 bits per channel are rejected.
+namespace Pnm
+{
+// sdkLoadPPM4, which this replaces, padded pixels with a zero alpha; nothing samples alpha, so the bytes stay the same.
+constexpr unsigned char kAlpha = 0;
+
+struct Header
+{
+    uint32_t width = 0, height = 0;
+    uint32_t channels = 0; // 1 for P5, 3 for P6
+    size_t dataOffset = 0; // Start of the pixels in the file
+};
+
+// Parses the header at the start of data. Fields are separated by whitespace and '#' comments; a single whitespace
+// character follows maxval.
+inline bool parseHeader(const unsigned char *data, size_t size, Header &header, std::string &error)
+{
+    if (size < 2 || data[0] != 'P' || (data[1] != '5' && data[1] != '6'))
+    {
+        error = "not a binary PPM or PGM image";
+        return false;
+    }
+    header.channels = data[1] == '6' ? 3 : 1;
+    size_t pos = 2;
+    uint32_t fields[3] = {0, 0, 0};
+    for (uint32_t &field : fields)
+    {
+        for (;;)
+        {
+            while (pos < size && (data[pos] == ' ' || data[pos] == '\t' || data[pos] == '\n' || data[pos] == '\r'))
+                ++pos;
+            if (pos >= size || data[pos] != '#')
+                break;
+            while (pos < size && data[pos] != '\n')
+                ++pos;
+        }
+        if (pos >= size || data[pos] < '0' || data[pos] > '9')
+        {
+            error = "malformed header";
+            return false;
+        }
+        uint64_t value = 0;
+        while (pos < size && data[pos] >= '0' && data[pos] <= '9' && value <= UINT32_MAX)
+            value = value * 10 + (data[pos++] - '0');
+        if (value == 0 || value > UINT32_MAX)
+        {
+            error = "malformed header";
+            return false;
+        }
+        field = uint32_t(value);
+    }
+    if (fields[2] > 255)
+    {
+        error = "16-bit images are not supported";
+        return false;
+    }
+    header.width = fields[0];
+    header.height = fields[1];
+    header.dataOffset = pos + 1;
+    // width * height fits 64 bits, times three for P6 it may not; divide the file size instead.
+    const uint64_t pixels = uint64_t(header.width) * header.height;
+    if (header.dataOffset > size || (size - header.dataOffset) / header.channels < pixels)
+    {
+        error = "file is shorter than its " + std::to_string(header.width) + "x" + std::to_string(header.height) + " pixels";
+        return false;
+    }
+    return true;
+}
+
+inline void expandScalar(const unsigned char *src, unsigned char *dst, size_t pixels, uint32_t channels)
+{
+    for (size_t i = 0; i < pixels; ++i, src += channels, dst += 4)
+    {
+        dst[0] = src[0];
+        dst[1] = src[channels == 3 ? 1 : 0];
+        dst[2] = src[channels == 3 ? 2 : 0];
+        dst[3] = kAlpha;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// 16 pixels per iteration: three 16-byte loads of RGB (or one of gray) become four 16-byte stores of RGBA.
+__attribute__((target("ssse3"))) inline size_t expandSsse3(const unsigned char *src, unsigned char *dst, size_t pixels, uint32_t channels)
+{
+    const __m128i alpha = _mm_set1_epi32(int(uint32_t(kAlpha) << 24));
+    size_t i = 0;
+    if (channels == 3)
+    {
+        const __m128i rgb = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+        for (; i + 16 <= pixels; i += 16, src += 48, dst += 64)
+        {
+            const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+            const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 16));
+            const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 32));
+            const __m128i quads[4] = {a, _mm_alignr_epi8(b, a, 12), _mm_alignr_epi8(c, b, 8), _mm_srli_si128(c, 4)};
+            for (int q = 0; q < 4; ++q)
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 16 * q), _mm_or_si128(_mm_shuffle_epi8(quads[q], rgb), alpha));
+        }
+    }
+    else
+    {
+        const __m128i gray[4] = {_mm_setr_epi8(0, 0, 0, -1, 1, 1, 1, -1, 2, 2, 2, -1, 3, 3, 3, -1),
+                                 _mm_setr_epi8(4, 4, 4, -1, 5, 5, 5, -1, 6, 6, 6, -1, 7, 7, 7, -1),
+                                 _mm_setr_epi8(8, 8, 8, -1, 9, 9, 9, -1, 10, 10, 10, -1, 11, 11, 11, -1),
+                                 _mm_setr_epi8(12, 12, 12, -1, 13, 13, 13, -1, 14, 14, 14, -1, 15, 15, 15, -1)};
+        for (; i + 16 <= pixels; i += 16, src += 16, dst += 64)
+        {
+            const __m128i g = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+            for (int q = 0; q < 4; ++q)
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 16 * q), _mm_or_si128(_mm_shuffle_epi8(g, gray[q]), alpha));
+        }
+    }
+    return i;
+}
+#endif
+
+// Writes pixels RGBA8 texels to dst from channels-byte (1 or 3) source pixels.
+inline void expandToRgba(const unsigned char *src, unsigned char *dst, size_t pixels, uint32_t channels)
+{
+    size_t done = 0;
+#if defined(__x86_64__) || defined(__i386__)
+    static const bool ssse3 = __builtin_cpu_supports("ssse3");
+    if (ssse3)
+        done = expandSsse3(src, dst, pixels, channels);
+#endif
+    expandScalar(src + done * channels, dst + done * 4, pixels - done, channels);
+}
+
+// A mapped image file. Opening maps the file and parses its header; the pixels are decoded on demand, so the
+// decode can run on another thread than the one that needed the size.
+class Image
+{
+public:
+    Image() = default;
+    Image(const Image &) = delete;
+    Image &operator=(const Image &) = delete;
+    Image(Image &&other) noexcept { *this = std::move(other); }
+    Image &operator=(Image &&other) noexcept
+    {
+        if (this != &other)
+        {
+            close();
+            data = other.data;
+            size = other.size;
+            header = other.header;
+            other.data = nullptr;
+            other.size = 0;
+        }
+        return *this;
+    }
+    ~Image() { close(); }
+
+    bool open(const std::string &path, std::string &error)
+    {
+        close();
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            error = "cannot open file";
+            return false;
+        }
+        struct stat status;
+        if (::fstat(fd, &status) != 0 || status.st_size <= 0)
+        {
+            ::close(fd);
+            error = "cannot read file";
+            return false;
+        }
+        size = size_t(status.st_size);
+        void *mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd); // The mapping keeps the file alive
+        if (mapping == MAP_FAILED)
+        {
+            size = 0;
+            error = "cannot map file";
+            return false;
+        }
+        data = static_cast<const unsigned char *>(mapping);
+        // Start reading the pixels in while the header is parsed and the upload is set up.
+        ::madvise(mapping, size, MADV_WILLNEED);
+        if (!parseHeader(data, size, header, error))
+        {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close()
+    {
+        if (data)
+            ::munmap(const_cast<unsigned char *>(data), size);
+        data = nullptr;
+        size = 0;
+    }
+
+    uint32_t width() const { return header.width; }
+    uint32_t height() const { return header.height; }
+    size_t rgbaSize() const { return size_t(header.width) * header.height * 4; }
+
+    // Decodes the whole image into rgbaSize() bytes at rgba.
+    void decodeRgba(unsigned char *rgba) const
+    {
+        expandToRgba(data + header.dataOffset, rgba, size_t(header.width) * header.height, header.channels);
+    }
+
+private:
+    const unsigned char *data = nullptr;
+    size_t size = 0;
+    Header header;
+};
+} // namespace Pnm
+
+#endif // PNMLOADER_H
@@ -0,0 +1,99 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for CPU work that splits into independent tasks, such as decoding textures at
+// startup. Tasks must not throw.
+class ThreadPool
+{
+public:
+    // 0 picks one thread per hardware thread.
+    explicit ThreadPool(size_t threadCount = 0)
+    {
+        if (threadCount == 0)
+        {
+            threadCount = std::max(1u, std::thread::hardware_concurrency());
+        }
+        for (size_t i = 0; i < threadCount; ++i)
+        {
+            workers.emplace_back(&ThreadPool::work, this);
+        }
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        taskAvailable.notify_all();
+        for (std::thread &worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    void enqueue(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(std::move(task));
+            ++unfinished;
+        }
+        taskAvailable.notify_one();
+    }
+
+    // Blocks until every task enqueued so far has run.
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        allDone.wait(lock, [this] { return unfinished == 0; });
+    }
+
+    size_t size() const { return workers.size(); }
+
+private:
+    void work()
+    {
+        for (;;)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                taskAvailable.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (tasks.empty())
+                {
+                    return;
+                }
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--unfinished == 0)
+            {
+                allDone.notify_all();
+            }
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable taskAvailable, allDone;
+    std::deque<std::function<void()>> tasks;
+    size_t unfinished = 0;
+    bool stopping = false;
+};
+
+#endif // THREADPOOL_H
@@ -0,0 +1,170 @@
+#include "engineCache.h"
+#include "NvInfer.h"
+#include "fileLock.h"
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+namespace nvinfer1::utils
+{
+namespace
+{
+//! Every cache file starts with this tag followed by the key it was written for and the plan size.
+constexpr char kEngineCacheMagic[8] = {'M', 'N', 'I', 'S', 'T', 'P', 'L', 'N'};
+
+std::string toHex(uint64_t value)
+{
+    std::stringstream ss;
+    ss << std::hex << std::setw(16) << std::setfill('0') << value;
+    return ss.str();
+}
+} // namespace
+
+uint64_t hashBytes(void const* data, size_t size, uint64_t seed)
+{
+    uint64_t hash = seed;
+    auto const* bytes = static_cast<uint8_t const*>(data);
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+std::vector<char> readBinaryFile(std::string const& fileName)
+{
+    std::ifstream iFile(fileName, std::ios::in | std::ios::binary | std::ios::ate);
+    if (!iFile)
+    {
+        return {};
+    }
+    size_t fsize = iFile.tellg();
+    iFile.seekg(0, std::ifstream::beg);
+    std::vector<char> content(fsize);
+    iFile.read(content.data(), fsize);
+    return content;
+}
+
+std::string computeEngineCacheKey(std::vector<char> const& onnxContents, int32_t tensorrtVersion,
+    std::string const& builderConfigFingerprint, uint8_t const* deviceUUID, size_t uuidSize)
+{
+    // A second FNV-1a pass over the model, chained from the first, widens the model digest to 128 bits. The two are not
+    // independent, but it is enough to keep accidental collisions between model files out of reach.
+    uint64_t modelHash = hashBytes(onnxContents.data(), onnxContents.size());
+    uint64_t modelHashAlt = hashBytes(onnxContents.data(), onnxContents.size(), modelHash ^ onnxContents.size());
+
+    uint64_t configHash = hashBytes(&tensorrtVersion, sizeof(tensorrtVersion));
+    configHash = hashBytes(builderConfigFingerprint.data(), builderConfigFingerprint.size(), configHash);
+    configHash = hashBytes(deviceUUID, uuidSize, configHash);
+
+    return toHex(modelHash) + toHex(modelHashAlt) + "_" + toHex(configHash);
+}
+
+std::string engineCacheFileName(std::string const& cacheDir, std::string const& modelName, std::string const& key)
+{
+    return (std::filesystem::path(cacheDir) / (modelName + "_" + key + ".plan")).string();
+}
+
+std::vector<char> loadEngineCacheFile(ILogger& logger, std::string const& fileName, std::string const& key)
+{
+    try
+    {
+        std::vector<char> content;
+        {
+            FileLock fileLock{logger, fileName};
+            content = readBinaryFile(fileName);
+        }
+        if (content.empty())
+        {
+            logger.log(ILogger::Severity::kINFO, ("No cached engine at " + fileName).c_str());
+            return {};
+        }
+
+        size_t const headerSize = sizeof(kEngineCacheMagic) + sizeof(uint32_t) + key.size() + sizeof(uint64_t);
+        uint32_t keySize = 0;
+        uint64_t planSize = 0;
+        if (content.size() >= sizeof(kEngineCacheMagic) + sizeof(uint32_t))
+        {
+            std::memcpy(&keySize, content.data() + sizeof(kEngineCacheMagic), sizeof(keySize));
+        }
+        if (content.size() < headerSize || std::memcmp(content.data(), kEngineCacheMagic, sizeof(kEngineCacheMagic)) != 0
+            || keySize != key.size()
+            || std::memcmp(content.data() + sizeof(kEngineCacheMagic) + sizeof(uint32_t), key.data(), key.size()) != 0)
+        {
+            logger.log(ILogger::Severity::kWARNING, ("Ignoring stale or foreign engine cache " + fileName).c_str());
+            return {};
+        }
+        std::memcpy(&planSize, content.data() + headerSize - sizeof(uint64_t), sizeof(planSize));
+        if (content.size() - headerSize != planSize)
+        {
+            logger.log(ILogger::Severity::kWARNING, ("Ignoring truncated engine cache " + fileName).c_str());
+            return {};
+        }
+
+        std::stringstream ss;
+        ss << "Loaded " << planSize << " bytes of serialized engine from " << fileName;
+        logger.log(ILogger::Severity::kINFO, ss.str().c_str());
+        return std::vector<char>(content.begin() + headerSize, content.end());
+    }
+    catch (std::exception const& e)
+    {
+        std::cerr << "Exception while loading engine cache file " << fileName << ": " << e.what() << std::endl;
+    }
+    return {};
+}
+
+bool saveEngineCacheFile(
+    ILogger& logger, std::string const& fileName, std::string const& key, void const* plan, size_t planSize)
+{
+    try
+    {
+        std::filesystem::path path(fileName);
+        if (path.has_parent_path())
+        {
+            std::filesystem::create_directories(path.parent_path());
+        }
+
+        FileLock fileLock{logger, fileName};
+        std::string tmpFileName = fileName + ".tmp";
+        {
+            std::ofstream oFile(tmpFileName, std::ios::out | std::ios::binary | std::ios::trunc);
+            if (!oFile)
+            {
+                logger.log(ILogger::Severity::kWARNING, ("Could not write engine cache to: " + tmpFileName).c_str());
+                return false;
+            }
+            uint32_t keySize = static_cast<uint32_t>(key.size());
+            uint64_t size = planSize;
+            oFile.write(kEngineCacheMagic, sizeof(kEngineCacheMagic));
+            oFile.write(reinterpret_cast<char const*>(&keySize), sizeof(keySize));
+            oFile.write(key.data(), key.size());
+            oFile.write(reinterpret_cast<char const*>(&size), sizeof(size));
+            oFile.write(static_cast<char const*>(plan), planSize);
+            if (!oFile.flush())
+            {
+                logger.log(ILogger::Severity::kWARNING, ("Failed writing engine cache " + tmpFileName).c_str());
+                std::remove(tmpFileName.c_str());
+                return false;
+            }
+        }
+        std::filesystem::rename(tmpFileName, fileName);
+
+        std::stringstream ss;
+        ss << "Saved " << planSize << " bytes of serialized engine to " << fileName;
+        logger.log(ILogger::Severity::kINFO, ss.str().c_str());
+        return true;
+    }
+    catch (std::exception const& e)
+    {
+        std::cerr << "Exception while saving engine cache file " << fileName << ": " << e.what() << std::endl;
+    }
+    return false;
+}
+
+} // namespace nvinfer1::utils
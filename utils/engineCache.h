@@ -0,0 +1,47 @@
+#ifndef TRT_SHARED_ENGINECACHE_H_
+#define TRT_SHARED_ENGINECACHE_H_
+
+#include "NvInfer.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace nvinfer1::utils
+{
+
+//! \brief 64-bit FNV-1a hash of a byte range, chainable through \p seed.
+uint64_t hashBytes(void const* data, size_t size, uint64_t seed = 0xcbf29ce484222325ULL);
+
+//! \brief Reads a whole binary file. \returns an empty vector if the file cannot be read.
+std::vector<char> readBinaryFile(std::string const& fileName);
+
+//! \brief Builds the engine cache key for a serialized plan.
+//!
+//! The key covers everything that makes a plan non-portable: the ONNX file contents, the TensorRT library version,
+//! a textual fingerprint of the builder configuration and the UUID of the device the plan is built for.
+//! \returns A lowercase hex string that is safe to use in a file name.
+std::string computeEngineCacheKey(std::vector<char> const& onnxContents, int32_t tensorrtVersion,
+    std::string const& builderConfigFingerprint, uint8_t const* deviceUUID, size_t uuidSize);
+
+//! \brief Returns the cache file path for \p modelName and \p key inside \p cacheDir.
+std::string engineCacheFileName(std::string const& cacheDir, std::string const& modelName, std::string const& key);
+
+//! \brief Loads a cached plan and checks that it was written for \p key.
+//!
+//! \note This is a blocking operation, as this method will acquire an exclusive file lock on the cache file for the
+//! duration of the read. \returns The plan bytes, or an empty vector on a miss, a key mismatch or a truncated file.
+std::vector<char> loadEngineCacheFile(nvinfer1::ILogger& logger, std::string const& fileName, std::string const& key);
+
+//! \brief Writes a plan to the cache, tagged with \p key.
+//!
+//! The plan is written to a temporary file which is then renamed over \p fileName, so readers in other processes
+//! never observe a partially written plan.
+//! \note This is a blocking operation, as this method will acquire an exclusive file lock on the cache file for the
+//! duration of the write. \returns true if the plan was stored.
+bool saveEngineCacheFile(nvinfer1::ILogger& logger, std::string const& fileName, std::string const& key,
+    void const* plan, size_t planSize);
+
+} // namespace nvinfer1::utils
+
+#endif // TRT_SHARED_ENGINECACHE_H_
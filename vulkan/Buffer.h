@@ -9,7 +9,7 @@ class Buffer :public MemoryManager
 {
 public:
     VkBuffer buffer = VK_NULL_HANDLE;
-    VkDeviceMemory memory = VK_NULL_HANDLE;
+    MemoryAllocation allocation;
     VkDescriptorBufferInfo descriptor;
     VkDeviceSize size = 0;
     VkDeviceSize aligment = 0;
@@ -23,7 +23,7 @@ public:
 
         createBuffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                     buffer, memory);
+                     buffer, allocation);
         map();
         memcpy(mapped, t.data(), size);
         unmap();
@@ -34,7 +34,7 @@ public:
         vulkanData_ = vulkanData;
         unmap();
         cleanUp();
-        createBuffer(size, usage, memFlags, buffer, memory);
+        createBuffer(size, usage, memFlags, buffer, allocation);
         if (data != nullptr)
         {
             VK_CHECK(map());
@@ -52,46 +52,43 @@ public:
         descriptor.buffer = buffer;
         descriptor.range = size;
     }
+    // Host-visible allocations stay mapped for their whole life, map() only hands out the address.
     VkResult map(VkDeviceSize size = VK_WHOLE_SIZE, VkDeviceSize offset = 0){
-        return vkMapMemory(vulkanData_.device, memory, offset, size, 0, &mapped);
+        if (!allocation.mapped)
+            return VK_ERROR_MEMORY_MAP_FAILED;
+        mapped = static_cast<char *>(allocation.mapped) + offset;
+        return VK_SUCCESS;
     }
     void unmap()
     {
-        if (mapped)
-        {
-            vkUnmapMemory(vulkanData_.device, memory);
-            mapped = nullptr;
-        }
+        mapped = nullptr;
     }
     void copyTo(void* data, VkDeviceSize size){
         assert(mapped);
         memcpy(mapped, data, size);
     }
     VkResult flush(VkDeviceSize size = VK_WHOLE_SIZE, VkDeviceSize offset = 0){
-        VkMappedMemoryRange mappedRange = {};
-        mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-        mappedRange.memory = memory;
-        mappedRange.offset = offset;
-        mappedRange.size = size;
+        VkMappedMemoryRange mappedRange = memoryRange(size, offset);
         return vkFlushMappedMemoryRanges(vulkanData_.device, 1, &mappedRange);
     }
     VkResult invalidate(VkDeviceSize size = VK_WHOLE_SIZE, VkDeviceSize offset = 0){
-        VkMappedMemoryRange mappedRange = {};
-        mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-        mappedRange.memory = memory;
-        mappedRange.offset = offset;
-        mappedRange.size = size;
+        VkMappedMemoryRange mappedRange = memoryRange(size, offset);
         return vkInvalidateMappedMemoryRanges(vulkanData_.device, 1, &mappedRange);
     }
     void cleanUp(){
-        if (buffer)
-        {
-            vkDestroyBuffer(vulkanData_.device, buffer, nullptr);
-        }
-        if (memory)
-        {
-            vkFreeMemory(vulkanData_.device, memory, nullptr);
-        }
+        unmap();
+        destroyBuffer(buffer, allocation);
+    }
+
+private:
+    // Ranges are relative to the buffer; VK_WHOLE_SIZE has to stop at the end of the buffer's part of the block.
+    VkMappedMemoryRange memoryRange(VkDeviceSize size, VkDeviceSize offset) const{
+        VkMappedMemoryRange mappedRange = {};
+        mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+        mappedRange.memory = allocation.memory;
+        mappedRange.offset = allocation.offset + offset;
+        mappedRange.size = size == VK_WHOLE_SIZE ? allocation.size - offset : size;
+        return mappedRange;
     }
 
 
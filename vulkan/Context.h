@@ -31,6 +31,7 @@ const VkResult result = func;                        \
     struct QueueFamilyIndices {
     std::optional<uint32_t> graphicsAndComputeFamily;
     std::optional<uint32_t> presentFamily;
+    std::optional<uint32_t> transferFamily; // Transfer-capable family without graphics, preferably without compute too
     bool isComplete() {
         return graphicsAndComputeFamily.has_value() && presentFamily.has_value();
     }
@@ -47,6 +48,9 @@ struct Screen{
     int height = 0;
 };
 
+class DeviceMemoryAllocator;
+class StagingRing;
+
 struct VulkanData{
     GLFWwindow *window = nullptr;
     VkInstance instance;
@@ -54,6 +58,9 @@ struct VulkanData{
     VkDevice device;
     VkCommandPool commandPool;
     VkQueue graphicQueue;
+    VkQueue transferQueue = VK_NULL_HANDLE; // Queue of a dedicated transfer family, null when uploads use graphicQueue
+    uint32_t graphicsQueueFamily = 0;
+    uint32_t transferQueueFamily = 0;
     VkExtent2D swapChainExtent;
     VkRenderPass renderpass;
     std::vector<VkBuffer> uniformBuffers;
@@ -62,7 +69,12 @@ struct VulkanData{
     VkSurfaceKHR surface;
     Screen screenProperties;
     uint8_t *vkDeviceUUID = nullptr;
-
+    bool externalMemory = false; // The device was created with the fd-based external memory and semaphore extensions
+    bool timelineSemaphores = false; // The timelineSemaphore feature is enabled on the device
+    bool updateAfterBindTextures = false; // Texture arrays are bound update-after-bind, under the descriptor indexing limits
+    uint32_t maxBoundTextures = 0; // Largest texture array a shader stage can bind next to a few other descriptors
+    DeviceMemoryAllocator *allocator = nullptr; // Owned by Core, sub-allocates buffer and image memory
+    StagingRing *stagingRing = nullptr; // Owned by Core, carries uploads to device-local resources
 };
 
 struct SamplerModes{
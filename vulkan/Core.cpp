@@ -1,8 +1,11 @@
 #include "Core.h"
 #include <iostream>
 #include <cassert>
+#include <algorithm>
 #include <cstring>
 #include <set>
+#include "Options.h"
+#include "Benchmark.h"
 
 #include <glm/gtx/string_cast.hpp>
 Core::Core()
@@ -18,12 +21,25 @@ void Core::init()
 {
     createInstance();
     validation.setupDebugMessenger(instance_);
-    createSurface();
+    if (!headless)
+    {
+        createSurface();
+    }
     pickPhysicalDevice();
     createLogicalDevice();
+    createMemoryAllocator();
     createCommandPool();
+    stagingRing.init(context);
+    context.stagingRing = &stagingRing;
     swapChain.init(context);
-    swapChain.create();
+    if (headless)
+    {
+        swapChain.createOffscreen(offscreenExtent, MAX_FRAMES_IN_FLIGHT);
+    }
+    else
+    {
+        swapChain.create();
+    }
     swapChain.createImageViews();
     context.swapChainExtent = swapChain.extent;
     createRenderPass();
@@ -35,11 +51,13 @@ void Core::init()
     createCommandBuffer();
     
     createSyncObjects();
-    mUserInterface.init(context);
+    mUserInterface.init(context, MAX_FRAMES_IN_FLIGHT);
     mUserInterface.shaders = {vertexShaders.createShaderModule("shaders/uioverlay.vert.spv", VK_SHADER_STAGE_VERTEX_BIT, logicalDevice_),
                               fragmentShaders.createShaderModule("shaders/uioverlay.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT, logicalDevice_)};
     mUserInterface.prepareResources();
-    mUserInterface.preparePipeline(pipelineCache, renderPass_, swapChain.imageFormat, depthFormat);
+    auto tPipeline = Benchmark::Clock::now();
+    mUserInterface.preparePipeline(pipelineCache.cache, renderPass_, swapChain.imageFormat, depthFormat);
+    pipelineCreateMs += Benchmark::elapsedMs(tPipeline);
     vertexShaders.cleanUp(logicalDevice_);
     fragmentShaders.cleanUp(logicalDevice_);
 }
@@ -51,8 +69,10 @@ void Core::cleanUp()
     depthBufferObject.cleanUp();
     vkDestroyImageView(logicalDevice_, colorImageView, nullptr);
     vkDestroyImage(logicalDevice_, colorImage, nullptr);
-    vkFreeMemory(logicalDevice_, colorImageMemory, nullptr);
-    vkDestroyPipelineCache(logicalDevice_, pipelineCache, nullptr);
+    memoryAllocator->free(colorImageMemory);
+    // Picks up pipelines compiled after startup.
+    pipelineCache.saveIfChanged();
+    pipelineCache.cleanUp();
     swapChain.cleanup();
     vkDestroyRenderPass(logicalDevice_, renderPass_, nullptr);
 
@@ -64,7 +84,10 @@ void Core::cleanUp()
     imageAvailableSemaphores.clear();
     renderFinishedSemaphores.clear();
     mUserInterface.cleanUp();
+    stagingRing.cleanUp();
     vkDestroyCommandPool(logicalDevice_, commandPool_, nullptr);
+    memoryAllocator.reset();
+    memoryBackend.reset();
     vkDestroyDevice(logicalDevice_, nullptr);
     validation.cleanUp(instance_);
     vkDestroySurfaceKHR(instance_, surface_, nullptr);
@@ -73,7 +96,7 @@ void Core::cleanUp()
 
 void Core::windowResize()
 {
-    if (!prepared)
+    if (!prepared || headless)
     {
         return;
     }
@@ -88,8 +111,6 @@ void Core::windowResize()
     }
     vkDeviceWaitIdle(logicalDevice_);
     clearSwapChain();
-    vkFreeCommandBuffers(logicalDevice_, commandPool_, static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
-    createCommandBuffer();
     buildCommandBuffers();
     vkDeviceWaitIdle(logicalDevice_);
     if ((width > 0.0f) && (height > 0.0f))
@@ -254,6 +275,10 @@ void Core::pickPhysicalDevice()
 
     vkEnumeratePhysicalDevices(instance_, &deviceCount, devices.data());
 
+    if (!headless)
+    {
+        deviceExtensions = swapChainExtensions;
+    }
     // Get suitable device for application.
     for (const auto &device : devices)
     {
@@ -271,6 +296,16 @@ void Core::pickPhysicalDevice()
         throw std::runtime_error("failed to find a suitable GPU!");
     }
 
+    context.externalMemory = checkDeviceExtensionSupport(physicalDevice_, interopExtensions);
+    if (context.externalMemory)
+    {
+        deviceExtensions.insert(deviceExtensions.end(), interopExtensions.begin(), interopExtensions.end());
+    }
+    else
+    {
+        std::cout << "Device has no external memory support, CUDA interop is unavailable" << std::endl;
+    }
+
     context.physicalDevice = physicalDevice_;
 
     VkPhysicalDeviceProperties properties{};
@@ -319,9 +354,17 @@ void Core::createLogicalDevice()
 {
     // Get selected queue family.
     indices = findQueueFamilies(physicalDevice_, surface_);
+    if (!Options::settings().transferQueue)
+    {
+        indices.transferFamily.reset();
+    }
 
     std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
     std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsAndComputeFamily.value(), indices.presentFamily.value()};
+    if (indices.transferFamily.has_value())
+    {
+        uniqueQueueFamilies.insert(indices.transferFamily.value());
+    }
 
     // Define Queue properties
     float queuePriority = 1.0f;
@@ -338,6 +381,40 @@ void Core::createLogicalDevice()
     VkPhysicalDeviceFeatures deviceFeatures{};
     VkDeviceCreateInfo deviceCreateInfo{};
     deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+
+    // Timeline semaphores are core since Vulkan 1.2 but remain an optional feature; the CUDA interop falls back to
+    // binary semaphores when the device does not offer them.
+    VkPhysicalDeviceTimelineSemaphoreFeatures timelineFeatures{};
+    timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+    VkPhysicalDeviceDescriptorIndexingFeatures indexingFeatures{};
+    indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+    timelineFeatures.pNext = &indexingFeatures;
+    VkPhysicalDeviceFeatures2 supportedFeatures2{};
+    supportedFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    supportedFeatures2.pNext = &timelineFeatures;
+    vkGetPhysicalDeviceFeatures2(physicalDevice_, &supportedFeatures2);
+    context.timelineSemaphores = context.externalMemory && Options::settings().timelineSemaphores && timelineFeatures.timelineSemaphore == VK_TRUE;
+    // Texture arrays bound as update-after-bind descriptors count against the descriptor indexing limits, hundreds of
+    // thousands of images per stage, instead of the 16 samplers a stage is guaranteed otherwise.
+    context.updateAfterBindTextures = indexingFeatures.descriptorBindingSampledImageUpdateAfterBind == VK_TRUE;
+
+    // Only the features in use are enabled, chained from whatever the device offers.
+    VkPhysicalDeviceDescriptorIndexingFeatures enabledIndexingFeatures{};
+    enabledIndexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+    enabledIndexingFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+    timelineFeatures.pNext = nullptr;
+    void *enabledFeatures = nullptr;
+    if (context.updateAfterBindTextures)
+    {
+        enabledIndexingFeatures.pNext = enabledFeatures;
+        enabledFeatures = &enabledIndexingFeatures;
+    }
+    if (context.timelineSemaphores)
+    {
+        timelineFeatures.pNext = enabledFeatures;
+        enabledFeatures = &timelineFeatures;
+    }
+    deviceCreateInfo.pNext = enabledFeatures;
     deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();
     deviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
     deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
@@ -346,6 +423,7 @@ void Core::createLogicalDevice()
     deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
     deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.data();
     deviceFeatures.samplerAnisotropy = VK_TRUE;
+    deviceFeatures.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
     deviceFeatures.fillModeNonSolid = VK_TRUE;
     // Previous Vulkan implementations needed to distinct instance validation layer and device validation layer but this no longer case.
     if (enableValidationLayers)
@@ -366,10 +444,19 @@ void Core::createLogicalDevice()
 
     context.device = logicalDevice_;
     context.graphicQueue = graphicQueue_;
+    context.graphicsQueueFamily = indices.graphicsAndComputeFamily.value();
+    if (indices.transferFamily.has_value())
+    {
+        vkGetDeviceQueue(logicalDevice_, indices.transferFamily.value(), 0, &context.transferQueue);
+        context.transferQueueFamily = indices.transferFamily.value();
+    }
+
+    VkPhysicalDeviceDescriptorIndexingProperties indexingProperties{};
+    indexingProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES;
 
     VkPhysicalDeviceIDProperties vkPhysicalDeviceIDProperties = {};
     vkPhysicalDeviceIDProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
-    vkPhysicalDeviceIDProperties.pNext = NULL;
+    vkPhysicalDeviceIDProperties.pNext = &indexingProperties;
 
     VkPhysicalDeviceProperties2 vkPhysicalDeviceProperties2 = {};
     vkPhysicalDeviceProperties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
@@ -390,6 +477,24 @@ void Core::createLogicalDevice()
 
     context.vkDeviceUUID = vkDeviceUUID_;
 
+    // The digit textures are bound as one array in the fragment stage and, next to the preprocess pass's two storage
+    // buffers, in the compute stage.
+    const VkPhysicalDeviceLimits &limits = vkPhysicalDeviceProperties2.properties.limits;
+    if (context.updateAfterBindTextures)
+    {
+        context.maxBoundTextures = std::min({indexingProperties.maxPerStageDescriptorUpdateAfterBindSamplers,
+                                             indexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages,
+                                             indexingProperties.maxDescriptorSetUpdateAfterBindSamplers,
+                                             indexingProperties.maxDescriptorSetUpdateAfterBindSampledImages,
+                                             indexingProperties.maxPerStageUpdateAfterBindResources - 2});
+    }
+    else
+    {
+        context.maxBoundTextures = std::min({limits.maxPerStageDescriptorSamplers, limits.maxPerStageDescriptorSampledImages,
+                                             limits.maxDescriptorSetSamplers, limits.maxDescriptorSetSampledImages,
+                                             limits.maxPerStageResources - 2});
+    }
+
     VkBool32 validFormat{false};
     if (requiresStencil)
     {
@@ -432,14 +537,14 @@ bool Core::checkRequestedLayerSupported()
     return true;
 }
 
-bool Core::checkDeviceExtensionSupport(VkPhysicalDevice device)
+bool Core::checkDeviceExtensionSupport(VkPhysicalDevice device, const std::vector<const char *> &extensions)
 {
     uint32_t extensionCount = 0;
     vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
     std::vector<VkExtensionProperties> availableExtension(extensionCount);
     vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtension.data());
 
-    std::set<std::string> requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
+    std::set<std::string> requiredExtensions(extensions.begin(), extensions.end());
 
     for (const auto &extension : availableExtension)
     {
@@ -450,11 +555,14 @@ bool Core::checkDeviceExtensionSupport(VkPhysicalDevice device)
 
 std::vector<const char *> Core::getRequiredExtensions()
 {
-    uint32_t glfwExtensionCount = 0;
-    const char **glfwExtensions;
-    glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-
-    std::vector<const char *> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
+    std::vector<const char *> extensions;
+    if (!headless)
+    {
+        uint32_t glfwExtensionCount = 0;
+        const char **glfwExtensions;
+        glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+        extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+    }
 
     if (enableValidationLayers)
     {
@@ -468,9 +576,9 @@ bool Core::isDeviceSuitable(VkPhysicalDevice device)
 {
     QueueFamilyIndices indices = findQueueFamilies(device, surface_);
 
-    bool extensionSupported = checkDeviceExtensionSupport(device);
-    bool swapChainAdequate = false;
-    if (extensionSupported)
+    bool extensionSupported = checkDeviceExtensionSupport(device, deviceExtensions);
+    bool swapChainAdequate = headless;
+    if (extensionSupported && !headless)
     {
         SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device, surface_);
         swapChainAdequate = !swapChainSupport.formats.empty() && !swapChainSupport.presentModes.empty();
@@ -478,7 +586,8 @@ bool Core::isDeviceSuitable(VkPhysicalDevice device)
     VkPhysicalDeviceFeatures supportedFeatures;
     vkGetPhysicalDeviceFeatures(device, &supportedFeatures);
 
-    return indices.isComplete() && extensionSupported && swapChainAdequate && supportedFeatures.samplerAnisotropy && supportedFeatures.geometryShader;
+    return indices.isComplete() && extensionSupported && swapChainAdequate && supportedFeatures.samplerAnisotropy && supportedFeatures.geometryShader &&
+           supportedFeatures.shaderSampledImageArrayDynamicIndexing;
 }
 
 void Core::createSurface()
@@ -527,7 +636,7 @@ void Core::clearSwapChain()
     depthBufferObject.cleanUp();
     vkDestroyImageView(logicalDevice_, colorImageView, nullptr);
     vkDestroyImage(logicalDevice_, colorImage, nullptr);
-    vkFreeMemory(logicalDevice_, colorImageMemory, nullptr);
+    memoryAllocator->free(colorImageMemory);
 
     swapChain.init(context);
     swapChain.recreate();
@@ -538,11 +647,27 @@ void Core::clearSwapChain()
     createFramebuffers();
 }
 
+void Core::createMemoryAllocator()
+{
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice_, &memoryProperties);
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDevice_, &deviceProperties);
+
+    DeviceMemoryAllocator::Limits limits;
+    limits.maxMemoryAllocationCount = deviceProperties.limits.maxMemoryAllocationCount;
+    limits.bufferImageGranularity = deviceProperties.limits.bufferImageGranularity;
+    limits.nonCoherentAtomSize = deviceProperties.limits.nonCoherentAtomSize;
+
+    memoryBackend = std::make_unique<VulkanMemoryBackend>(logicalDevice_);
+    memoryAllocator = std::make_unique<DeviceMemoryAllocator>(*memoryBackend, memoryProperties, limits);
+    // Set before anything copies the context, every resource allocates through it.
+    context.allocator = memoryAllocator.get();
+}
+
 void Core::createPipelineCache()
 {
-    VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {};
-    pipelineCacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
-    VK_CHECK(vkCreatePipelineCache(logicalDevice_, &pipelineCacheCreateInfo, nullptr, &pipelineCache));
+    pipelineCache.init(context, Options::settings().pipelineCache);
 }
 
 void Core::createRenderPass()
@@ -584,6 +709,11 @@ void Core::createRenderPass()
     // The finalLayout specifies the layout to automatically transition to when the render pass finishes.
     // We want the image to be ready for presentation using the swap chain after rendering, which is why we use VK_IMAGE_LAYOUT_PRESENT_SRC_KHR as finalLayout.
     colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    // Offscreen images are never presented (PRESENT_SRC_KHR needs VK_KHR_swapchain); leave them ready for a readback.
+    if (headless)
+    {
+        colorAttachment.finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    }
 
     // Subpasses and attachment references
     // A single render pass can consist of multiple subpasses. Subpasses are subsequent rendering operations that depend on the contents of framebuffers in previous passes, for example a sequence of post-processing effects that are applied one after another.
@@ -621,7 +751,7 @@ void Core::createRenderPass()
     dependencies[1].dstSubpass = 0;
     dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
     dependencies[1].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependencies[1].srcAccessMask = 0;
+    dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT; // Previous frames may still be writing to shared attachments
     dependencies[1].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_READ_BIT;
     dependencies[1].dependencyFlags = 0;
 
@@ -696,7 +826,9 @@ void Core::createCommandPool()
 
 void Core::createCommandBuffer()
 {
-    commandBuffers.resize(swapChain.images.size());
+    // One command buffer per frame in flight. Each is re-recorded for whichever swap chain image the frame acquires,
+    // once the frame's fence says the GPU is done with its previous contents.
+    commandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
     VkCommandBufferAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
     allocInfo.commandPool = commandPool_;
@@ -705,7 +837,7 @@ void Core::createCommandBuffer()
     VK_CHECK(vkAllocateCommandBuffers(logicalDevice_, &allocInfo, commandBuffers.data()));
 }
 
-void Core::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex)
+void Core::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex, size_t currentFrameIdx)
 {
 }
 
@@ -724,19 +856,23 @@ void Core::nextFrame()
     }
 }
 
-void Core::prepareFrame(uint32_t& imageIndex, size_t& currentFrameIdx)
+bool Core::prepareFrame(uint32_t& imageIndex, size_t& currentFrameIdx)
 {
-    vkWaitForFences(logicalDevice_, 1, &inFlightFences[currentFrameIdx], VK_TRUE, UINT64_MAX);
+    // This is the only point where the CPU waits for the GPU: the frame that last used this slot has to finish before
+    // its command buffer and per-frame buffers are overwritten. Up to MAX_FRAMES_IN_FLIGHT frames stay queued.
+    VK_CHECK(vkWaitForFences(logicalDevice_, 1, &inFlightFences[currentFrameIdx], VK_TRUE, UINT64_MAX));
 
     VkResult result = swapChain.acquireNextImage(imageAvailableSemaphores[currentFrameIdx], imageIndex);
 
     if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+        // Nothing was acquired, so the semaphore is unsignaled and the fence must stay signaled for the next attempt.
         windowResize();
-        return;
+        return false;
     } else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
         throw std::runtime_error("failed to acquire swap chain image!");
     }
-    vkResetFences(logicalDevice_, 1, &inFlightFences[currentFrameIdx]);
+    VK_CHECK(vkResetFences(logicalDevice_, 1, &inFlightFences[currentFrameIdx]));
+    return true;
 }
 
 void Core::submitFrame(uint32_t& imageIndex, size_t& currentFrameIdx)
@@ -754,7 +890,9 @@ void Core::submitFrame(uint32_t& imageIndex, size_t& currentFrameIdx)
     else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
         throw std::runtime_error("failed to acquire swap chain image!");
     }
-    VK_CHECK(vkQueueWaitIdle(graphicQueue_));
+    if (Options::settings().serializeFrames) {
+        VK_CHECK(vkQueueWaitIdle(graphicQueue_));
+    }
     currentFrame++;
 
 }
@@ -804,14 +942,14 @@ void Core::OnUpdateUIOverlay(UserInterface *userInterface)
 {
 }
 
-void Core::drawUI(const VkCommandBuffer commandBuffer)
+void Core::drawUI(const VkCommandBuffer commandBuffer, size_t currentFrameIdx)
 {
 
     const VkViewport viewport = initializers::viewport((float)swapChain.extent.width, (float)swapChain.extent.height, 0.0f, 1.0f);
     const VkRect2D scissor = initializers::rect2D(swapChain.extent.width, swapChain.extent.height, 0, 0);
     vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
     vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
-    mUserInterface.draw(commandBuffer);
+    mUserInterface.draw(commandBuffer, static_cast<uint32_t>(currentFrameIdx));
 }
 
 
@@ -5,6 +5,7 @@
 #define GLM_FORCE_RADIANS
 #include <GLFW/glfw3.h>
 
+#include <memory>
 #include <vector>
 
 #include "Context.h"
@@ -12,6 +13,8 @@
 #include "Shader.h"
 #include "SwapChain.h"
 #include "DepthBuffer.h"
+#include "PipelineCache.h"
+#include "StagingRing.h"
 
 #include "HelperFunctions.h"
 #include "Initializers.h"
@@ -72,7 +75,7 @@ private:
     // Extensions and validation layers.
 private:
     bool checkRequestedLayerSupported();
-    bool checkDeviceExtensionSupport(VkPhysicalDevice device);
+    bool checkDeviceExtensionSupport(VkPhysicalDevice device, const std::vector<const char *> &extensions);
     std::vector<const char *> getRequiredExtensions();
 #ifdef NDEBUG
     const bool enableValidationLayers = false;
@@ -80,11 +83,14 @@ private:
     const bool enableValidationLayers = true;
 #endif
     const std::vector<const char *> validationLayers = {"VK_LAYER_KHRONOS_validation"};
-    const std::vector<const char *> deviceExtensions = {VK_KHR_SWAPCHAIN_EXTENSION_NAME,
-                                                        VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME,
-                                                        VK_KHR_EXTERNAL_SEMAPHORE_EXTENSION_NAME,
-                                                        VK_KHR_EXTERNAL_SEMAPHORE_FD_EXTENSION_NAME,
-                                                        VK_KHR_EXTERNAL_MEMORY_FD_EXTENSION_NAME};
+    const std::vector<const char *> swapChainExtensions = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
+    // Needed for sharing textures and semaphores with CUDA. Optional, so software drivers without them still run the
+    // host preprocessing path.
+    const std::vector<const char *> interopExtensions = {VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME,
+                                                         VK_KHR_EXTERNAL_SEMAPHORE_EXTENSION_NAME,
+                                                         VK_KHR_EXTERNAL_SEMAPHORE_FD_EXTENSION_NAME,
+                                                         VK_KHR_EXTERNAL_MEMORY_FD_EXTENSION_NAME};
+    std::vector<const char *> deviceExtensions; // Filled in by pickPhysicalDevice
 
 private:
     Validation validation{};
@@ -110,7 +116,15 @@ private:
     // Swap Chain
 public:
     void createPipelineCache();
-    VkPipelineCache pipelineCache{VK_NULL_HANDLE};
+    PipelineCache pipelineCache;
+    double pipelineCreateMs = 0.0; // Time spent in vkCreateGraphicsPipelines, to compare cold and warm caches
+    // Device memory
+private:
+    void createMemoryAllocator();
+protected:
+    std::unique_ptr<VulkanMemoryBackend> memoryBackend;
+    std::unique_ptr<DeviceMemoryAllocator> memoryAllocator; // Shared with every resource through context.allocator
+    StagingRing stagingRing;
     // Render passes
 private:
     void createRenderPass();
@@ -121,11 +135,10 @@ private:
 private:
     void createCommandPool();
     void createCommandBuffer();
-    void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex);
     // Draw
 public:
     void nextFrame();
-    void prepareFrame(uint32_t &imageIndex, size_t &currentFrameIdx);
+    bool prepareFrame(uint32_t &imageIndex, size_t &currentFrameIdx);
     void submitFrame(uint32_t &imageIndex, size_t &currentFrameIdx);
     // void drawFrame();
 
@@ -153,7 +166,7 @@ protected:
 private:
     VkSampleCountFlagBits msaaSamples = VK_SAMPLE_COUNT_1_BIT;
     VkImage colorImage;
-    VkDeviceMemory colorImageMemory;
+    MemoryAllocation colorImageMemory;
     VkImageView colorImageView;
     void createColorResources();
 
@@ -167,9 +180,13 @@ protected:
     virtual void prepare();
     virtual void renderFrame();
     virtual void buildCommandBuffers();
+    virtual void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex, size_t currentFrameIdx);
     virtual void OnUpdateUIOverlay(UserInterface *userInterface);
     bool prepared = false;
     bool requiresStencil{false};
+    // Headless runs render into an offscreen ring of MAX_FRAMES_IN_FLIGHT images instead of a window's swap chain.
+    bool headless = false;
+    VkExtent2D offscreenExtent{640, 640};
 
 protected:
     VulkanData context;
@@ -180,7 +197,7 @@ protected:
     Shader fragmentShaders;
 
 protected:
-    void drawUI(const VkCommandBuffer commandBuffer);
+    void drawUI(const VkCommandBuffer commandBuffer, size_t currentFrameIdx);
 
     uint8_t vkDeviceUUID_[VK_UUID_SIZE];
 };
@@ -20,7 +20,7 @@ void DepthBuffer::cleanUp()
 {
     vkDestroyImageView(vulkanData_.device, imageView, nullptr);
     vkDestroyImage(vulkanData_.device, image, nullptr);
-    vkFreeMemory(vulkanData_.device, imageMemory, nullptr);
+    vulkanData_.allocator->free(imageMemory);
 }
 
 void DepthBuffer::createSources()
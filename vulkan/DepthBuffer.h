@@ -28,7 +28,7 @@ public:
     void init(const VulkanData &vulkanData);
     void cleanUp();
     VkImage image;
-    VkDeviceMemory imageMemory;
+    MemoryAllocation imageMemory;
     VkImageView imageView;
 
     void createSources();
@@ -0,0 +1,322 @@
+#include "DeviceMemoryAllocator.h"
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+    return alignment > 1 ? (value + alignment - 1) / alignment * alignment : value;
+}
+} // namespace
+
+VkResult VulkanMemoryBackend::allocate(const VkMemoryAllocateInfo &allocateInfo, VkDeviceMemory &memory)
+{
+    return vkAllocateMemory(device, &allocateInfo, nullptr, &memory);
+}
+
+void VulkanMemoryBackend::free(VkDeviceMemory memory)
+{
+    // Freeing a mapped allocation unmaps it implicitly.
+    vkFreeMemory(device, memory, nullptr);
+}
+
+VkResult VulkanMemoryBackend::map(VkDeviceMemory memory, void **data)
+{
+    return vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, data);
+}
+
+DeviceMemoryAllocator::DeviceMemoryAllocator(DeviceMemoryBackend &backend, const VkPhysicalDeviceMemoryProperties &memoryProperties,
+                                             const Limits &limits, VkDeviceSize requestedBlockSize)
+    : backend(backend), memoryProperties(memoryProperties), limits(limits), blockSize(kMinBuddySize)
+{
+    // Buddy blocks split in halves down to kMinBuddySize, so the block size has to be a power of two.
+    while (blockSize * 2 <= requestedBlockSize)
+    {
+        blockSize *= 2;
+    }
+    pools.resize(memoryProperties.memoryTypeCount * 2);
+}
+
+DeviceMemoryAllocator::~DeviceMemoryAllocator()
+{
+    if (statistics.allocations != 0)
+    {
+        std::cerr << "DeviceMemoryAllocator destroyed with " << statistics.allocations << " live allocations" << std::endl;
+    }
+    for (Pool &p : pools)
+    {
+        for (Block &block : p.blocks)
+        {
+            if (block.memory != VK_NULL_HANDLE)
+            {
+                backend.free(block.memory);
+            }
+        }
+    }
+}
+
+bool DeviceMemoryAllocator::isHostVisible(uint32_t memoryTypeIndex) const
+{
+    return (memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0;
+}
+
+VkDeviceSize DeviceMemoryAllocator::blockSizeFor(uint32_t memoryTypeIndex) const
+{
+    const VkDeviceSize heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[memoryTypeIndex].heapIndex].size;
+    VkDeviceSize size = blockSize;
+    while (size > kMinBuddySize && size * 8 > heapSize)
+    {
+        size /= 2;
+    }
+    return size;
+}
+
+uint32_t DeviceMemoryAllocator::buddyOrder(VkDeviceSize size) const
+{
+    uint32_t order = 0;
+    while ((kMinBuddySize << order) < size)
+    {
+        ++order;
+    }
+    return order;
+}
+
+VkDeviceMemory DeviceMemoryAllocator::allocateDeviceMemory(VkDeviceSize size, uint32_t memoryTypeIndex, const void *pNext, void **mapped)
+{
+    if (statistics.deviceAllocations >= limits.maxMemoryAllocationCount)
+    {
+        throw std::runtime_error("device memory allocation count would exceed maxMemoryAllocationCount (" +
+                                 std::to_string(limits.maxMemoryAllocationCount) + ")");
+    }
+    VkMemoryAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.pNext = pNext;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memoryTypeIndex;
+
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    if (backend.allocate(allocInfo, memory) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to allocate " + std::to_string(size) + " bytes of device memory!");
+    }
+    *mapped = nullptr;
+    if (isHostVisible(memoryTypeIndex) && backend.map(memory, mapped) != VK_SUCCESS)
+    {
+        backend.free(memory);
+        throw std::runtime_error("failed to map device memory!");
+    }
+    statistics.deviceAllocations++;
+    statistics.bytesReserved += size;
+    return memory;
+}
+
+void DeviceMemoryAllocator::freeDeviceMemory(VkDeviceMemory memory)
+{
+    backend.free(memory);
+    statistics.deviceAllocations--;
+}
+
+MemoryAllocation DeviceMemoryAllocator::allocateDedicated(const VkMemoryRequirements &requirements, uint32_t memoryTypeIndex, const void *pNext)
+{
+    MemoryAllocation allocation;
+    allocation.memory = allocateDeviceMemory(requirements.size, memoryTypeIndex, pNext, &allocation.mapped);
+    allocation.size = requirements.size;
+    allocation.memoryTypeIndex = memoryTypeIndex;
+    statistics.dedicated++;
+    statistics.allocations++;
+    statistics.bytesUsed += requirements.size;
+    return allocation;
+}
+
+MemoryAllocation DeviceMemoryAllocator::allocate(const VkMemoryRequirements &requirements, uint32_t memoryTypeIndex, Strategy strategy)
+{
+    // Linear and optimal resources may share a block, so every allocation starts on a bufferImageGranularity boundary.
+    // Host-visible, non-coherent memory is padded to whole atoms so flushing one allocation never touches another.
+    VkDeviceSize alignment = std::max<VkDeviceSize>(requirements.alignment, limits.bufferImageGranularity);
+    VkDeviceSize size = requirements.size;
+    const VkMemoryPropertyFlags flags = memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags;
+    if ((flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) && !(flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+    {
+        alignment = std::max(alignment, limits.nonCoherentAtomSize);
+        size = alignUp(size, limits.nonCoherentAtomSize);
+    }
+
+    const VkDeviceSize typeBlockSize = blockSizeFor(memoryTypeIndex);
+    if (size > typeBlockSize / 2)
+    {
+        return allocateDedicated(requirements, memoryTypeIndex);
+    }
+
+    Pool &p = pool(memoryTypeIndex, strategy);
+    int32_t blockIndex = -1;
+    VkDeviceSize offset = 0, reserved = 0;
+    for (size_t i = 0; i < p.blocks.size() && blockIndex < 0; ++i)
+    {
+        if (p.blocks[i].memory != VK_NULL_HANDLE && allocateFromBlock(p.blocks[i], strategy, size, alignment, offset, reserved))
+        {
+            blockIndex = static_cast<int32_t>(i);
+        }
+    }
+    if (blockIndex < 0)
+    {
+        auto freeSlot = std::find_if(p.blocks.begin(), p.blocks.end(), [](const Block &block) { return block.memory == VK_NULL_HANDLE; });
+        if (freeSlot == p.blocks.end())
+        {
+            freeSlot = p.blocks.insert(p.blocks.end(), Block{});
+        }
+        Block &block = *freeSlot;
+        block = Block{};
+        block.memory = allocateDeviceMemory(typeBlockSize, memoryTypeIndex, nullptr, &block.mapped);
+        block.size = typeBlockSize;
+        if (strategy == Strategy::Buddy)
+        {
+            block.freeLists.resize(buddyOrder(typeBlockSize) + 1);
+            block.freeLists.back().insert(0);
+        }
+        if (!allocateFromBlock(block, strategy, size, alignment, offset, reserved))
+        {
+            // Only an alignment larger than the block gets here; keeping the block would leave it empty for good.
+            statistics.bytesReserved -= block.size;
+            freeDeviceMemory(block.memory);
+            block = Block{};
+            throw std::runtime_error("cannot place " + std::to_string(size) + " bytes aligned to " + std::to_string(alignment) +
+                                     " in a " + std::to_string(typeBlockSize) + " byte block!");
+        }
+        statistics.blocks++;
+        blockIndex = static_cast<int32_t>(freeSlot - p.blocks.begin());
+    }
+
+    Block &block = p.blocks[blockIndex];
+    block.live++;
+    MemoryAllocation allocation;
+    allocation.memory = block.memory;
+    allocation.offset = offset;
+    allocation.size = reserved;
+    allocation.mapped = block.mapped ? static_cast<char *>(block.mapped) + offset : nullptr;
+    allocation.memoryTypeIndex = memoryTypeIndex;
+    allocation.block = blockIndex;
+    allocation.strategy = static_cast<uint8_t>(strategy);
+    statistics.allocations++;
+    statistics.bytesUsed += reserved;
+    return allocation;
+}
+
+bool DeviceMemoryAllocator::allocateFromBlock(Block &block, Strategy strategy, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize &offset, VkDeviceSize &reserved)
+{
+    if (strategy == Strategy::Linear)
+    {
+        const VkDeviceSize start = alignUp(block.head, alignment);
+        if (start + size > block.size)
+        {
+            return false;
+        }
+        offset = start;
+        reserved = size;
+        block.head = start + size;
+        return true;
+    }
+
+    // Buddies are aligned to their own size, so a buddy at least as large as the alignment satisfies it.
+    const uint32_t order = buddyOrder(std::max(size, alignment));
+    uint32_t available = order;
+    while (available < block.freeLists.size() && block.freeLists[available].empty())
+    {
+        ++available;
+    }
+    if (available >= block.freeLists.size())
+    {
+        return false;
+    }
+    offset = *block.freeLists[available].begin();
+    block.freeLists[available].erase(block.freeLists[available].begin());
+    while (available > order)
+    {
+        --available;
+        block.freeLists[available].insert(offset + (kMinBuddySize << available));
+    }
+    block.allocatedOrders[offset] = order;
+    reserved = kMinBuddySize << order;
+    return true;
+}
+
+void DeviceMemoryAllocator::freeFromBlock(Block &block, Strategy strategy, VkDeviceSize offset)
+{
+    if (strategy == Strategy::Linear)
+    {
+        // Staging allocations are released together, after which the block starts over from the beginning.
+        if (block.live == 0)
+        {
+            block.head = 0;
+        }
+        return;
+    }
+
+    auto allocated = block.allocatedOrders.find(offset);
+    if (allocated == block.allocatedOrders.end())
+    {
+        throw std::runtime_error("freeing device memory that was not allocated from this block!");
+    }
+    uint32_t order = allocated->second;
+    block.allocatedOrders.erase(allocated);
+    while (order + 1 < block.freeLists.size())
+    {
+        const VkDeviceSize buddy = offset ^ (kMinBuddySize << order);
+        auto freeBuddy = block.freeLists[order].find(buddy);
+        if (freeBuddy == block.freeLists[order].end())
+        {
+            break;
+        }
+        block.freeLists[order].erase(freeBuddy);
+        offset = std::min(offset, buddy);
+        ++order;
+    }
+    block.freeLists[order].insert(offset);
+}
+
+void DeviceMemoryAllocator::free(MemoryAllocation &allocation)
+{
+    if (!allocation)
+    {
+        return;
+    }
+    statistics.allocations--;
+    statistics.bytesUsed -= allocation.size;
+    if (allocation.block < 0)
+    {
+        statistics.dedicated--;
+        statistics.bytesReserved -= allocation.size;
+        freeDeviceMemory(allocation.memory);
+        allocation = MemoryAllocation{};
+        return;
+    }
+
+    const Strategy strategy = static_cast<Strategy>(allocation.strategy);
+    Pool &p = pool(allocation.memoryTypeIndex, strategy);
+    Block &block = p.blocks[allocation.block];
+    block.live--;
+    freeFromBlock(block, strategy, allocation.offset);
+
+    // An empty block goes back to the device unless it is the last one of its pool, which is kept for the next upload.
+    const bool otherBlocks = std::any_of(p.blocks.begin(), p.blocks.end(), [&block](const Block &other) {
+        return &other != &block && other.memory != VK_NULL_HANDLE;
+    });
+    if (block.live == 0 && otherBlocks)
+    {
+        statistics.blocks--;
+        statistics.bytesReserved -= block.size;
+        freeDeviceMemory(block.memory);
+        block = Block{};
+    }
+    allocation = MemoryAllocation{};
+}
+
+void DeviceMemoryAllocator::printStats(std::ostream &os) const
+{
+    os << "Device memory: " << statistics.allocations << " allocations backed by " << statistics.deviceAllocations
+       << " device allocations (" << statistics.blocks << " blocks, " << statistics.dedicated
+       << " dedicated, limit " << limits.maxMemoryAllocationCount << "), " << (statistics.bytesUsed >> 10) << " of "
+       << (statistics.bytesReserved >> 10) << " KiB used" << std::endl;
+}
@@ -0,0 +1,139 @@
+#ifndef DEVICEMEMORYALLOCATOR_H
+#define DEVICEMEMORYALLOCATOR_H
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <set>
+#include <vector>
+
+// Every vkAllocateMemory call counts against maxMemoryAllocationCount (4096 on many drivers) and is slow, so buffers
+// and images are carved out of large blocks instead. Blocks are kept per memory type and per strategy:
+//   Linear - bump allocation that rewinds once every allocation in the block is gone; meant for short-lived staging
+//            buffers that are freed right after their upload.
+//   Buddy  - power-of-two buddy allocation for resources that live for the whole run and are freed in any order.
+// Allocations that would take more than half a block, and memory exported to CUDA (the handle covers the whole
+// VkDeviceMemory), get a dedicated vkAllocateMemory. Not thread-safe; all allocations happen on the render thread.
+
+// Source of the device memory the allocator splits up. VulkanMemoryBackend forwards to the device; anything else
+// (e.g. a fake handing out host memory) can stand in for it to exercise the allocator without a GPU.
+class DeviceMemoryBackend
+{
+public:
+    virtual ~DeviceMemoryBackend() = default;
+    virtual VkResult allocate(const VkMemoryAllocateInfo &allocateInfo, VkDeviceMemory &memory) = 0;
+    virtual void free(VkDeviceMemory memory) = 0;
+    // Maps the whole allocation; blocks stay mapped until they are freed.
+    virtual VkResult map(VkDeviceMemory memory, void **data) = 0;
+};
+
+class VulkanMemoryBackend : public DeviceMemoryBackend
+{
+public:
+    explicit VulkanMemoryBackend(VkDevice device) : device(device) {}
+    VkResult allocate(const VkMemoryAllocateInfo &allocateInfo, VkDeviceMemory &memory) override;
+    void free(VkDeviceMemory memory) override;
+    VkResult map(VkDeviceMemory memory, void **data) override;
+
+private:
+    VkDevice device;
+};
+
+struct MemoryAllocation
+{
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;    // Size reserved for the allocation, at least the requested size
+    void *mapped = nullptr;   // Host address of offset, for host-visible memory types
+    uint32_t memoryTypeIndex = 0;
+    int32_t block = -1;       // Index into the pool's blocks, -1 for a dedicated allocation
+    uint8_t strategy = 0;
+
+    explicit operator bool() const { return memory != VK_NULL_HANDLE; }
+};
+
+class DeviceMemoryAllocator
+{
+public:
+    enum class Strategy : uint8_t
+    {
+        Linear,
+        Buddy
+    };
+
+    struct Limits
+    {
+        uint32_t maxMemoryAllocationCount = 4096;
+        VkDeviceSize bufferImageGranularity = 1;
+        VkDeviceSize nonCoherentAtomSize = 1;
+    };
+
+    struct Stats
+    {
+        uint32_t deviceAllocations = 0; // Live vkAllocateMemory allocations: blocks plus dedicated ones
+        uint32_t blocks = 0;
+        uint32_t dedicated = 0;
+        uint64_t allocations = 0;       // Live allocations handed out
+        VkDeviceSize bytesReserved = 0; // Device memory held, including unused block space
+        VkDeviceSize bytesUsed = 0;
+    };
+
+    static constexpr VkDeviceSize kDefaultBlockSize = VkDeviceSize(64) << 20;
+
+    DeviceMemoryAllocator(DeviceMemoryBackend &backend, const VkPhysicalDeviceMemoryProperties &memoryProperties,
+                          const Limits &limits, VkDeviceSize blockSize = kDefaultBlockSize);
+    ~DeviceMemoryAllocator();
+    DeviceMemoryAllocator(const DeviceMemoryAllocator &) = delete;
+    DeviceMemoryAllocator &operator=(const DeviceMemoryAllocator &) = delete;
+
+    // Throws std::runtime_error when the device is out of memory or out of allocations.
+    MemoryAllocation allocate(const VkMemoryRequirements &requirements, uint32_t memoryTypeIndex, Strategy strategy = Strategy::Buddy);
+    // pNext is chained into the VkMemoryAllocateInfo, e.g. a VkExportMemoryAllocateInfo.
+    MemoryAllocation allocateDedicated(const VkMemoryRequirements &requirements, uint32_t memoryTypeIndex, const void *pNext = nullptr);
+    // Resets the allocation. Freeing an empty allocation is a no-op.
+    void free(MemoryAllocation &allocation);
+
+    Stats stats() const { return statistics; }
+    void printStats(std::ostream &os) const;
+    // Block size used for a memory type: the default, shrunk for heaps smaller than eight blocks.
+    VkDeviceSize blockSizeFor(uint32_t memoryTypeIndex) const;
+
+private:
+    struct Block
+    {
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkDeviceSize size = 0;
+        void *mapped = nullptr;
+        uint32_t live = 0;
+        // Linear
+        VkDeviceSize head = 0;
+        // Buddy: free offsets per order (order 0 is kMinBuddySize bytes) and the order of each allocated offset
+        std::vector<std::set<VkDeviceSize>> freeLists;
+        std::map<VkDeviceSize, uint32_t> allocatedOrders;
+    };
+
+    struct Pool
+    {
+        std::vector<Block> blocks; // Freed blocks keep their slot with a null memory handle
+    };
+
+    static constexpr VkDeviceSize kMinBuddySize = 256;
+
+    Pool &pool(uint32_t memoryTypeIndex, Strategy strategy) { return pools[memoryTypeIndex * 2 + static_cast<uint32_t>(strategy)]; }
+    VkDeviceMemory allocateDeviceMemory(VkDeviceSize size, uint32_t memoryTypeIndex, const void *pNext, void **mapped);
+    void freeDeviceMemory(VkDeviceMemory memory);
+    bool allocateFromBlock(Block &block, Strategy strategy, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize &offset, VkDeviceSize &reserved);
+    void freeFromBlock(Block &block, Strategy strategy, VkDeviceSize offset);
+    uint32_t buddyOrder(VkDeviceSize size) const;
+    bool isHostVisible(uint32_t memoryTypeIndex) const;
+
+    DeviceMemoryBackend &backend;
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    Limits limits;
+    VkDeviceSize blockSize;
+    std::vector<Pool> pools;
+    Stats statistics;
+};
+
+#endif // DEVICEMEMORYALLOCATOR_H
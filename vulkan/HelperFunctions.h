@@ -3,6 +3,7 @@
 
 #include <random>
 #include "Context.h"
+#include "DeviceMemoryAllocator.h"
 #include "Initializers.h"
 static VkCommandBuffer beginSingleTimeCommands(const VulkanData &vulkanData)
 {
@@ -76,11 +77,11 @@ static uint32_t findMemoryType(const VkPhysicalDevice &physicalDevice, uint32_t
 
     throw std::runtime_error("failed to find suitable memory type!");
 }
-static void transitionImageLayout(const VulkanData &vulkanData, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, VkPipelineStageFlags srcStageMask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VkPipelineStageFlags dstStageMask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT)
+// Records the layout transition into commandBuffer; the overload below submits it on its own and waits.
+static void transitionImageLayout(VkCommandBuffer commandBuffer, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, VkPipelineStageFlags srcStageMask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VkPipelineStageFlags dstStageMask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT)
 {
     // One of the most common ways to perform layout transitions is using an image memory barrier.
     // A pipeline barrier like that is generally used to synchronize access to resources, like ensuring that a write to a buffer completes before reading from it, but it can also be used to transition image layouts and transfer queue family ownership when VK_SHARING_MODE_EXCLUSIVE is used
-    VkCommandBuffer commandBuffer = beginSingleTimeCommands(vulkanData);
     // Create an image barrier object
     VkImageMemoryBarrier imageMemoryBarrier{};
     imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -199,11 +200,18 @@ static void transitionImageLayout(const VulkanData &vulkanData, VkImage image, V
         0, nullptr,
         0, nullptr,
         1, &imageMemoryBarrier);
+}
 
+static void transitionImageLayout(const VulkanData &vulkanData, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, VkPipelineStageFlags srcStageMask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VkPipelineStageFlags dstStageMask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT)
+{
+    VkCommandBuffer commandBuffer = beginSingleTimeCommands(vulkanData);
+    transitionImageLayout(commandBuffer, image, oldLayout, newLayout, srcStageMask, dstStageMask);
     endSingleTimeCommands(vulkanData, commandBuffer);
 }
 
-static void generateMipmaps(const VulkanData &vulkanData, VkImage image, VkFormat imageFormat, int32_t texWidth, int32_t texHeight, uint32_t mipLevels)
+// Records the mip chain blits into commandBuffer. Level 0 has to be in TRANSFER_DST_OPTIMAL; every level ends up in
+// SHADER_READ_ONLY_OPTIMAL.
+static void generateMipmaps(const VulkanData &vulkanData, VkCommandBuffer commandBuffer, VkImage image, VkFormat imageFormat, int32_t texWidth, int32_t texHeight, uint32_t mipLevels)
 {
     VkFormatProperties formatProperties;
     vkGetPhysicalDeviceFormatProperties(vulkanData.physicalDevice, imageFormat, &formatProperties);
@@ -213,8 +221,6 @@ static void generateMipmaps(const VulkanData &vulkanData, VkImage image, VkForma
         throw std::runtime_error("texture image format does not support linear blitting!");
     }
 
-    VkCommandBuffer commandBuffer = beginSingleTimeCommands(vulkanData);
-
     VkImageMemoryBarrier barrier = {};
     barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
     barrier.image = image;
@@ -308,7 +314,12 @@ static void generateMipmaps(const VulkanData &vulkanData, VkImage image, VkForma
                          nullptr,
                          1,
                          &barrier);
+}
 
+static void generateMipmaps(const VulkanData &vulkanData, VkImage image, VkFormat imageFormat, int32_t texWidth, int32_t texHeight, uint32_t mipLevels)
+{
+    VkCommandBuffer commandBuffer = beginSingleTimeCommands(vulkanData);
+    generateMipmaps(vulkanData, commandBuffer, image, imageFormat, texWidth, texHeight, mipLevels);
     endSingleTimeCommands(vulkanData, commandBuffer);
 }
 static VkImage createImage(const VulkanData &vulkanData, VkImageCreateInfo& imageInfo, VkMemoryPropertyFlags properties, VkDeviceMemory &imageMemory, bool externalMemory = false)
@@ -355,6 +366,41 @@ static VkImage createImage(const VulkanData &vulkanData, VkImageCreateInfo& imag
     return tempImage;
 }
 
+// As above, with the memory taken from vulkanData.allocator. Exported memory gets a dedicated allocation because the
+// handle CUDA imports always covers a whole VkDeviceMemory.
+static VkImage createImage(const VulkanData &vulkanData, VkImageCreateInfo &imageInfo, VkMemoryPropertyFlags properties, MemoryAllocation &allocation, bool externalMemory = false)
+{
+    VkImage tempImage;
+
+    VkExportMemoryAllocateInfoKHR vulkanExportMemoryAllocateInfoKHR = {};
+    vulkanExportMemoryAllocateInfoKHR.sType = VK_STRUCTURE_TYPE_EXPORT_MEMORY_ALLOCATE_INFO_KHR;
+    vulkanExportMemoryAllocateInfoKHR.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT_KHR;
+
+    VkExternalMemoryImageCreateInfo vkExternalMemImageCreateInfo = {};
+    vkExternalMemImageCreateInfo.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_IMAGE_CREATE_INFO;
+    vkExternalMemImageCreateInfo.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT_KHR;
+
+    if (externalMemory)
+    {
+        imageInfo.pNext = &vkExternalMemImageCreateInfo;
+    }
+
+    if (vkCreateImage(vulkanData.device, &imageInfo, nullptr, &tempImage) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create image!");
+    }
+
+    VkMemoryRequirements memRequirements;
+    vkGetImageMemoryRequirements(vulkanData.device, tempImage, &memRequirements);
+    const uint32_t memoryTypeIndex = findMemoryType(vulkanData.physicalDevice, memRequirements.memoryTypeBits, properties);
+    allocation = externalMemory ? vulkanData.allocator->allocateDedicated(memRequirements, memoryTypeIndex, &vulkanExportMemoryAllocateInfoKHR)
+                                : vulkanData.allocator->allocate(memRequirements, memoryTypeIndex);
+
+    vkBindImageMemory(vulkanData.device, tempImage, allocation.memory, allocation.offset);
+
+    return tempImage;
+}
+
 static void copyBufferToImage(const VulkanData &vulkanData, VkImage &image, VkBuffer buffer, std::vector<VkBufferImageCopy> bufferCopyRegions)
 {
     // Just like with buffer copies, you need to specify which part of the buffer is going to be copied to which part of the image
@@ -405,12 +451,10 @@ static VkBool32 formatIsFilterable(VkPhysicalDevice physicalDevice, VkFormat for
 
     return false;
 }
-static void copyBufferToImage(const VulkanData &vulkanData, VkBuffer buffer, VkImage image, uint32_t width, uint32_t height)
+static void copyBufferToImage(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize bufferOffset, VkImage image, uint32_t width, uint32_t height)
 {
-    VkCommandBuffer commandBuffer = beginSingleTimeCommands(vulkanData);
-
     VkBufferImageCopy region = {};
-    region.bufferOffset = 0;
+    region.bufferOffset = bufferOffset;
     region.bufferRowLength = 0;
     region.bufferImageHeight = 0;
     region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -421,7 +465,11 @@ static void copyBufferToImage(const VulkanData &vulkanData, VkBuffer buffer, VkI
     region.imageExtent = {width, height, 1};
 
     vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-
+}
+static void copyBufferToImage(const VulkanData &vulkanData, VkBuffer buffer, VkImage image, uint32_t width, uint32_t height)
+{
+    VkCommandBuffer commandBuffer = beginSingleTimeCommands(vulkanData);
+    copyBufferToImage(commandBuffer, buffer, 0, image, width, height);
     endSingleTimeCommands(vulkanData, commandBuffer);
 }
 static VkSampler createSampler(const VulkanData &vulkanData, uint32_t mipLevel, VkFilter filterType, SamplerModes samplerModes, VkBorderColor borderColor, VkCompareOp compareOp)
@@ -468,6 +516,38 @@ static VkSampler createSampler(const VulkanData &vulkanData, uint32_t mipLevel,
 
     return sampler;
 }
+// Descriptor set layout of bindings, one of which (textureBinding) is an array of every digit texture. On devices with
+// update-after-bind textures that binding is flagged so the array counts against the descriptor indexing limits, and
+// sets of the layout come from a pool created with textureArrayPoolFlags().
+static VkDescriptorSetLayout createTextureArraySetLayout(const VulkanData &vulkanData, const std::vector<VkDescriptorSetLayoutBinding> &bindings,
+                                                         uint32_t textureBinding)
+{
+    VkDescriptorSetLayoutCreateInfo layoutInfo = initializers::descriptorSetLayoutCreateInfo(bindings);
+    std::vector<VkDescriptorBindingFlags> bindingFlags(bindings.size(), 0);
+    VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo{};
+    bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+    if (vulkanData.updateAfterBindTextures)
+    {
+        for (size_t i = 0; i < bindings.size(); ++i)
+        {
+            if (bindings[i].binding == textureBinding)
+            {
+                bindingFlags[i] = VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT;
+            }
+        }
+        bindingFlagsInfo.bindingCount = static_cast<uint32_t>(bindingFlags.size());
+        bindingFlagsInfo.pBindingFlags = bindingFlags.data();
+        layoutInfo.pNext = &bindingFlagsInfo;
+        layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+    }
+    VkDescriptorSetLayout layout;
+    VK_CHECK(vkCreateDescriptorSetLayout(vulkanData.device, &layoutInfo, nullptr, &layout));
+    return layout;
+}
+static VkDescriptorPoolCreateFlags textureArrayPoolFlags(const VulkanData &vulkanData)
+{
+    return vulkanData.updateAfterBindTextures ? VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT : 0;
+}
 static VkFormat findDepthFormat(const VkPhysicalDevice &physicalDevice)
 {
     // All of these candidate formats contain a depth component, but the latter two also contain a stencil component.
@@ -603,8 +683,22 @@ static QueueFamilyIndices findQueueFamilies(const VkPhysicalDevice &device, cons
         {
             indices.graphicsAndComputeFamily = i;
         }
-        // Check the physicaldevice that supports presentation queue
-        vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+        // A family that can copy but not draw is usually backed by the DMA engines; a transfer-only one beats async compute.
+        if ((queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT) && !(queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) &&
+            (!indices.transferFamily.has_value() || !(queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT)))
+        {
+            indices.transferFamily = i;
+        }
+        // Check the physicaldevice that supports presentation queue. Without a surface nothing is presented, and the
+        // graphics queue stands in for the present queue.
+        if (surface == VK_NULL_HANDLE)
+        {
+            presentSupport = indices.graphicsAndComputeFamily.has_value() && indices.graphicsAndComputeFamily.value() == i;
+        }
+        else
+        {
+            vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+        }
         if (presentSupport)
         {
             indices.presentFamily = i;
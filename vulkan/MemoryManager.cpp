@@ -31,6 +31,37 @@ void MemoryManager::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, Vk
     vkBindBufferMemory(vulkanData_.device, buffer, bufferMemory, 0);
 }
 
+void MemoryManager::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer &buffer, MemoryAllocation &allocation,
+                                 DeviceMemoryAllocator::Strategy strategy)
+{
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = usage;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    if (vkCreateBuffer(vulkanData_.device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create buffer!");
+    }
+
+    vkGetBufferMemoryRequirements(vulkanData_.device, buffer, &memRequirements);
+    const uint32_t memoryTypeIndex = findMemoryType(vulkanData_.physicalDevice, memRequirements.memoryTypeBits, properties);
+    allocation = vulkanData_.allocator->allocate(memRequirements, memoryTypeIndex, strategy);
+    // The buffer shares its VkDeviceMemory with others, so it is bound at the offset of its own range.
+    vkBindBufferMemory(vulkanData_.device, buffer, allocation.memory, allocation.offset);
+}
+
+void MemoryManager::destroyBuffer(VkBuffer &buffer, MemoryAllocation &allocation)
+{
+    if (buffer != VK_NULL_HANDLE) {
+        vkDestroyBuffer(vulkanData_.device, buffer, nullptr);
+        buffer = VK_NULL_HANDLE;
+    }
+    if (allocation) {
+        vulkanData_.allocator->free(allocation);
+    }
+}
+
 
 
 void MemoryManager::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size)
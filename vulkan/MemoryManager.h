@@ -8,6 +8,10 @@ class MemoryManager
 protected:
     MemoryManager() = default;
     void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer &buffer, VkDeviceMemory &bufferMemory);
+    // Sub-allocated from vulkanData_.allocator. Linear suits staging buffers that are destroyed right after the copy.
+    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer &buffer, MemoryAllocation &allocation,
+                      DeviceMemoryAllocator::Strategy strategy = DeviceMemoryAllocator::Strategy::Buddy);
+    void destroyBuffer(VkBuffer &buffer, MemoryAllocation &allocation);
     void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
 
     VulkanData vulkanData_;
@@ -0,0 +1,163 @@
+#include "PipelineCache.h"
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+namespace
+{
+constexpr char kPipelineCacheMagic[8] = {'M', 'N', 'I', 'S', 'T', 'P', 'S', 'O'};
+}
+
+void PipelineCache::init(const VulkanData &vulkanData, const std::string &cacheFileName)
+{
+    device = vulkanData.device;
+    fileName = cacheFileName;
+    vkGetPhysicalDeviceProperties(vulkanData.physicalDevice, &properties);
+    if (vulkanData.vkDeviceUUID != nullptr)
+    {
+        std::memcpy(deviceUUID, vulkanData.vkDeviceUUID, VK_UUID_SIZE);
+    }
+
+    std::vector<char> initialData = load();
+    warm = !initialData.empty();
+    storedSize = initialData.size();
+
+    VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {};
+    pipelineCacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    pipelineCacheCreateInfo.initialDataSize = initialData.size();
+    pipelineCacheCreateInfo.pInitialData = initialData.empty() ? nullptr : initialData.data();
+    VK_CHECK(vkCreatePipelineCache(device, &pipelineCacheCreateInfo, nullptr, &cache));
+}
+
+PipelineCache::FileHeader PipelineCache::expectedHeader(uint64_t dataSize) const
+{
+    FileHeader header{};
+    std::memcpy(header.magic, kPipelineCacheMagic, sizeof(header.magic));
+    header.vendorID = properties.vendorID;
+    header.deviceID = properties.deviceID;
+    header.driverVersion = properties.driverVersion;
+    std::memcpy(header.deviceUUID, deviceUUID, VK_UUID_SIZE);
+    std::memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+    header.dataSize = dataSize;
+    return header;
+}
+
+std::vector<char> PipelineCache::load()
+{
+    if (fileName.empty())
+    {
+        return {};
+    }
+    std::ifstream file(fileName, std::ios::in | std::ios::binary | std::ios::ate);
+    if (!file)
+    {
+        std::cout << "No pipeline cache at " << fileName << std::endl;
+        return {};
+    }
+    const size_t fileSize = file.tellg();
+    file.seekg(0, std::ios::beg);
+
+    FileHeader header{};
+    if (fileSize < sizeof(header) || !file.read(reinterpret_cast<char *>(&header), sizeof(header)))
+    {
+        std::cerr << "Ignoring truncated pipeline cache " << fileName << std::endl;
+        return {};
+    }
+    // dataSize is compared separately so that a truncated file is reported as such.
+    FileHeader expected = expectedHeader(header.dataSize);
+    if (std::memcmp(&header, &expected, sizeof(header)) != 0)
+    {
+        std::cerr << "Ignoring pipeline cache " << fileName << " written by another device or driver" << std::endl;
+        return {};
+    }
+    if (fileSize - sizeof(header) != header.dataSize)
+    {
+        std::cerr << "Ignoring truncated pipeline cache " << fileName << std::endl;
+        return {};
+    }
+
+    std::vector<char> data(header.dataSize);
+    if (!file.read(data.data(), data.size()))
+    {
+        return {};
+    }
+    // The driver's own header leads the blob; check it too rather than relying on every driver to reject a mismatch.
+    VkPipelineCacheHeaderVersionOne driverHeader{};
+    if (data.size() < sizeof(driverHeader))
+    {
+        return {};
+    }
+    std::memcpy(&driverHeader, data.data(), sizeof(driverHeader));
+    if (driverHeader.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE || driverHeader.vendorID != properties.vendorID ||
+        driverHeader.deviceID != properties.deviceID ||
+        std::memcmp(driverHeader.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+    {
+        std::cerr << "Ignoring pipeline cache " << fileName << " with a mismatching driver header" << std::endl;
+        return {};
+    }
+    std::cout << "Loaded " << data.size() << " bytes of pipeline cache from " << fileName << std::endl;
+    return data;
+}
+
+bool PipelineCache::save()
+{
+    if (fileName.empty() || cache == VK_NULL_HANDLE)
+    {
+        return false;
+    }
+    size_t dataSize = 0;
+    VK_CHECK(vkGetPipelineCacheData(device, cache, &dataSize, nullptr));
+    std::vector<char> data(dataSize);
+    VK_CHECK(vkGetPipelineCacheData(device, cache, &dataSize, data.data()));
+    data.resize(dataSize);
+
+    try
+    {
+        std::filesystem::path path(fileName);
+        if (path.has_parent_path())
+        {
+            std::filesystem::create_directories(path.parent_path());
+        }
+        // Readers either see the previous file or the complete new one, never a partial write.
+        const std::string tmpFileName = fileName + ".tmp";
+        {
+            std::ofstream file(tmpFileName, std::ios::out | std::ios::binary | std::ios::trunc);
+            const FileHeader header = expectedHeader(data.size());
+            file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            file.write(data.data(), data.size());
+            if (!file.flush())
+            {
+                std::cerr << "Failed writing pipeline cache " << tmpFileName << std::endl;
+                std::remove(tmpFileName.c_str());
+                return false;
+            }
+        }
+        std::filesystem::rename(tmpFileName, fileName);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Exception while saving pipeline cache " << fileName << ": " << e.what() << std::endl;
+        return false;
+    }
+    std::cout << "Saved " << data.size() << " bytes of pipeline cache to " << fileName << std::endl;
+    storedSize = data.size();
+    return true;
+}
+
+bool PipelineCache::saveIfChanged()
+{
+    if (fileName.empty() || cache == VK_NULL_HANDLE)
+    {
+        return false;
+    }
+    size_t dataSize = 0;
+    VK_CHECK(vkGetPipelineCacheData(device, cache, &dataSize, nullptr));
+    return dataSize != storedSize && save();
+}
+
+void PipelineCache::cleanUp()
+{
+    vkDestroyPipelineCache(device, cache, nullptr);
+    cache = VK_NULL_HANDLE;
+}
@@ -0,0 +1,50 @@
+#ifndef PIPELINECACHE_H
+#define PIPELINECACHE_H
+
+#include "Context.h"
+#include <string>
+#include <vector>
+
+// VkPipelineCache that persists between runs. The file carries its own header naming the device and driver it was
+// written by, and is only fed back to the driver when all of them still match; anything else starts a cold cache.
+class PipelineCache
+{
+public:
+    PipelineCache() = default;
+    // An empty fileName keeps the cache in memory only.
+    void init(const VulkanData &vulkanData, const std::string &fileName);
+    // Writes the cache contents to a temporary file and renames it over the cache file.
+    bool save();
+    // Saves only when the driver's data has changed size since it was loaded or last saved, i.e. when pipelines the
+    // file did not hold have been compiled. Cheap enough to call after startup and again at shutdown.
+    bool saveIfChanged();
+    void cleanUp();
+    bool isWarm() const { return warm; }
+
+    VkPipelineCache cache{VK_NULL_HANDLE};
+
+private:
+    struct FileHeader
+    {
+        char magic[8];
+        uint32_t vendorID;
+        uint32_t deviceID;
+        uint32_t driverVersion;
+        uint8_t deviceUUID[VK_UUID_SIZE];
+        uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+        uint32_t reserved; // Keeps dataSize aligned without padding, so headers compare with memcmp
+        uint64_t dataSize;
+    };
+
+    FileHeader expectedHeader(uint64_t dataSize) const;
+    std::vector<char> load();
+
+    VkDevice device{VK_NULL_HANDLE};
+    VkPhysicalDeviceProperties properties{};
+    uint8_t deviceUUID[VK_UUID_SIZE]{};
+    std::string fileName;
+    bool warm = false;
+    size_t storedSize = 0; // Bytes of driver data in the file, as loaded or last saved
+};
+
+#endif // PIPELINECACHE_H
@@ -0,0 +1,176 @@
+#include "PreprocessPass.h"
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include "Buffer.h"
+#include "Shader.h"
+
+bool PreprocessPass::shaderAvailable()
+{
+    std::error_code error;
+    return std::filesystem::is_regular_file(kShaderFile, error);
+}
+
+void PreprocessPass::init(const VulkanData &vulkanData, VkPipelineCache pipelineCache, const std::vector<VkDescriptorImageInfo> &textures,
+                          VkBuffer outputBuffer, VkDeviceSize size)
+{
+    vulkanData_ = vulkanData;
+    outputSize = size;
+    output = outputBuffer;
+    if (output == VK_NULL_HANDLE)
+    {
+        createBuffer(outputSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                     ownOutput, ownOutputAllocation);
+        output = ownOutput;
+    }
+    createBuffer(VkDeviceSize(kMnistWorkSize) * kMnistWorkSize * sizeof(float), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, workBuffer, workAllocation);
+
+    createDescriptors(textures);
+    createPipeline(pipelineCache, static_cast<uint32_t>(textures.size()));
+}
+
+void PreprocessPass::createDescriptors(const std::vector<VkDescriptorImageInfo> &textures)
+{
+    const uint32_t textureCount = static_cast<uint32_t>(textures.size());
+    std::vector<VkDescriptorPoolSize> poolSizes = {
+        initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, textureCount),
+        initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2)};
+    VkDescriptorPoolCreateInfo poolInfo = initializers::descriptorPoolCreateInfo(poolSizes, 1);
+    poolInfo.flags = textureArrayPoolFlags(vulkanData_);
+    VK_CHECK(vkCreateDescriptorPool(vulkanData_.device, &poolInfo, nullptr, &descriptorPool));
+
+    std::vector<VkDescriptorSetLayoutBinding> bindings = {
+        initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 0, textureCount),
+        initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 1),
+        initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 2)};
+    descriptorSetLayout = createTextureArraySetLayout(vulkanData_, bindings, 0);
+
+    VkDescriptorSetAllocateInfo allocInfo = initializers::descriptorSetAllocateInfo(descriptorPool, &descriptorSetLayout, 1);
+    VK_CHECK(vkAllocateDescriptorSets(vulkanData_.device, &allocInfo, &descriptorSet));
+
+    std::vector<VkDescriptorImageInfo> imageInfos = textures;
+    VkDescriptorBufferInfo workInfo{workBuffer, 0, VK_WHOLE_SIZE};
+    VkDescriptorBufferInfo outputInfo{output, 0, outputSize};
+    std::vector<VkWriteDescriptorSet> writes = {
+        initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 0, imageInfos.data(), textureCount),
+        initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, &workInfo),
+        initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2, &outputInfo)};
+    vkUpdateDescriptorSets(vulkanData_.device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+}
+
+void PreprocessPass::createPipeline(VkPipelineCache pipelineCache, uint32_t textureCount)
+{
+    VkPushConstantRange pushConstantRange = initializers::pushConstantRange(VK_SHADER_STAGE_COMPUTE_BIT, sizeof(PushConstants), 0);
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = initializers::pipelineLayoutCreateInfo(&descriptorSetLayout, 1);
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+    VK_CHECK(vkCreatePipelineLayout(vulkanData_.device, &pipelineLayoutInfo, nullptr, &pipelineLayout));
+
+    Shader computeShader;
+    VkComputePipelineCreateInfo pipelineInfo = initializers::computePipelineCreateInfo(pipelineLayout);
+    pipelineInfo.stage = computeShader.createShaderModule(kShaderFile, VK_SHADER_STAGE_COMPUTE_BIT, vulkanData_.device);
+    // Same texture array size as the fragment shader (constant_id 0).
+    VkSpecializationMapEntry textureCountEntry = initializers::specializationMapEntry(0, 0, sizeof(uint32_t));
+    VkSpecializationInfo specialization = initializers::specializationInfo(1, &textureCountEntry, sizeof(uint32_t), &textureCount);
+    pipelineInfo.stage.pSpecializationInfo = &specialization;
+    VK_CHECK(vkCreateComputePipelines(vulkanData_.device, pipelineCache, 1, &pipelineInfo, nullptr, &pipeline));
+    computeShader.cleanUp(vulkanData_.device);
+}
+
+void PreprocessPass::dispatchStage(VkCommandBuffer commandBuffer, PushConstants &constants, uint32_t stage, uint32_t groups)
+{
+    // Earlier dispatches on the queue, this frame's first stage or the previous frame's pass, may still use the work
+    // image, and stage 1 reads what stage 0 wrote.
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    constants.stage = stage;
+    vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &constants);
+    vkCmdDispatch(commandBuffer, groups, groups, 1);
+}
+
+void PreprocessPass::record(VkCommandBuffer commandBuffer, uint32_t textureIndex, uint32_t outputOffset)
+{
+    PushConstants constants{};
+    constants.textureIndex = textureIndex;
+    constants.outputOffset = outputOffset;
+    constants.flags = (config.enabled ? kFlagFit : 0) | (config.invert ? kFlagInvert : 0) | (config.normalize ? kFlagNormalize : 0);
+    constants.threshold = config.threshold;
+    constants.mean = config.mean;
+    constants.stddev = config.stddev;
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+    // One workgroup per output pixel of the downsample, then a single workgroup for the fit on the work image.
+    dispatchStage(commandBuffer, constants, 0, config.enabled ? kMnistWorkSize : kMnistSize);
+    if (config.enabled)
+    {
+        dispatchStage(commandBuffer, constants, 1, 1);
+    }
+}
+
+float PreprocessPass::checkParity(uint32_t textureIndex, const unsigned char *rgba, uint32_t width, uint32_t height)
+{
+    constexpr VkDeviceSize sampleBytes = kMnistSize * kMnistSize * sizeof(float);
+    Buffer readback;
+    readback.create(vulkanData_, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                    sampleBytes);
+
+    VkCommandBuffer commandBuffer = beginSingleTimeCommands(vulkanData_);
+    record(commandBuffer, textureIndex, 0);
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+    VkBufferCopy copyRegion{0, 0, sampleBytes};
+    vkCmdCopyBuffer(commandBuffer, output, readback.buffer, 1, &copyRegion);
+    endSingleTimeCommands(vulkanData_, commandBuffer);
+
+    std::vector<float> work(size_t(kMnistWorkSize) * kMnistWorkSize);
+    std::vector<float> reference(kMnistSize * kMnistSize);
+    mnistPreprocessHost(rgba, int(width), int(height), config, work.data(), reference.data());
+
+    VK_CHECK(readback.map());
+    const float *result = static_cast<const float *>(readback.mapped);
+    float maxError = 0.0f;
+    for (size_t i = 0; i < reference.size(); ++i)
+    {
+        maxError = std::max(maxError, std::fabs(result[i] - reference[i]));
+    }
+    readback.cleanUp();
+    return maxError;
+}
+
+void PreprocessPass::cleanUp()
+{
+    if (pipeline != VK_NULL_HANDLE)
+    {
+        vkDestroyPipeline(vulkanData_.device, pipeline, nullptr);
+        pipeline = VK_NULL_HANDLE;
+    }
+    if (pipelineLayout != VK_NULL_HANDLE)
+    {
+        vkDestroyPipelineLayout(vulkanData_.device, pipelineLayout, nullptr);
+        pipelineLayout = VK_NULL_HANDLE;
+    }
+    if (descriptorSetLayout != VK_NULL_HANDLE)
+    {
+        vkDestroyDescriptorSetLayout(vulkanData_.device, descriptorSetLayout, nullptr);
+        descriptorSetLayout = VK_NULL_HANDLE;
+    }
+    if (descriptorPool != VK_NULL_HANDLE)
+    {
+        // Frees the descriptor set with it.
+        vkDestroyDescriptorPool(vulkanData_.device, descriptorPool, nullptr);
+        descriptorPool = VK_NULL_HANDLE;
+        descriptorSet = VK_NULL_HANDLE;
+    }
+    destroyBuffer(workBuffer, workAllocation);
+    destroyBuffer(ownOutput, ownOutputAllocation);
+    output = VK_NULL_HANDLE;
+}
@@ -0,0 +1,75 @@
+#ifndef PREPROCESSPASS_H
+#define PREPROCESSPASS_H
+
+#include <vector>
+#include "Context.h"
+#include "MemoryManager.h"
+#include "MnistPreprocess.h"
+
+// The texture-to-network-input preprocessing of VulkanImageCuda::updateCuda() as a compute pass (shaders/preprocess.comp)
+// recorded into the frame's command buffer. It samples the digit textures through the same descriptors the fragment
+// shader uses and writes 28x28 floats into a storage buffer, normally the input tensor CUDA imported, so a frame
+// reaches the network without a CUDA kernel. Without an output buffer the pass writes into one of its own, which is
+// enough to check it against the CPU reference on devices without CUDA.
+class PreprocessPass : public MemoryManager
+{
+public:
+    static constexpr const char *kShaderFile = "shaders/preprocess.comp.spv";
+    // The SPIR-V is compiled with the other shaders by the build (or shaders/compile.sh); without it the CUDA kernels
+    // stay in charge.
+    static bool shaderAvailable();
+
+    PreprocessPass() = default;
+    PreprocessPass(const PreprocessPass &) = delete;
+    PreprocessPass &operator=(const PreprocessPass &) = delete;
+
+    // textures are the digit textures' descriptors, in the order record() indexes them.
+    void init(const VulkanData &vulkanData, VkPipelineCache pipelineCache, const std::vector<VkDescriptorImageInfo> &textures,
+              VkBuffer output, VkDeviceSize outputSize);
+    void cleanUp();
+    bool isReady() const { return pipeline != VK_NULL_HANDLE; }
+
+    // Preprocesses texture textureIndex into the 28x28 floats at outputOffset (in floats) of the output buffer. Recorded
+    // outside a render pass; the caller orders the output against its readers, e.g. with the frame's semaphores.
+    void record(VkCommandBuffer commandBuffer, uint32_t textureIndex, uint32_t outputOffset);
+
+    // Runs the pass on texture textureIndex, reads the result back and \returns its largest absolute deviation from
+    // mnistPreprocessHost() on rgba, the texture's pixels. Blocks on the graphics queue.
+    float checkParity(uint32_t textureIndex, const unsigned char *rgba, uint32_t width, uint32_t height);
+
+    // Read by every record(); the renderer copies the CUDA kernels' settings in, so both paths give the same input.
+    MnistPreprocessConfig config;
+
+private:
+    // Matches the push constant block of preprocess.comp.
+    struct PushConstants
+    {
+        uint32_t textureIndex;
+        uint32_t stage; // 0: area downsample, 1: bounding box, fit and centre
+        uint32_t outputOffset;
+        uint32_t flags;
+        float threshold;
+        float mean;
+        float stddev;
+    };
+    static constexpr uint32_t kFlagFit = 1, kFlagInvert = 2, kFlagNormalize = 4;
+
+    void createDescriptors(const std::vector<VkDescriptorImageInfo> &textures);
+    void createPipeline(VkPipelineCache pipelineCache, uint32_t textureCount);
+    void dispatchStage(VkCommandBuffer commandBuffer, PushConstants &constants, uint32_t stage, uint32_t groups);
+
+    VkBuffer workBuffer = VK_NULL_HANDLE; // kMnistWorkSize^2 grayscale image between the two stages
+    MemoryAllocation workAllocation;
+    VkBuffer output = VK_NULL_HANDLE;
+    VkBuffer ownOutput = VK_NULL_HANDLE; // Only when init() got no output buffer
+    MemoryAllocation ownOutputAllocation;
+    VkDeviceSize outputSize = 0;
+
+    VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+    VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+    VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+    VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+};
+
+#endif // PREPROCESSPASS_H
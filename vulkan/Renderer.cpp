@@ -1,9 +1,26 @@
 #include "Renderer.h"
 #include <fstream>
 #include "stb_image_write.h"
+#include <algorithm>
 #include <chrono>
-#include <thread>
+#include <cfloat>
+#include <csignal>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include "Options.h"
+
+namespace
+{
+volatile std::sig_atomic_t headlessInterrupted = 0;
+void onHeadlessInterrupt(int)
+{
+    headlessInterrupted = 1;
+}
+} // namespace
+
 Renderer::Renderer(GLFWwindow &window)
+    : framePacer(FramePacer::parseMode(Options::settings().pacing), Options::settings().targetFps)
 {
     window_ = &window;
     context.window = window_;
@@ -11,6 +28,15 @@ Renderer::Renderer(GLFWwindow &window)
     Renderer::prepare();
 }
 
+Renderer::Renderer(VkExtent2D offscreenSize)
+    : framePacer(FramePacer::parseMode(Options::settings().pacing), Options::settings().targetFps)
+{
+    headless = true;
+    offscreenExtent = offscreenSize;
+
+    Renderer::prepare();
+}
+
 Renderer::~Renderer()
 {
     vkDeviceWaitIdle(logicalDevice_);
@@ -18,9 +44,16 @@ Renderer::~Renderer()
     vkDestroyDescriptorPool(logicalDevice_, descriptorPool, nullptr);
     vkDestroyPipelineLayout(logicalDevice_, graphics.pipelineLayout, nullptr);
     vkDestroyDescriptorSetLayout(logicalDevice_, graphics.descriptorSetLayout, nullptr);
-    graphics.sceneDataUniformBuffer.cleanUp();
+    for (auto &uniformBuffer : graphics.sceneDataUniformBuffers)
+    {
+        uniformBuffer.cleanUp();
+    }
+#ifdef ENABLE_BENCHMARKS
+    frameTimes.print(std::cout, histogramSerialized ? "Frame times (serialized)" : "Frame times (pipelined)");
+#endif
     graphics.vertexBuffer.cleanUp();
     graphics.indexBuffer.cleanUp();
+    preprocessPass.cleanUp();
 }
 
 void Renderer::render()
@@ -28,37 +61,75 @@ void Renderer::render()
     auto tStart = std::chrono::high_resolution_clock::now();
     if (!prepared)
         return;
-    updateUniformBuffers();
+    if (histogramSerialized != Options::settings().serializeFrames)
+    {
+        histogramSerialized = Options::settings().serializeFrames;
+        frameTimes.reset();
+    }
+    else if (lastFrameStart.time_since_epoch().count() != 0)
+    {
+        frameTimes.record(std::chrono::duration<double, std::milli>(tStart - lastFrameStart).count());
+    }
+    lastFrameStart = tStart;
 
     size_t currentFrameIdx = currentFrame % MAX_FRAMES_IN_FLIGHT;
     uint32_t imageIndex;
-    Core::prepareFrame(imageIndex, currentFrameIdx);
+    if (!Core::prepareFrame(imageIndex, currentFrameIdx))
+        return;
+
+    // Past the fence wait nothing indexed by currentFrameIdx is in use by the GPU any more, while the other frames
+    // may still be executing.
+    updateUniformBuffers(currentFrameIdx);
+    streamInput();
+    mUserInterface.update(static_cast<uint32_t>(currentFrameIdx));
+    recordCommandBuffer(commandBuffers[currentFrameIdx], imageIndex, currentFrameIdx);
+
     std::vector<VkSemaphore> waitSemaphores;
     std::vector<VkPipelineStageFlags> waitStages;
+    std::vector<uint64_t> waitValues;
 
-    waitSemaphores.push_back(imageAvailableSemaphores[currentFrameIdx]);
-    waitStages.push_back(VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
-    if (currentFrame != 0)
+    // Nothing acquires or presents offscreen images, so headless frames neither wait for nor signal the swap chain.
+    if (!headless)
     {
-        cudaManager->getWaitFrameSemaphores(waitSemaphores, waitStages);
+        waitSemaphores.push_back(imageAvailableSemaphores[currentFrameIdx]);
+        waitStages.push_back(VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+        waitValues.push_back(0);
     }
+    cudaManager->getWaitFrameSemaphores(waitSemaphores, waitStages, waitValues);
     VkSubmitInfo submitInfo{};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
     submitInfo.waitSemaphoreCount = (uint32_t)waitSemaphores.size();
     submitInfo.pWaitSemaphores = waitSemaphores.data();
     submitInfo.pWaitDstStageMask = waitStages.data();
     submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffers[imageIndex];
+    submitInfo.pCommandBuffers = &commandBuffers[currentFrameIdx];
     std::vector<VkSemaphore> signalSemaphores;
-    signalSemaphores.push_back(renderFinishedSemaphores[currentFrameIdx]);
-    cudaManager->getSignalFrameSemaphores(signalSemaphores);
+    std::vector<uint64_t> signalValues;
+    if (!headless)
+    {
+        signalSemaphores.push_back(renderFinishedSemaphores[currentFrameIdx]);
+        signalValues.push_back(0);
+    }
+    cudaManager->getSignalFrameSemaphores(signalSemaphores, signalValues);
     submitInfo.signalSemaphoreCount = (uint32_t)signalSemaphores.size();
     submitInfo.pSignalSemaphores = signalSemaphores.data();
 
+    // The swap chain semaphores stay binary; their entries in the value arrays are ignored.
+    VkTimelineSemaphoreSubmitInfo timelineInfo{};
+    if (cudaManager->usesTimelineSemaphores())
+    {
+        timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timelineInfo.waitSemaphoreValueCount = (uint32_t)waitValues.size();
+        timelineInfo.pWaitSemaphoreValues = waitValues.data();
+        timelineInfo.signalSemaphoreValueCount = (uint32_t)signalValues.size();
+        timelineInfo.pSignalSemaphoreValues = signalValues.data();
+        submitInfo.pNext = &timelineInfo;
+    }
+
     VK_CHECK(vkQueueSubmit(graphicQueue_, 1, &submitInfo, inFlightFences[currentFrameIdx]);)
     Core::submitFrame(imageIndex, currentFrameIdx);
     cudaManager->cudaUpdateVkImage(currentTextureIndex);
-    std::this_thread::sleep_for(std::chrono::microseconds(10000));
+    framePacer.wait();
 
     frameCounter++;
     auto tEnd = std::chrono::high_resolution_clock::now();
@@ -76,6 +147,13 @@ void Renderer::render()
         frameCounter = 0;
         lastTimestamp = tEnd;
     }
+    // Every frame, not only the ones that rebuild the UI below.
+    textureSwitchTimer += frameTimer;
+    if (!inputStream && textureSwitchTimer >= 1.0f) // Switch every second
+    {
+        textureSwitchTimer = 0.0f;
+        currentTextureIndex = (currentTextureIndex + 1) % TEXTURE_COUNT;
+    }
     mUserInterface.updateTimer -= frameTimer;
     if (mUserInterface.updateTimer >= 0.0f)
     {
@@ -92,32 +170,122 @@ void Renderer::render()
     ImGui::Begin("Control", nullptr, imguiWindowFlags);
     ImGui::Text("%.2f ms/frame (%.1d fps)", (1000.0f / lastFPS), lastFPS);
     ImGui::NewLine();
-    ImGui::Text("Detected Text: %d", cudaManager->getDetection());
+    ImGui::Text("Detected Text: %d (%s)", cudaManager->getDetection(), cudaManager->getInferenceEngineName());
+    ImGui::Text("Inference latency: %.2f ms (GPU %.2f ms)", cudaManager->getInferenceLatencyMs(), cudaManager->getInferenceGpuMs());
+    ImGui::Checkbox("CUDA graphs", &cudaManager->useCudaGraphs);
+    ImGui::Text("CUDA submit: %.3f ms eager, %.3f ms graph", cudaManager->getSubmitMs(false), cudaManager->getSubmitMs(true));
+    ImGui::Checkbox("Serialize frames", &Options::settings().serializeFrames);
+    ImGui::Text("Pacing: %s, jitter %.3f ms (worst %.3f ms)", FramePacer::modeName(framePacer.getMode()), framePacer.jitterMs(), framePacer.worstErrorMs());
+    ImGui::PlotHistogram("##frametimes", frameTimes.counts.data(), Benchmark::FrameTimeHistogram::kBuckets, 0, nullptr, 0.0f, FLT_MAX, ImVec2(0, 60));
+    ImGui::Text("Frame time p50 %.1f ms, p99 %.1f ms, max %.1f ms (0-%.0f ms)", frameTimes.percentileMs(0.5), frameTimes.percentileMs(0.99),
+                frameTimes.maxMs, Benchmark::FrameTimeHistogram::kBuckets * Benchmark::FrameTimeHistogram::kBucketMs);
+    const MemoryReport memory = memoryReport();
+    ImGui::Text("Memory: host %llu KiB, device %llu KiB, CUDA %llu KiB, resident %llu MiB", (unsigned long long)(memory.hostBytes >> 10),
+                (unsigned long long)(memory.deviceBytes >> 10), (unsigned long long)(memory.cudaBytes >> 10),
+                (unsigned long long)(memory.residentBytes >> 20));
+    if (inputStream)
+    {
+        const InputStream::Metrics input = inputStream->metrics();
+        ImGui::Text("Input %s: %.1f images/s, queue %zu/%zu (max %zu)", inputStream->name().c_str(), input.framesPerSecond, input.depth,
+                    input.capacity, input.maxDepth);
+        ImGui::Text("Input images: %llu received, %llu shown, %llu rejected", (unsigned long long)input.received,
+                    (unsigned long long)input.consumed, (unsigned long long)input.rejected);
+    }
     OnUpdateUIOverlay(&mUserInterface);
     ImGui::End();
     ImGui::Render();
+}
 
-    if (mUserInterface.update() || mUserInterface.updated)
+void Renderer::draw()
+{
+}
+
+bool Renderer::runHeadless(uint64_t frameLimit)
+{
+    headlessInterrupted = 0;
+    std::signal(SIGINT, onHeadlessInterrupt);
+    std::cout << "Headless run with " << cudaManager->getInferenceEngineName() << (cudaManager->usesHostPipeline() ? " on the host pipeline" : "")
+              << ", " << swapChain.extent.width << "x" << swapChain.extent.height << ", "
+              << (frameLimit ? std::to_string(frameLimit) + " frames" : std::string("until interrupted")) << std::endl;
+
+    const auto runStart = Benchmark::Clock::now();
+    auto reportStart = runStart;
+    uint64_t frames = 0, reportFrames = 0;
+    uint64_t reportInferences = cudaManager->getInferencesCompleted();
+    const size_t deviceAllocations = cudaManager->getDeviceAllocationCount();
+    while (!headlessInterrupted && (frameLimit == 0 || frames < frameLimit))
     {
-        buildCommandBuffers();
-        mUserInterface.updated = false;
+        // A run without a frame limit ends with a finite input (a file or stdin) once its last image has been shown.
+        if (frameLimit == 0 && inputStream && inputStream->metrics().finished)
+        {
+            break;
+        }
+        render();
+        ++frames;
+        ++reportFrames;
+
+        const double reportMs = Benchmark::elapsedMs(reportStart);
+        if (reportMs >= 1000.0)
+        {
+            const uint64_t inferences = cudaManager->getInferencesCompleted();
+            printf("[Headless] %.1f frames/s, %.1f inferences/s, detected %d\n", reportFrames * 1000.0 / reportMs,
+                   (inferences - reportInferences) * 1000.0 / reportMs, cudaManager->getDetection());
+            if (inputStream)
+            {
+                const InputStream::Metrics input = inputStream->metrics();
+                printf("[Headless] input %.1f images/s, queue %zu/%zu (max %zu), %llu received, %llu rejected\n", input.framesPerSecond,
+                       input.depth, input.capacity, input.maxDepth, (unsigned long long)input.received, (unsigned long long)input.rejected);
+            }
+            reportStart = Benchmark::Clock::now();
+            reportFrames = 0;
+            reportInferences = inferences;
+        }
     }
-    textureSwitchTimer += frameTimer;
-    if (textureSwitchTimer >= 1.0f) // Switch every second
+
+    cudaManager->finishInference();
+    VK_CHECK(vkDeviceWaitIdle(logicalDevice_));
+    const double seconds = Benchmark::elapsedMs(runStart) / 1000.0;
+    printf("[Headless] %llu frames in %.2f s: %.1f frames/s, %.1f inferences/s, last detection %d\n", (unsigned long long)frames,
+           seconds, frames / seconds, cudaManager->getInferencesSubmitted() / seconds, cudaManager->getDetection());
+    frameTimes.print(std::cout, "[Headless] Frame times");
+    memoryReport().print(std::cout, "[Headless] Memory");
+    if (inputStream)
     {
-        textureSwitchTimer = 0.0f;
-        currentTextureIndex = (currentTextureIndex + 1) % TEXTURE_COUNT;
+        const InputStream::Metrics input = inputStream->metrics();
+        printf("[Headless] input: %llu images shown in %.2f s (%.1f images/s), %llu rejected, queue max %zu of %zu\n",
+               (unsigned long long)input.consumed, seconds, input.consumed / seconds, (unsigned long long)input.rejected,
+               input.maxDepth, input.capacity);
+    }
+    std::signal(SIGINT, SIG_DFL);
 
-        buildCommandBuffers();
+    // Every CUDA buffer is allocated before the first frame; anything more is an allocation per frame.
+    const size_t finalDeviceAllocations = cudaManager->getDeviceAllocationCount();
+    if (finalDeviceAllocations != deviceAllocations)
+    {
+        printf("[Headless] Error: CUDA device allocations grew from %zu to %zu during the run\n", deviceAllocations,
+               finalDeviceAllocations);
+        return false;
     }
+    return true;
 }
 
-void Renderer::draw()
+void Renderer::cleanUp()
 {
 }
 
-void Renderer::cleanUp()
+MemoryReport Renderer::memoryReport() const
 {
+    MemoryReport report;
+    const DeviceMemoryAllocator::Stats device = memoryAllocator->stats();
+    report.deviceBytes = device.bytesUsed;
+    report.deviceReservedBytes = device.bytesReserved;
+    cudaManager->addMemoryUsage(report);
+    if (inputStream)
+    {
+        report.hostBytes += inputStream->hostBytes();
+    }
+    report.residentBytes = MemoryReport::residentSetBytes();
+    return report;
 }
 
 void Renderer::framebufferResizeCallback(GLFWwindow *window, int width, int height)
@@ -160,11 +328,25 @@ void Renderer::prepare()
     Core::init();
     generateQuad();
     cudaInitialize();
+    openInputStream();
     createCamera();
     createUniformBuffers();
     setupDescriptors();
+    auto tPipeline = Benchmark::Clock::now();
     createGraphicsPipeline();
-    buildCommandBuffers();
+    createPreprocessPass();
+    pipelineCreateMs += Benchmark::elapsedMs(tPipeline);
+    std::cout << "Pipeline creation: " << pipelineCreateMs << " ms with a " << (pipelineCache.isWarm() ? "warm" : "cold") << " pipeline cache" << std::endl;
+    // Every startup pipeline exists at this point. A warm cache that already held them all is left alone, one that
+    // missed some (a changed shader, a new pass) grows and is written back.
+    pipelineCache.saveIfChanged();
+    // Queue order puts the remaining uploads ahead of the parity check and the first frame, so there is nothing to wait
+    // for here. The check samples the textures, so it has to come after them.
+    stagingRing.submit();
+    std::cout << "Staging ring: " << stagingRing.uploads() << " uploads in " << stagingRing.submissions() << " submissions" << std::endl;
+    checkPreprocessParity();
+    memoryAllocator->printStats(std::cout);
+    memoryReport().print(std::cout, "Memory at startup");
     prepared = true;
     Core::windowResize();
 }
@@ -174,10 +356,10 @@ void Renderer::OnUpdateUIOverlay(UserInterface *userInterface)
    
 }
 
-void Renderer::buildCommandBuffers()
+void Renderer::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex, size_t currentFrameIdx)
 {
     VkCommandBufferBeginInfo cmdBufInfo = initializers::commandBufferBeginInfo();
-    cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+    cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
     VkClearValue clearValues[2];
     clearValues[0].color = {{0.025f, 0.025f, 0.025f, 1.0f}};
     clearValues[1].depthStencil = {1.0f, 0};
@@ -190,43 +372,49 @@ void Renderer::buildCommandBuffers()
     renderPassBeginInfo.renderArea.extent.height = swapChain.extent.height;
     renderPassBeginInfo.clearValueCount = 2;
     renderPassBeginInfo.pClearValues = clearValues;
+    renderPassBeginInfo.framebuffer = swapChain.framebuffers[imageIndex];
 
-    for (int32_t i = 0; i < commandBuffers.size(); ++i)
-    {
-
-        renderPassBeginInfo.framebuffer = swapChain.framebuffers[i];
+    VK_CHECK(vkBeginCommandBuffer(commandBuffer, &cmdBufInfo));
 
-        VK_CHECK(vkBeginCommandBuffer(commandBuffers[i], &cmdBufInfo));
+    // This frame's network input, written before the semaphore signal the frame's CUDA work waits for.
+    if (cudaManager->usesVulkanPreprocess())
+    {
+        preprocessPass.record(commandBuffer, currentTextureIndex, cudaManager->inputSlotOffset());
+    }
 
-        vkCmdBeginRenderPass(commandBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+    vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
-        VkViewport viewport = initializers::viewport((float)swapChain.extent.width, (float)swapChain.extent.height, 0.0f, 1.0f);
-        vkCmdSetViewport(commandBuffers[i], 0, 1, &viewport);
+    VkViewport viewport = initializers::viewport((float)swapChain.extent.width, (float)swapChain.extent.height, 0.0f, 1.0f);
+    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
 
-        VkRect2D scissor = initializers::rect2D(swapChain.extent.width, swapChain.extent.height, 0, 0);
-        vkCmdSetScissor(commandBuffers[i], 0, 1, &scissor);
+    VkRect2D scissor = initializers::rect2D(swapChain.extent.width, swapChain.extent.height, 0, 0);
+    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-        vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphics.pipelineLayout, 0, 1, &graphics.descriptorSets[currentTextureIndex], 0, NULL);
-        vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphics.pipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphics.pipelineLayout, 0, 1, &graphics.descriptorSets[currentFrameIdx], 0, NULL);
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphics.pipeline);
+    vkCmdPushConstants(commandBuffer, graphics.pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(uint32_t), &currentTextureIndex);
 
-        // cudaManager->fillRenderingCommandBuffer(commandBuffers[i]);
-        VkDeviceSize offsets[1] = {0};
-        vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, &graphics.vertexBuffer.buffer, offsets);
-        vkCmdBindIndexBuffer(commandBuffers[i], graphics.indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
-        vkCmdDrawIndexed(commandBuffers[i], graphics.indexCount, 1, 0, 0, 0);
+    // cudaManager->fillRenderingCommandBuffer(commandBuffer);
+    VkDeviceSize offsets[1] = {0};
+    vkCmdBindVertexBuffers(commandBuffer, 0, 1, &graphics.vertexBuffer.buffer, offsets);
+    vkCmdBindIndexBuffer(commandBuffer, graphics.indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+    vkCmdDrawIndexed(commandBuffer, graphics.indexCount, 1, 0, 0, 0);
 
-        drawUI(commandBuffers[i]);
+    drawUI(commandBuffer, currentFrameIdx);
 
-        vkCmdEndRenderPass(commandBuffers[i]);
+    vkCmdEndRenderPass(commandBuffer);
 
-        VK_CHECK(vkEndCommandBuffer(commandBuffers[i]));
-    }
+    VK_CHECK(vkEndCommandBuffer(commandBuffer));
 }
 
 void Renderer::createGraphicsPipeline()
 {
     // Layout
+    // The fragment shader reads the index of the digit texture to sample from a push constant.
+    VkPushConstantRange pushConstantRange = initializers::pushConstantRange(VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(uint32_t), 0);
     VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = initializers::pipelineLayoutCreateInfo(&graphics.descriptorSetLayout, 1);
+    pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
     VK_CHECK(vkCreatePipelineLayout(logicalDevice_, &pipelineLayoutCreateInfo, nullptr, &graphics.pipelineLayout));
 
     // Pipeline
@@ -244,6 +432,10 @@ void Renderer::createGraphicsPipeline()
     // Shaders
     shaderStages[0] = vertexShaders.createShaderModule("shaders/shader.vert.spv", VK_SHADER_STAGE_VERTEX_BIT, logicalDevice_);
     shaderStages[1] = fragmentShaders.createShaderModule("shaders/shader.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT, logicalDevice_);
+    // Sizes the fragment shader's texture array (constant_id 0) to match the descriptor binding.
+    VkSpecializationMapEntry textureCountEntry = initializers::specializationMapEntry(0, 0, sizeof(uint32_t));
+    VkSpecializationInfo fragmentSpecialization = initializers::specializationInfo(1, &textureCountEntry, sizeof(uint32_t), &TEXTURE_COUNT);
+    shaderStages[1].pSpecializationInfo = &fragmentSpecialization;
 
     // Vertex input state
     std::vector<VkVertexInputBindingDescription> vertexInputBindings = {
@@ -270,12 +462,69 @@ void Renderer::createGraphicsPipeline()
     pipelineCreateInfo.pDynamicState = &dynamicState;
     pipelineCreateInfo.stageCount = static_cast<uint32_t>(shaderStages.size());
     pipelineCreateInfo.pStages = shaderStages.data();
-    VK_CHECK(vkCreateGraphicsPipelines(logicalDevice_, pipelineCache, 1, &pipelineCreateInfo, nullptr, &graphics.pipeline));
+    VK_CHECK(vkCreateGraphicsPipelines(logicalDevice_, pipelineCache.cache, 1, &pipelineCreateInfo, nullptr, &graphics.pipeline));
 
     vertexShaders.cleanUp(logicalDevice_);
     fragmentShaders.cleanUp(logicalDevice_);
 }
 
+void Renderer::createPreprocessPass()
+{
+    // The host pipeline has no shared input tensor and preprocesses on the CPU, but the pass still gets built so it can
+    // be checked against the CPU reference on devices without CUDA.
+    const bool checkOnly = cudaManager->usesHostPipeline();
+    if (Options::settings().preprocess != "vulkan" || !(cudaManager->usesVulkanPreprocess() || checkOnly))
+    {
+        return;
+    }
+    if (!PreprocessPass::shaderAvailable())
+    {
+        std::cout << PreprocessPass::kShaderFile << " not found, no Vulkan preprocessing pass" << std::endl;
+        return;
+    }
+    std::vector<VkDescriptorImageInfo> textureDescriptors;
+    for (uint32_t i = 0; i < TEXTURE_COUNT; ++i)
+    {
+        textureDescriptors.push_back(cudaManager->textures[i].descriptor);
+    }
+    preprocessPass.init(context, pipelineCache.cache, textureDescriptors, checkOnly ? VK_NULL_HANDLE : cudaManager->inputTensorBuffer(),
+                        checkOnly ? kMnistSize * kMnistSize * sizeof(float) : cudaManager->inputTensorSize());
+    preprocessPass.config = cudaManager->preprocessConfig();
+}
+
+void Renderer::checkPreprocessParity()
+{
+    if (!preprocessPass.isReady())
+    {
+        return;
+    }
+    // Same tolerance as the CUDA kernels' check: the reductions sum in another order than the CPU.
+    constexpr float kParityTolerance = 1e-3f;
+    float maxError = 0.0f;
+    for (uint32_t i = 0; i < TEXTURE_COUNT; ++i)
+    {
+        const Texture &texture = cudaManager->textures[i];
+        if (!texture.image_data)
+        {
+            continue;
+        }
+        maxError = std::max(maxError, preprocessPass.checkParity(i, reinterpret_cast<const unsigned char *>(texture.image_data), texture.width,
+                                                                 texture.height));
+        // Only the host pipeline reads the pixels after this.
+        if (!cudaManager->usesHostPipeline())
+        {
+            cudaManager->textures[i].releaseHostPixels();
+        }
+    }
+    std::cout << "Vulkan preprocessing pass against the CPU reference: max error " << maxError << std::endl;
+    // A pass that disagrees would feed the network wrong inputs for the whole run.
+    if (maxError > kParityTolerance)
+    {
+        throw std::runtime_error("the Vulkan preprocessing pass differs from the CPU reference by " + std::to_string(maxError) +
+                                 ", run with --preprocess=cuda");
+    }
+}
+
 void Renderer::createCamera()
 {
     timerSpeed *= 0.25f;
@@ -287,45 +536,60 @@ void Renderer::createCamera()
     camera.setPerspective(60.0f, (float)swapChain.extent.width / (float)swapChain.extent.height, 0.1f, 256.0f);
 }
 
-void Renderer::updateUniformBuffers()
+void Renderer::updateUniformBuffers(size_t currentFrameIdx)
 {
 
     sceneData.projection = camera.matrices.perspective;
     sceneData.view = camera.matrices.view;
     sceneData.model = glm::mat4(1.0f);
 
-    graphics.sceneDataUniformBuffer.updateData(sceneData);
+    graphics.sceneDataUniformBuffers[currentFrameIdx].updateData(sceneData);
 }
 void Renderer::setupDescriptors()
 {
+    // The whole texture array is bound in the fragment stage and, by the preprocess pass, in the compute stage. With
+    // update-after-bind textures the device takes hundreds of thousands; otherwise as few as 16 are guaranteed.
+    if (TEXTURE_COUNT > context.maxBoundTextures)
+    {
+        throw std::runtime_error("TEXTURE_COUNT (" + std::to_string(TEXTURE_COUNT) + ") exceeds the " + std::to_string(context.maxBoundTextures) +
+                                 " combined image samplers a shader stage of this device can bind");
+    }
+
     // Pool
-    graphics.descriptorSets.resize(TEXTURE_COUNT);
+    const uint32_t setCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
     std::vector<VkDescriptorPoolSize> poolSizes = {
-        initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, TEXTURE_COUNT),
-        initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, TEXTURE_COUNT)
+        initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, setCount),
+        initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, setCount * TEXTURE_COUNT)
 
     };
-    VkDescriptorPoolCreateInfo descriptorPoolInfo = initializers::descriptorPoolCreateInfo(poolSizes, TEXTURE_COUNT);
+    VkDescriptorPoolCreateInfo descriptorPoolInfo = initializers::descriptorPoolCreateInfo(poolSizes, setCount);
+    descriptorPoolInfo.flags = textureArrayPoolFlags(context);
     VK_CHECK(vkCreateDescriptorPool(logicalDevice_, &descriptorPoolInfo, nullptr, &descriptorPool));
 
     // Layout
     std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
         // Binding 0 : Shader uniform ubo
         initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, 0),
-        initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 1),
+        // Binding 1 : All digit textures, indexed by the push constant
+        initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 1, TEXTURE_COUNT),
     };
-    VkDescriptorSetLayoutCreateInfo descriptorLayout = initializers::descriptorSetLayoutCreateInfo(setLayoutBindings);
-    VK_CHECK(vkCreateDescriptorSetLayout(logicalDevice_, &descriptorLayout, nullptr, &graphics.descriptorSetLayout));
-    std::vector<VkDescriptorSetLayout> layouts(TEXTURE_COUNT, graphics.descriptorSetLayout);
-    VkDescriptorSetAllocateInfo allocInfo = initializers::descriptorSetAllocateInfo(descriptorPool, layouts.data(), TEXTURE_COUNT);
+    graphics.descriptorSetLayout = createTextureArraySetLayout(context, setLayoutBindings, 1);
+    std::vector<VkDescriptorSetLayout> layouts(setCount, graphics.descriptorSetLayout);
+    VkDescriptorSetAllocateInfo allocInfo = initializers::descriptorSetAllocateInfo(descriptorPool, layouts.data(), setCount);
     VK_CHECK(vkAllocateDescriptorSets(logicalDevice_, &allocInfo, graphics.descriptorSets.data()));
 
-    // Fill each descriptor set with the corresponding texture
+    // Fill each descriptor set with the frame's uniform buffer and the whole texture array
+    std::vector<VkDescriptorImageInfo> textureDescriptors;
     for (uint32_t i = 0; i < TEXTURE_COUNT; ++i)
     {
+        textureDescriptors.push_back(cudaManager->textures[i].descriptor);
+    }
+    for (size_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame)
+    {
+        VkDescriptorSet set = graphics.descriptorSets[frame];
         std::vector<VkWriteDescriptorSet> writeDescriptorSets = {
-            initializers::writeDescriptorSet(graphics.descriptorSets[i], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 0, &graphics.sceneDataUniformBuffer.descriptor),
-            initializers::writeDescriptorSet(graphics.descriptorSets[i], VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, &cudaManager->textures[i].descriptor),
+            initializers::writeDescriptorSet(set, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 0, &graphics.sceneDataUniformBuffers[frame].descriptor),
+            initializers::writeDescriptorSet(set, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, textureDescriptors.data(), TEXTURE_COUNT),
         };
         vkUpdateDescriptorSets(logicalDevice_, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
     }
@@ -333,8 +597,11 @@ void Renderer::setupDescriptors()
 
 void Renderer::createUniformBuffers()
 {
-    graphics.sceneDataUniformBuffer.init(context);
-    updateUniformBuffers();
+    for (size_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame)
+    {
+        graphics.sceneDataUniformBuffers[frame].init(context);
+        updateUniformBuffers(frame);
+    }
 }
 
 void Renderer::generateQuad()
@@ -363,3 +630,45 @@ void Renderer::cudaInitialize()
 {
     cudaManager = std::make_unique<CudaManager>(context, TEXTURE_COUNT);
 }
+
+void Renderer::openInputStream()
+{
+    const Options::Settings &settings = Options::settings();
+    if (settings.input.empty())
+    {
+        return;
+    }
+    // Streamed images take the size of the digit textures they are written into.
+    const Texture &slot = cudaManager->textures[0];
+    inputStream = InputStream::open(settings.input, slot.width, slot.height, settings.inputQueue);
+    if (!inputStream)
+    {
+        throw std::runtime_error("could not open input source '" + settings.input + "'");
+    }
+    slotLastFrame.assign(TEXTURE_COUNT, 0);
+    std::cout << "Streaming input from " << settings.input << " into " << TEXTURE_COUNT << " texture slots of " << slot.width << "x"
+              << slot.height << ", queue of " << settings.inputQueue << std::endl;
+}
+
+void Renderer::streamInput()
+{
+    if (!inputStream)
+    {
+        return;
+    }
+    // Past this frame's fence wait, every Vulkan frame up to MAX_FRAMES_IN_FLIGHT back has finished, and with it the
+    // CUDA work up to maxCudaLag() frames before that. A slot last shown by one of those frames can be overwritten
+    // without waiting for anything.
+    const uint64_t frame = cudaManager->frameValue();
+    const uint32_t slot = (currentTextureIndex + 1) % TEXTURE_COUNT;
+    const uint64_t lastFrame = slotLastFrame[slot];
+    const bool slotIdle = lastFrame == 0 || lastFrame + MAX_FRAMES_IN_FLIGHT + cudaManager->maxCudaLag() <= frame;
+    if (slotIdle && inputStream->pop(inputFrame))
+    {
+        cudaManager->updateTexture(slot, inputFrame.pixels.data());
+        // Queue order puts the upload ahead of this frame's submission, and the frame's semaphore signal ahead of CUDA.
+        stagingRing.submit();
+        currentTextureIndex = slot;
+    }
+    slotLastFrame[currentTextureIndex] = frame;
+}
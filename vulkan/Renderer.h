@@ -6,14 +6,25 @@
 #include "CudaManager.h"
 #include "UniformBuffer.h"
 #include "StagingBuffer.h"
+#include "Benchmark.h"
+#include "FramePacer.h"
+#include "InputStream.h"
+#include "MemoryReport.h"
 
 class Renderer : public Core
 {
 public:
     Renderer(GLFWwindow &window);
+    // Headless renderer drawing into an offscreen image ring of the given size.
+    explicit Renderer(VkExtent2D offscreenSize);
     // void init(GLFWwindow& window);
     ~Renderer();
     void render() override;
+    // Renders frameLimit frames (0: until SIGINT) without a window and reports frames/s and inferences/s. \returns false
+    // if the inference engine allocated device memory during the run.
+    bool runHeadless(uint64_t frameLimit);
+    // Current image memory by owner, e.g. to check that streaming keeps it flat.
+    MemoryReport memoryReport() const;
     void draw();
     bool uiVisible = false;
     void cleanUp();
@@ -35,16 +46,19 @@ private:
     float zFar{1024.0f};
 
 private:
-    void buildCommandBuffers() override;
+    void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex, size_t currentFrameIdx) override;
 
 private:
     void createGraphicsPipeline();
+    // --preprocess=vulkan: writes the network input from the frame's command buffer, see CudaManager::usesVulkanPreprocess().
+    void createPreprocessPass();
+    void checkPreprocessParity();
     void setupDescriptors();
     VkDescriptorPool descriptorPool{VK_NULL_HANDLE};
 
 private:
     void createUniformBuffers();
-    void updateUniformBuffers();
+    void updateUniformBuffers(size_t currentFrameIdx);
 
 private:
     uint32_t frameCounter = 0;
@@ -52,7 +66,10 @@ private:
     float frameTimer = 1.0f;
     float timer = 0.0f;
     float timerSpeed = 0.25f;
-    std::chrono::time_point<std::chrono::high_resolution_clock> lastTimestamp, tPrevEnd;
+    std::chrono::time_point<std::chrono::high_resolution_clock> lastTimestamp, tPrevEnd, lastFrameStart;
+    Benchmark::FrameTimeHistogram frameTimes;
+    FramePacer framePacer;
+    bool histogramSerialized = false; // Mode the histogram was collected in; it restarts when the mode changes
 
 private:
     void createCamera();
@@ -67,9 +84,9 @@ private:
     } sceneData;
     struct Graphics
     {
-        UniformBuffer<SceneData> sceneDataUniformBuffer{};
+        std::array<UniformBuffer<SceneData>, MAX_FRAMES_IN_FLIGHT> sceneDataUniformBuffers{};
         VkDescriptorSetLayout descriptorSetLayout{VK_NULL_HANDLE};
-        std::vector<VkDescriptorSet> descriptorSets;
+        std::array<VkDescriptorSet, MAX_FRAMES_IN_FLIGHT> descriptorSets{}; // Frame's uniform buffer and every digit texture
         VkPipeline pipeline{VK_NULL_HANDLE};
         VkPipelineLayout pipelineLayout{VK_NULL_HANDLE};
         StagingBuffer vertexBuffer;
@@ -79,6 +96,9 @@ private:
 
 protected:
     virtual void cudaInitialize();
+    void openInputStream();
+    // Moves the next streamed image, if any, into a texture slot no frame in flight still reads and displays it.
+    void streamInput();
     void submitVulkan(uint32_t imageIndex);
 
 private:
@@ -93,6 +113,12 @@ private:
     uint32_t currentTextureIndex = 0;
     const uint32_t TEXTURE_COUNT = 10;
     float textureSwitchTimer = 0.0f;
+    PreprocessPass preprocessPass;
+
+    // With --input the digit textures become a ring of slots that streamed images overwrite in place.
+    std::unique_ptr<InputStream> inputStream;
+    InputStream::Frame inputFrame;
+    std::vector<uint64_t> slotLastFrame; // Frame value of the last frame that displayed each slot, 0 if none did
 };
 
 #endif // RENDERER_H
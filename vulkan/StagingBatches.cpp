@@ -0,0 +1,138 @@
+#include "StagingBatches.h"
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+uint64_t alignUp(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+} // namespace
+
+void StagingBatches::reset(uint64_t capacity)
+{
+    ringCapacity = capacity;
+    head = tail = 0;
+    batches = {};
+    current = 0;
+    uploadCount = 0;
+    submitCount = 0;
+}
+
+uint64_t StagingBatches::place(uint64_t size, uint64_t alignment) const
+{
+    // With nothing in use the region can start at the beginning of the buffer; allocate() rebases head and tail there.
+    const uint64_t start = tail == head ? alignUp(head, ringCapacity) : head;
+    const uint64_t end = tail == head ? start : tail;
+    // Regions never wrap; the unused end of the buffer is skipped instead.
+    uint64_t offset = alignUp(start, alignment);
+    if (offset % ringCapacity + size > ringCapacity)
+    {
+        offset = alignUp(offset, ringCapacity);
+    }
+    return offset + size - end <= ringCapacity ? offset : kNoRoom;
+}
+
+bool StagingBatches::hasRoom(uint64_t size, uint64_t alignment) const
+{
+    return size <= ringCapacity && place(size, alignment) != kNoRoom;
+}
+
+uint64_t StagingBatches::allocate(uint64_t size, uint64_t alignment)
+{
+    if (size > ringCapacity)
+    {
+        throw std::runtime_error("upload of " + std::to_string(size) + " bytes does not fit the " + std::to_string(ringCapacity) + " byte staging ring!");
+    }
+    for (;;)
+    {
+        const uint64_t offset = place(size, alignment);
+        if (offset != kNoRoom)
+        {
+            if (tail == head)
+            {
+                tail = alignUp(head, ringCapacity);
+            }
+            head = offset + size;
+            ++uploadCount;
+            return offset % ringCapacity;
+        }
+        retireOldest();
+    }
+}
+
+size_t StagingBatches::recordingBatch()
+{
+    Batch &batch = batches[current];
+    if (!batch.recording)
+    {
+        if (batch.pending)
+        {
+            wait(current);
+        }
+        backend.begin(current);
+        batch.recording = true;
+    }
+    return current;
+}
+
+void StagingBatches::submit()
+{
+    Batch &batch = batches[current];
+    if (!batch.recording)
+    {
+        return;
+    }
+    backend.submit(current);
+    batch.end = head;
+    batch.recording = false;
+    batch.pending = true;
+    ++submitCount;
+    current = (current + 1) % kBatches;
+}
+
+void StagingBatches::finish()
+{
+    submit();
+    for (size_t i = 0; i < kBatches; ++i)
+    {
+        const size_t slot = (current + i) % kBatches;
+        if (batches[slot].pending)
+        {
+            wait(slot);
+        }
+    }
+}
+
+void StagingBatches::wait(size_t slot)
+{
+    Batch &batch = batches[slot];
+    backend.wait(slot);
+    batch.pending = false;
+    // allocate() may already have moved tail past this batch when the ring ran empty.
+    if (batch.end > tail)
+    {
+        tail = batch.end;
+    }
+}
+
+void StagingBatches::retireOldest()
+{
+    // Slots are used round-robin, so the oldest submitted batch is the first pending one from the current slot on.
+    for (size_t i = 0; i < kBatches; ++i)
+    {
+        const size_t slot = (current + i) % kBatches;
+        if (batches[slot].pending)
+        {
+            wait(slot);
+            return;
+        }
+    }
+    if (!batches[current].recording)
+    {
+        throw std::runtime_error("staging ring is full of regions that no recorded command reads!");
+    }
+    // Everything still in use belongs to the batch being recorded.
+    finish();
+}
@@ -0,0 +1,81 @@
+#ifndef STAGINGBATCHES_H
+#define STAGINGBATCHES_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// The command side of StagingRing's batches. StagingRing records into command buffers and waits on fences; a fake can
+// stand in for it to exercise the ring's bookkeeping without a GPU.
+class StagingBatchBackend
+{
+public:
+    virtual ~StagingBatchBackend() = default;
+    // Starts recording into the batch's command buffers.
+    virtual void begin(size_t batch) = 0;
+    // Hands the recorded batch to the queues.
+    virtual void submit(size_t batch) = 0;
+    // Returns once the submitted batch has executed.
+    virtual void wait(size_t batch) = 0;
+};
+
+// Where StagingRing's regions go and which batch reads them, without any Vulkan. Ring positions only grow; position %
+// capacity is the buffer offset. Regions are handed to the batch being recorded, and the space a batch read is handed
+// out again once it has been waited for. The backend is asked to submit or wait only when the ring is full.
+class StagingBatches
+{
+public:
+    static constexpr size_t kBatches = 4;
+
+    explicit StagingBatches(StagingBatchBackend &backend) : backend(backend) {}
+    StagingBatches(const StagingBatches &) = delete;
+    StagingBatches &operator=(const StagingBatches &) = delete;
+
+    // Starts over with an empty ring of capacity bytes, a multiple of every alignment asked for.
+    void reset(uint64_t capacity);
+    uint64_t capacity() const { return ringCapacity; }
+
+    // Buffer offset of a size byte region read by the batch being recorded. Regions never wrap around the end of the
+    // buffer. Submits the current batch and waits for older ones when the ring is full; throws when size exceeds it.
+    uint64_t allocate(uint64_t size, uint64_t alignment);
+    // True when allocate() would return without submitting or waiting.
+    bool hasRoom(uint64_t size, uint64_t alignment) const;
+    // Slot of the batch being recorded, waiting for the slot's previous batch and beginning it if need be.
+    size_t recordingBatch();
+    // Submits the batch being recorded, if any.
+    void submit();
+    // Submits the batch being recorded and waits for every batch.
+    void finish();
+
+    uint32_t uploads() const { return uploadCount; }
+    uint32_t submissions() const { return submitCount; }
+    // Bytes the GPU may still read, including space skipped at the end of the buffer.
+    uint64_t inFlight() const { return head - tail; }
+
+private:
+    struct Batch
+    {
+        uint64_t end = 0;     // Ring position after the last region the batch reads
+        bool recording = false;
+        bool pending = false; // Submitted and not yet waited for
+    };
+
+    static constexpr uint64_t kNoRoom = UINT64_MAX;
+
+    // Ring position a size byte region would start at, kNoRoom while the GPU may still read the space it needs.
+    uint64_t place(uint64_t size, uint64_t alignment) const;
+    void wait(size_t batch);
+    void retireOldest();
+
+    StagingBatchBackend &backend;
+    uint64_t ringCapacity = 0;
+    // The GPU may still read [tail, head).
+    uint64_t head = 0;
+    uint64_t tail = 0;
+    std::array<Batch, kBatches> batches{};
+    size_t current = 0;
+    uint32_t uploadCount = 0;
+    uint32_t submitCount = 0;
+};
+
+#endif // STAGINGBATCHES_H
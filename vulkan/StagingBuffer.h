@@ -2,34 +2,31 @@
 #define STAGINGBUFFER_H
 
 #include "MemoryManager.h"
+#include "StagingRing.h"
 
 class StagingBuffer:public MemoryManager
 {
 public:
+    // The copy is recorded into the staging ring; the buffer holds the data once the ring's batch has been submitted.
     template <typename T>
     void create(const VulkanData &vulkanData, const T &t, VkBufferUsageFlags usage, VkDeviceSize bufferSize){
 
         vulkanData_ = vulkanData;
-        VkBuffer stagingBuffer;
-        VkDeviceMemory stagingBufferMemory;
-        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+        createBuffer(bufferSize, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, allocation);
 
-        void* data;
-        vkMapMemory(vulkanData_.device, stagingBufferMemory, 0, bufferSize, 0, &data);
-        memcpy(data, t.data(), (size_t) bufferSize);
-        vkUnmapMemory(vulkanData_.device, stagingBufferMemory);
+        StagingRing &stagingRing = *vulkanData_.stagingRing;
+        StagingRing::Region staging = stagingRing.allocate(bufferSize);
+        memcpy(staging.data, t.data(), (size_t) bufferSize);
 
-        createBuffer(bufferSize, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, bufferMemory);
-
-        copyBuffer(stagingBuffer, buffer, bufferSize);
-
-        vkDestroyBuffer(vulkanData_.device, stagingBuffer, nullptr);
-        vkFreeMemory(vulkanData_.device, stagingBufferMemory, nullptr);
+        VkBufferCopy copyRegion{};
+        copyRegion.srcOffset = staging.offset;
+        copyRegion.size = bufferSize;
+        vkCmdCopyBuffer(stagingRing.transferCommandBuffer(), staging.buffer, buffer, 1, &copyRegion);
+        stagingRing.releaseBuffer(buffer, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
     }
 
     void cleanUp(){
-        vkDestroyBuffer(vulkanData_.device, buffer, nullptr);
-        vkFreeMemory(vulkanData_.device, bufferMemory, nullptr);
+        destroyBuffer(buffer, allocation);
     }
 
     void setupDescriptor(VkDeviceSize size = VK_WHOLE_SIZE, VkDeviceSize offset = 0){
@@ -38,7 +35,7 @@ public:
         descriptor.range = size;
     }
     VkBuffer buffer;
-    VkDeviceMemory bufferMemory;
+    MemoryAllocation allocation;
     VkDescriptorBufferInfo descriptor;
 };
 
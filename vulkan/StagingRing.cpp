@@ -0,0 +1,232 @@
+#include "StagingRing.h"
+#include <iostream>
+
+namespace
+{
+uint64_t alignUp(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+} // namespace
+
+void StagingRing::init(const VulkanData &vulkanData, VkDeviceSize size)
+{
+    vulkanData_ = vulkanData;
+    dedicatedTransfer = vulkanData_.transferQueue != VK_NULL_HANDLE;
+    // A multiple of every copy alignment, so aligned positions stay aligned after wrapping around.
+    const VkDeviceSize capacity = alignUp(size, 256);
+
+    // Copies read the ring on the transfer queue, the graphics-only uploads (mip blits) on the graphics queue. Sharing
+    // it concurrently spares an ownership transfer for a buffer nobody writes on the device.
+    const uint32_t queueFamilies[] = {vulkanData_.graphicsQueueFamily, vulkanData_.transferQueueFamily};
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = capacity;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    bufferInfo.sharingMode = dedicatedTransfer ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE;
+    bufferInfo.queueFamilyIndexCount = dedicatedTransfer ? 2 : 0;
+    bufferInfo.pQueueFamilyIndices = dedicatedTransfer ? queueFamilies : nullptr;
+    VK_CHECK(vkCreateBuffer(vulkanData_.device, &bufferInfo, nullptr, &buffer));
+
+    vkGetBufferMemoryRequirements(vulkanData_.device, buffer, &memRequirements);
+    const uint32_t memoryTypeIndex = findMemoryType(vulkanData_.physicalDevice, memRequirements.memoryTypeBits,
+                                                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    allocation = vulkanData_.allocator->allocate(memRequirements, memoryTypeIndex);
+    VK_CHECK(vkBindBufferMemory(vulkanData_.device, buffer, allocation.memory, allocation.offset));
+
+    std::array<VkCommandBuffer, kBatches> graphicsCommandBuffers;
+    std::array<VkCommandBuffer, kBatches> transferCommandBuffers;
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandPool = vulkanData_.commandPool;
+    allocInfo.commandBufferCount = kBatches;
+    VK_CHECK(vkAllocateCommandBuffers(vulkanData_.device, &allocInfo, graphicsCommandBuffers.data()));
+    transferCommandBuffers = graphicsCommandBuffers;
+    if (dedicatedTransfer)
+    {
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        poolInfo.queueFamilyIndex = vulkanData_.transferQueueFamily;
+        VK_CHECK(vkCreateCommandPool(vulkanData_.device, &poolInfo, nullptr, &transferCommandPool));
+        allocInfo.commandPool = transferCommandPool;
+        VK_CHECK(vkAllocateCommandBuffers(vulkanData_.device, &allocInfo, transferCommandBuffers.data()));
+    }
+
+    VkFenceCreateInfo fenceInfo{};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    for (size_t i = 0; i < kBatches; ++i)
+    {
+        batches[i] = Batch{};
+        batches[i].graphicsCommandBuffer = graphicsCommandBuffers[i];
+        batches[i].transferCommandBuffer = transferCommandBuffers[i];
+        VK_CHECK(vkCreateFence(vulkanData_.device, &fenceInfo, nullptr, &batches[i].fence));
+        if (dedicatedTransfer)
+        {
+            VK_CHECK(vkCreateSemaphore(vulkanData_.device, &semaphoreInfo, nullptr, &batches[i].transferDone));
+        }
+    }
+    schedule.reset(capacity);
+    std::cout << "Staging ring uses the " << (dedicatedTransfer ? "dedicated transfer" : "graphics") << " queue" << std::endl;
+}
+
+void StagingRing::cleanUp()
+{
+    if (buffer == VK_NULL_HANDLE)
+    {
+        return;
+    }
+    finish();
+    for (Batch &batch : batches)
+    {
+        vkFreeCommandBuffers(vulkanData_.device, vulkanData_.commandPool, 1, &batch.graphicsCommandBuffer);
+        vkDestroySemaphore(vulkanData_.device, batch.transferDone, nullptr);
+        vkDestroyFence(vulkanData_.device, batch.fence, nullptr);
+        batch = Batch{};
+    }
+    // Destroying the pool frees the transfer command buffers.
+    vkDestroyCommandPool(vulkanData_.device, transferCommandPool, nullptr);
+    transferCommandPool = VK_NULL_HANDLE;
+    destroyBuffer(buffer, allocation);
+}
+
+bool StagingRing::hasRoom(VkDeviceSize size, VkDeviceSize alignment) const
+{
+    return schedule.hasRoom(size, alignment);
+}
+
+StagingRing::Region StagingRing::allocate(VkDeviceSize size, VkDeviceSize alignment)
+{
+    Region region;
+    region.buffer = buffer;
+    region.offset = schedule.allocate(size, alignment);
+    region.data = static_cast<char *>(allocation.mapped) + region.offset;
+    return region;
+}
+
+void StagingRing::begin(size_t slot)
+{
+    Batch &batch = batches[slot];
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VK_CHECK(vkBeginCommandBuffer(batch.transferCommandBuffer, &beginInfo));
+    if (dedicatedTransfer)
+    {
+        VK_CHECK(vkBeginCommandBuffer(batch.graphicsCommandBuffer, &beginInfo));
+    }
+}
+
+VkCommandBuffer StagingRing::transferCommandBuffer()
+{
+    return batches[schedule.recordingBatch()].transferCommandBuffer;
+}
+
+VkCommandBuffer StagingRing::graphicsCommandBuffer()
+{
+    return batches[schedule.recordingBatch()].graphicsCommandBuffer;
+}
+
+void StagingRing::releaseImage(VkImage image, VkImageLayout newLayout, VkAccessFlags dstAccessMask, VkPipelineStageFlags dstStageMask, uint32_t mipLevels)
+{
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = dstAccessMask;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = newLayout;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.levelCount = mipLevels;
+    barrier.subresourceRange.layerCount = 1;
+    if (!dedicatedTransfer)
+    {
+        vkCmdPipelineBarrier(transferCommandBuffer(), VK_PIPELINE_STAGE_TRANSFER_BIT, dstStageMask, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+        return;
+    }
+
+    // The release and the acquire carry the same layouts, so the transition happens once, in between the two.
+    barrier.srcQueueFamilyIndex = vulkanData_.transferQueueFamily;
+    barrier.dstQueueFamilyIndex = vulkanData_.graphicsQueueFamily;
+    VkImageMemoryBarrier release = barrier;
+    release.dstAccessMask = 0;
+    vkCmdPipelineBarrier(transferCommandBuffer(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &release);
+    VkImageMemoryBarrier acquire = barrier;
+    acquire.srcAccessMask = 0;
+    vkCmdPipelineBarrier(graphicsCommandBuffer(), dstStageMask, dstStageMask, 0, 0, nullptr, 0, nullptr, 1, &acquire);
+}
+
+void StagingRing::releaseBuffer(VkBuffer uploaded, VkAccessFlags dstAccessMask, VkPipelineStageFlags dstStageMask)
+{
+    VkBufferMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = dstAccessMask;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = uploaded;
+    barrier.size = VK_WHOLE_SIZE;
+    if (!dedicatedTransfer)
+    {
+        vkCmdPipelineBarrier(transferCommandBuffer(), VK_PIPELINE_STAGE_TRANSFER_BIT, dstStageMask, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+        return;
+    }
+
+    barrier.srcQueueFamilyIndex = vulkanData_.transferQueueFamily;
+    barrier.dstQueueFamilyIndex = vulkanData_.graphicsQueueFamily;
+    VkBufferMemoryBarrier release = barrier;
+    release.dstAccessMask = 0;
+    vkCmdPipelineBarrier(transferCommandBuffer(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &release, 0, nullptr);
+    VkBufferMemoryBarrier acquire = barrier;
+    acquire.srcAccessMask = 0;
+    vkCmdPipelineBarrier(graphicsCommandBuffer(), dstStageMask, dstStageMask, 0, 0, nullptr, 1, &acquire, 0, nullptr);
+}
+
+void StagingRing::submit()
+{
+    schedule.submit();
+}
+
+void StagingRing::finish()
+{
+    schedule.finish();
+}
+
+void StagingRing::submit(size_t slot)
+{
+    Batch &batch = batches[slot];
+    VK_CHECK(vkResetFences(vulkanData_.device, 1, &batch.fence));
+    VK_CHECK(vkEndCommandBuffer(batch.transferCommandBuffer));
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    if (dedicatedTransfer)
+    {
+        // The graphics half waits for the copies; its fence therefore covers the whole batch.
+        submitInfo.pCommandBuffers = &batch.transferCommandBuffer;
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = &batch.transferDone;
+        VK_CHECK(vkQueueSubmit(vulkanData_.transferQueue, 1, &submitInfo, VK_NULL_HANDLE));
+
+        VK_CHECK(vkEndCommandBuffer(batch.graphicsCommandBuffer));
+        const VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+        submitInfo = VkSubmitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.waitSemaphoreCount = 1;
+        submitInfo.pWaitSemaphores = &batch.transferDone;
+        submitInfo.pWaitDstStageMask = &waitStage;
+        submitInfo.commandBufferCount = 1;
+    }
+    submitInfo.pCommandBuffers = &batch.graphicsCommandBuffer;
+    VK_CHECK(vkQueueSubmit(vulkanData_.graphicQueue, 1, &submitInfo, batch.fence));
+}
+
+void StagingRing::wait(size_t slot)
+{
+    VK_CHECK(vkWaitForFences(vulkanData_.device, 1, &batches[slot].fence, VK_TRUE, UINT64_MAX));
+}
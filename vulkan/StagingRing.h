@@ -0,0 +1,88 @@
+#ifndef STAGINGRING_H
+#define STAGINGRING_H
+
+#include <array>
+#include <cstdint>
+#include "MemoryManager.h"
+#include "StagingBatches.h"
+
+// One persistently mapped, host-visible buffer that every upload copies its data through. Uploads record their copies
+// into the ring's current batch and submit() hands the whole batch to the queues with a fence; the space a batch used
+// is handed out again once its fence has signalled. Loading many resources therefore costs one submission per batch
+// (or per ring's worth of data) instead of an allocation, a map and a vkQueueWaitIdle each.
+//
+// When the device has a transfer queue family without graphics (VulkanData::transferQueue), copies run there. Every
+// uploaded resource is then released to the graphics family at the end of the transfer commands and acquired by a
+// small graphics command buffer that waits on the batch's semaphore, so uploads overlap rendering and inference.
+// Without such a queue both command buffers are one and the same, submitted to the graphics queue.
+// Where regions go and when batches are submitted is up to StagingBatches; this class does the Vulkan side of it.
+// Not thread-safe; uploads happen on the render thread.
+class StagingRing : public MemoryManager, private StagingBatchBackend
+{
+public:
+    struct Region
+    {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkDeviceSize offset = 0; // Source offset of copies out of the region
+        void *data = nullptr;    // Host address of offset
+    };
+
+    static constexpr VkDeviceSize kDefaultSize = VkDeviceSize(32) << 20;
+
+    StagingRing() : schedule(*this) {}
+    StagingRing(const StagingRing &) = delete;
+    StagingRing &operator=(const StagingRing &) = delete;
+
+    void init(const VulkanData &vulkanData, VkDeviceSize size = kDefaultSize);
+    // Waits for the outstanding batches before releasing the ring.
+    void cleanUp();
+
+    // Reserves size bytes, submitting the current batch and waiting for older ones when the ring is full. A region
+    // must be consumed by commands recorded into the batch before the next submit(). Throws when size exceeds the ring.
+    Region allocate(VkDeviceSize size, VkDeviceSize alignment = 16);
+    // True when allocate() would return without submitting or waiting. Regions filled by other threads have to be
+    // complete before an allocate() that may submit them.
+    bool hasRoom(VkDeviceSize size, VkDeviceSize alignment = 16) const;
+    // Command buffers of the batch being recorded; call them after allocate(), which may submit the previous batch.
+    // Transfer commands may only copy and change layouts. Blits and anything else that needs a graphics queue go into
+    // the graphics command buffer, which runs after the transfer one.
+    VkCommandBuffer transferCommandBuffer();
+    VkCommandBuffer graphicsCommandBuffer();
+    // End of an upload recorded into the transfer command buffer: moves the resource, written by transfer commands
+    // (images in TRANSFER_DST_OPTIMAL), to the graphics queue family and makes it visible to dstStageMask/dstAccessMask.
+    void releaseImage(VkImage image, VkImageLayout newLayout, VkAccessFlags dstAccessMask, VkPipelineStageFlags dstStageMask, uint32_t mipLevels = 1);
+    void releaseBuffer(VkBuffer buffer, VkAccessFlags dstAccessMask, VkPipelineStageFlags dstStageMask);
+    // Submits the recorded batch without waiting. Later submissions to the graphics queue see its results.
+    void submit();
+    // Submits the recorded batch and waits until every batch has executed.
+    void finish();
+
+    uint32_t uploads() const { return schedule.uploads(); }
+    uint32_t submissions() const { return schedule.submissions(); }
+    bool usesTransferQueue() const { return dedicatedTransfer; }
+
+private:
+    static constexpr size_t kBatches = StagingBatches::kBatches;
+
+    struct Batch
+    {
+        VkCommandBuffer transferCommandBuffer = VK_NULL_HANDLE;
+        VkCommandBuffer graphicsCommandBuffer = VK_NULL_HANDLE; // The transfer one without a dedicated transfer queue
+        VkSemaphore transferDone = VK_NULL_HANDLE;              // Transfer to graphics handoff, dedicated transfer queue only
+        VkFence fence = VK_NULL_HANDLE;
+    };
+
+    // StagingBatchBackend
+    void begin(size_t batch) override;
+    void submit(size_t batch) override;
+    void wait(size_t batch) override;
+
+    bool dedicatedTransfer = false;
+    VkCommandPool transferCommandPool = VK_NULL_HANDLE;
+    VkBuffer buffer = VK_NULL_HANDLE;
+    MemoryAllocation allocation;
+    StagingBatches schedule;
+    std::array<Batch, kBatches> batches{};
+};
+
+#endif // STAGINGRING_H
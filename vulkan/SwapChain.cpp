@@ -1,6 +1,8 @@
 #include "SwapChain.h"
 #include "HelperFunctions.h"
 #include <algorithm>
+#include <iostream>
+#include "Options.h"
 
 void SwapChain::init(VulkanData &vulkanData)
 {
@@ -36,12 +38,34 @@ VkPresentModeKHR SwapChain::chooseSwapPresentMode(const std::vector<VkPresentMod
     // VK_PRESENT_MODE_FIFO_RELAXED_KHR -> This mode only differs from the previous one if the application is late and the queue was empty at the last vertical blank.
     // VK_PRESENT_MODE_MAILBOX_KHR -> This is another variation of the second mode.
     // Instead of blocking the application when the queue is full, the images that are already queued are simply replaced with the newer ones
-    for (const auto& availablePresentMode : availablePresentModes) {
-        if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR) {
-            return availablePresentMode;
+
+    // With pacing=present the requested mode sets the frame rate. The other pacing modes time frames themselves, so
+    // they want a mode that never blocks in present.
+    std::vector<VkPresentModeKHR> preferred;
+    const Options::Settings& settings = Options::settings();
+    if (settings.pacing == "present") {
+        if (settings.presentMode == "immediate") {
+            preferred.push_back(VK_PRESENT_MODE_IMMEDIATE_KHR);
+        } else if (settings.presentMode == "fifo-relaxed") {
+            preferred.push_back(VK_PRESENT_MODE_FIFO_RELAXED_KHR);
+        } else if (settings.presentMode == "mailbox") {
+            preferred.push_back(VK_PRESENT_MODE_MAILBOX_KHR);
         }
+    } else {
+        preferred = {VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR};
     }
 
+    for (VkPresentModeKHR mode : preferred) {
+        if (std::find(availablePresentModes.begin(), availablePresentModes.end(), mode) != availablePresentModes.end()) {
+            return mode;
+        }
+    }
+    // FIFO is the only mode every implementation has to support.
+    if (settings.pacing != "present") {
+        std::cout << "No non-blocking present mode available, frames are limited to the display rate" << std::endl;
+    } else if (settings.presentMode != "fifo") {
+        std::cout << "Present mode " << settings.presentMode << " is unavailable, using fifo" << std::endl;
+    }
     return VK_PRESENT_MODE_FIFO_KHR;
 }
 
@@ -159,6 +183,36 @@ void SwapChain::create()
 
 }
 
+void SwapChain::createOffscreen(VkExtent2D imageExtent, uint32_t imageCount)
+{
+    // Same format and usage as the window's swap chain images, so the render pass and pipelines do not change.
+    offscreen = true;
+    imageFormat = VK_FORMAT_B8G8R8A8_UNORM;
+    extent = imageExtent;
+    vulkanData_.screenProperties.width = imageExtent.width;
+    vulkanData_.screenProperties.height = imageExtent.height;
+
+    VkImageCreateInfo imageInfo{};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.extent = {imageExtent.width, imageExtent.height, 1};
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.format = imageFormat;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    images.resize(imageCount);
+    offscreenMemory.resize(imageCount);
+    for (uint32_t i = 0; i < imageCount; i++) {
+        images[i] = createImage(vulkanData_, imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, offscreenMemory[i]);
+    }
+    std::cout << "Offscreen image ring is initialized..." << std::endl;
+}
+
 void SwapChain::createImageViews()
 {
     // To use any VkImage, including those in the swapchain, in ther render pipeline we have to create a VkImageView object.
@@ -201,16 +255,35 @@ void SwapChain::cleanup()
         vkDestroyImageView(vulkanData_.device, imageViews[i], nullptr);
     }
 
+    if (offscreen) {
+        for (size_t i = 0; i < images.size(); i++) {
+            vkDestroyImage(vulkanData_.device, images[i], nullptr);
+            vulkanData_.allocator->free(offscreenMemory[i]);
+        }
+        images.clear();
+        offscreenMemory.clear();
+        return;
+    }
     vkDestroySwapchainKHR(vulkanData_.device, swapChain , nullptr);
 }
 
 VkResult SwapChain::acquireNextImage(VkSemaphore presentCompleteSemaphore, uint32_t &imageIndex)
 {
+    // The offscreen ring has as many images as frames in flight, so the frame fence already guarantees the image is
+    // idle and nothing signals presentCompleteSemaphore.
+    if (offscreen) {
+        imageIndex = nextOffscreenImage;
+        nextOffscreenImage = (nextOffscreenImage + 1) % static_cast<uint32_t>(images.size());
+        return VK_SUCCESS;
+    }
     return vkAcquireNextImageKHR(vulkanData_.device, swapChain, UINT64_MAX, presentCompleteSemaphore, (VkFence)nullptr, &imageIndex);
 }
 
 VkResult SwapChain::queuePresent(VkQueue queue, uint32_t imageIndex, VkSemaphore waitSemaphore)
 {
+    if (offscreen) {
+        return VK_SUCCESS;
+    }
     VkPresentInfoKHR presentInfo = {};
     presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
     presentInfo.pNext = NULL;
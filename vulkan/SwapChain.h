@@ -8,6 +8,7 @@
 #include <vulkan/vulkan.h>
 
 #include "Context.h"
+#include "DeviceMemoryAllocator.h"
 
 
 class SwapChain
@@ -21,11 +22,14 @@ public:
     VkExtent2D extent;
     std::vector<VkImageView> imageViews;
     std::vector<VkFramebuffer> framebuffers;
+    // Set by createOffscreen: the images are plain device images handed out round robin, and present is a no-op.
+    bool offscreen = false;
 
 
 public:
     void init(VulkanData& vulkanData);
     void create();
+    void createOffscreen(VkExtent2D imageExtent, uint32_t imageCount);
     void createImageViews();
     void recreate();
     void cleanup();
@@ -39,6 +43,8 @@ private:
     VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities);
 private:
     VulkanData vulkanData_;
+    std::vector<MemoryAllocation> offscreenMemory;
+    uint32_t nextOffscreenImage = 0;
 };
 
 #endif // SWAPCHAIN_H
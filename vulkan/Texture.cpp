@@ -1,9 +1,9 @@
 #include "Texture.h"
 #include "Controllers.h"
 #include "Initializers.h"
+#include "StagingRing.h"
 #include <cstring>
 #include "helper_string.h"
-#include "helper_image.h"
 
 
 void Texture::cleanUp()
@@ -11,7 +11,16 @@ void Texture::cleanUp()
     vkDestroySampler(vulkanData_.device, sampler, nullptr);
     vkDestroyImageView(vulkanData_.device, view, nullptr);
     vkDestroyImage(vulkanData_.device, image, nullptr);
-    vkFreeMemory(vulkanData_.device, memory, nullptr);
+    vulkanData_.allocator->free(allocation);
+    memory = VK_NULL_HANDLE;
+    free(image_data);
+    image_data = NULL;
+}
+
+void Texture::releaseHostPixels()
+{
+    free(image_data);
+    image_data = NULL;
 }
 
 void Texture::loadFromGltfImage(const VulkanData &vulkanData, tinygltf::Image &gltfimage, std::string path)
@@ -69,14 +78,9 @@ void Texture::loadFromGltfImage(const VulkanData &vulkanData, tinygltf::Image &g
 
         assert(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_DST_BIT);
 
-        VkBuffer stagingBuffer;
-        VkDeviceMemory stagingMemory;
-
-        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingMemory);
-        uint8_t *data;
-        vkMapMemory(vulkanData_.device, stagingMemory, 0, memRequirements.size, 0, (void **)&data);
-        memcpy(data, buffer, static_cast<size_t>(bufferSize));
-        vkUnmapMemory(vulkanData_.device, stagingMemory);
+        StagingRing &stagingRing = *vulkanData_.stagingRing;
+        StagingRing::Region staging = stagingRing.allocate(bufferSize);
+        memcpy(staging.data, buffer, static_cast<size_t>(bufferSize));
 
         VkImageCreateInfo imageCreateInfo{};
         imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -92,9 +96,11 @@ void Texture::loadFromGltfImage(const VulkanData &vulkanData, tinygltf::Image &g
         imageCreateInfo.extent = {width, height, 1};
         imageCreateInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
 
-        image = createImage(vulkanData_, imageCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, memory);
+        image = createImage(vulkanData_, imageCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, allocation);
+        memory = allocation.memory;
 
-        VkCommandBuffer commandBuffer = beginSingleTimeCommands(vulkanData);
+        // The mip chain is blitted, which only a graphics queue can do, so the upload stays on the graphics side.
+        VkCommandBuffer commandBuffer = stagingRing.graphicsCommandBuffer();
         VkImageSubresourceRange subresourceRange = {};
         subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
         subresourceRange.levelCount = 1;
@@ -112,6 +118,7 @@ void Texture::loadFromGltfImage(const VulkanData &vulkanData, tinygltf::Image &g
         vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
 
         VkBufferImageCopy bufferCopyRegion = {};
+        bufferCopyRegion.bufferOffset = staging.offset;
         bufferCopyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
         bufferCopyRegion.imageSubresource.mipLevel = 0;
         bufferCopyRegion.imageSubresource.baseArrayLayer = 0;
@@ -120,7 +127,7 @@ void Texture::loadFromGltfImage(const VulkanData &vulkanData, tinygltf::Image &g
         bufferCopyRegion.imageExtent.height = height;
         bufferCopyRegion.imageExtent.depth = 1;
 
-        vkCmdCopyBufferToImage(commandBuffer, stagingBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &bufferCopyRegion);
+        vkCmdCopyBufferToImage(commandBuffer, staging.buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &bufferCopyRegion);
 
         imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
         imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
@@ -131,12 +138,7 @@ void Texture::loadFromGltfImage(const VulkanData &vulkanData, tinygltf::Image &g
         imageMemoryBarrier.subresourceRange = subresourceRange;
         vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
 
-        endSingleTimeCommands(vulkanData_, commandBuffer);
-
-        vkDestroyBuffer(vulkanData_.device, stagingBuffer, nullptr);
-        vkFreeMemory(vulkanData_.device, stagingMemory, nullptr);
-
-        VkCommandBuffer blitCmd = beginSingleTimeCommands(vulkanData_);
+        VkCommandBuffer blitCmd = commandBuffer;
         for (uint32_t i = 1; i < mipLevels; i++)
         {
             VkImageBlit imageBlit{};
@@ -204,7 +206,6 @@ void Texture::loadFromGltfImage(const VulkanData &vulkanData, tinygltf::Image &g
         {
             delete[] buffer;
         }
-        endSingleTimeCommands(vulkanData_, blitCmd);
     }
     else
     {
@@ -276,7 +277,8 @@ void Texture::loadFromGltfImage(const VulkanData &vulkanData, tinygltf::Image &g
         imageCreateInfo.extent = {width, height, 1};
         imageCreateInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
 
-        image = createImage(vulkanData_, imageCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, memory);
+        image = createImage(vulkanData_, imageCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, allocation);
+        memory = allocation.memory;
 
         VkImageSubresourceRange subresourceRange = {};
         subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -410,7 +412,8 @@ void Texture::loadImageFromFile(const VulkanData &vulkanData, const std::string
         vkExternalMemImageCreateInfo.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT_KHR;
         imageCreateInfo.pNext = &vkExternalMemImageCreateInfo;
 
-        image = createImage(vulkanData_, imageCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, memory, true);
+        image = createImage(vulkanData_, imageCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, allocation, exportMemory);
+        memory = allocation.memory;
 
         VkImageSubresourceRange subresourceRange = {};
         subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -442,7 +445,6 @@ void Texture::loadImageFromFile(const VulkanData &vulkanData, const std::string
         assert(formatProperties.linearTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT);
 
         VkImage mappableImage;
-        VkDeviceMemory mappableMemory;
 
         VkImageCreateInfo imageCreateInfo = initializers::imageCreateInfo();
         imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
@@ -456,7 +458,7 @@ void Texture::loadImageFromFile(const VulkanData &vulkanData, const std::string
         imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
         imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 
-        mappableImage = createImage(vulkanData_, imageCreateInfo, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, mappableMemory);
+        mappableImage = createImage(vulkanData_, imageCreateInfo, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, allocation);
 
         // Get sub resource layout
         // Mip map count, array layer, etc.
@@ -465,24 +467,19 @@ void Texture::loadImageFromFile(const VulkanData &vulkanData, const std::string
         subRes.mipLevel = 0;
 
         VkSubresourceLayout subResLayout;
-        void *data;
 
         // Get sub resources layout
         // Includes row pitch, size offsets, etc.
         vkGetImageSubresourceLayout(vulkanData_.device, mappableImage, &subRes, &subResLayout);
 
-        // Map image memory
-        VK_CHECK(vkMapMemory(vulkanData_.device, mappableMemory, 0, memRequirements.size, 0, &data));
-
-        // Copy image data into memory
-        memcpy(data, ktxTextureData, memRequirements.size);
-
-        vkUnmapMemory(vulkanData_.device, mappableMemory);
+        // Host-visible blocks stay mapped by the allocator, so copy straight into the image's part of the block
+        uint8_t *data = static_cast<uint8_t *>(allocation.mapped) + subResLayout.offset;
+        memcpy(data, ktxTextureData, std::min<VkDeviceSize>(ktxTextureSize, subResLayout.size));
 
         // Linear tiled images don't need to be staged
         // and can be directly used as textures
         image = mappableImage;
-        memory = mappableMemory;
+        memory = allocation.memory;
         this->imageLayout = imageLayout;
 
         VkImageSubresourceRange subresourceRange = {};
@@ -577,7 +574,8 @@ void Texture::loadImageFromFileCubeMap(const VulkanData &vulkanData, const std::
     // This flag is required for cube map images
     imageCreateInfo.flags = VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT;
 
-    image = createImage(vulkanData_, imageCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, memory);
+    image = createImage(vulkanData_, imageCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, allocation);
+    memory = allocation.memory;
 
     // Setup buffer copy regions for each face including all of its miplevels
     std::vector<VkBufferImageCopy> bufferCopyRegions;
@@ -682,7 +680,8 @@ void Texture::loadImage(const VulkanData &vulkanData, void *buffer, VkDeviceSize
     imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
     imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-    image = createImage(vulkanData_, imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, memory);
+    image = createImage(vulkanData_, imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, allocation);
+    memory = allocation.memory;
     VkImageSubresourceRange subresourceRange = {};
     subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
     subresourceRange.baseMipLevel = 0;
@@ -782,7 +781,8 @@ void Texture::emptyTexture(const VulkanData &vulkanData)
     imageCreateInfo.extent = {width, height, 1};
     imageCreateInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
 
-    image = createImage(vulkanData_, imageCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, memory);
+    image = createImage(vulkanData_, imageCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, allocation);
+    memory = allocation.memory;
     VkImageSubresourceRange subresourceRange{};
     subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
     subresourceRange.baseMipLevel = 0;
@@ -906,14 +906,8 @@ void Texture::empty3DTexture(const VulkanData &vulkanData, unsigned char *buffer
     vkFreeMemory(vulkanData_.device, stagingMemory, nullptr);
 }
 
-void Texture::loadImageData(const std::string &filePath, VulkanData &vulkanData,  cudaTextureObject_t& textureObjMipMapInput, std::function<void(unsigned int, unsigned int, unsigned int, size_t, VkDeviceMemory &, cudaTextureObject_t&)> importImageMemFunc)
+void Texture::openImageFile(const std::string &filePath, Pnm::Image &file, bool keepHostCopy)
 {
-    // load image (needed so we can get the width and height before we create
-    // the window
-    vulkanData_ = vulkanData;
-
-    unsigned int imageWidth, imageHeight;
-
     char *image_path = sdkFindFilePath(filePath.c_str(), execution_path.c_str());
 
     if (image_path == 0)
@@ -922,44 +916,98 @@ void Texture::loadImageData(const std::string &filePath, VulkanData &vulkanData,
         exit(EXIT_FAILURE);
     }
 
-    sdkLoadPPM4(image_path, (unsigned char **)&image_data, &imageWidth, &imageHeight);
-
-    if (!image_data)
+    std::string error;
+    if (!file.open(image_path, error))
     {
-        printf("Error opening file '%s'\n", image_path);
+        printf("Error opening file '%s': %s\n", image_path, error.c_str());
         exit(EXIT_FAILURE);
     }
 
-    printf("Loaded '%s', %d x %d pixels\n", image_path, imageWidth, imageHeight);
+    printf("Loaded '%s', %d x %d pixels\n", image_path, file.width(), file.height());
+    free(image_path);
 
-    width = imageWidth;
-    height = imageHeight;
-    createTextureImage(imageWidth, imageHeight);
-    importImageMemFunc(mipLevels, imageWidth, imageHeight, totalImageMemSize, memory, textureObjMipMapInput);
+    width = file.width();
+    height = file.height();
+    if (keepHostCopy)
+    {
+        image_data = static_cast<unsigned int *>(malloc(file.rgbaSize()));
+    }
 }
 
-void Texture::createTextureImage(unsigned int imageWidth, unsigned int imageHeight)
+void Texture::decodeImage(const Pnm::Image &file, void *staging)
 {
-    VkDeviceSize imageSize = imageWidth * imageHeight * 4;
-    mipLevels = 1;
-
     if (!image_data)
     {
-        throw std::runtime_error("failed to load texture image!");
+        file.decodeRgba(static_cast<unsigned char *>(staging));
+        return;
     }
+    // Decode once into the host copy and copy that into the staging region: the ring may be write-combined memory,
+    // which is cheap to write sequentially but slow to read back from.
+    file.decodeRgba(reinterpret_cast<unsigned char *>(image_data));
+    memcpy(staging, image_data, file.rgbaSize());
+}
 
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    createBuffer(imageSize,
-                 VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                 stagingBuffer,
-                 stagingBufferMemory);
+void Texture::loadImageData(const std::string &filePath, VulkanData &vulkanData, bool exportMemory, bool keepHostCopy)
+{
+    vulkanData_ = vulkanData;
+    Pnm::Image file;
+    openImageFile(filePath, file, keepHostCopy);
+    decodeImage(file, createTextureImage(width, height, exportMemory));
+}
 
-    void *data;
-    vkMapMemory(vulkanData_.device, stagingBufferMemory, 0, imageSize, 0, &data);
-    memcpy(data, image_data, static_cast<size_t>(imageSize));
-    vkUnmapMemory(vulkanData_.device, stagingBufferMemory);
+void Texture::loadImageData(std::vector<Texture> &textures, const std::vector<std::string> &filePaths, VulkanData &vulkanData, bool exportMemory,
+                            bool keepHostCopy, ThreadPool &pool)
+{
+    StagingRing &stagingRing = *vulkanData.stagingRing;
+    std::vector<Pnm::Image> files(textures.size());
+    for (size_t i = 0; i < textures.size(); ++i)
+    {
+        Texture &texture = textures[i];
+        texture.vulkanData_ = vulkanData;
+        texture.openImageFile(filePaths[i], files[i], keepHostCopy);
+        // An allocate() without room submits the batch, which must not happen before the pixels are in its regions.
+        if (!stagingRing.hasRoom(files[i].rgbaSize()))
+        {
+            pool.wait();
+        }
+        void *staging = texture.createTextureImage(texture.width, texture.height, exportMemory);
+        Pnm::Image &file = files[i];
+        pool.enqueue([&texture, &file, staging] {
+            texture.decodeImage(file, staging);
+            file.close();
+        });
+    }
+    pool.wait();
+}
+
+void Texture::updateImageData(const unsigned char *pixels)
+{
+    const VkDeviceSize imageSize = VkDeviceSize(width) * height * 4;
+    StagingRing &stagingRing = *vulkanData_.stagingRing;
+    StagingRing::Region staging = stagingRing.allocate(imageSize);
+    memcpy(staging.data, pixels, static_cast<size_t>(imageSize));
+    // The host pipeline and the parity checks preprocess from the loaded pixels, so they follow the image.
+    if (image_data)
+    {
+        memcpy(image_data, pixels, static_cast<size_t>(imageSize));
+    }
+
+    // Every texel is replaced, so the old contents are discarded: the image starts out UNDEFINED and, on a dedicated
+    // transfer queue, needs no ownership transfer back from the graphics family first.
+    VkCommandBuffer commandBuffer = stagingRing.transferCommandBuffer();
+    transitionImageLayout(commandBuffer, image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+    copyBufferToImage(commandBuffer, staging.buffer, staging.offset, image, width, height);
+    stagingRing.releaseImage(image, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_SHADER_READ_BIT,
+                             VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, mipLevels);
+}
+
+void *Texture::createTextureImage(unsigned int imageWidth, unsigned int imageHeight, bool exportMemory)
+{
+    VkDeviceSize imageSize = VkDeviceSize(imageWidth) * imageHeight * 4;
+    mipLevels = 1;
+
+    StagingRing &stagingRing = *vulkanData_.stagingRing;
+    StagingRing::Region staging = stagingRing.allocate(imageSize);
 
     VkImageCreateInfo imageInfo = {};
     imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -988,23 +1036,24 @@ void Texture::createTextureImage(unsigned int imageWidth, unsigned int imageHeig
     imageCreateInfo.extent = {imageWidth, imageHeight, 1};
     imageCreateInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
 
-    image = createImage(vulkanData_, imageCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, memory, true);
+    image = createImage(vulkanData_, imageCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, allocation, exportMemory);
+    memory = allocation.memory;
 
     VkMemoryRequirements vkMemoryRequirements = {};
     vkGetImageMemoryRequirements(vulkanData_.device, image, &vkMemoryRequirements);
     totalImageMemSize = vkMemoryRequirements.size;
 
-    transitionImageLayout(vulkanData_, image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
-
-    copyBufferToImage(vulkanData_,
-                       stagingBuffer, image, static_cast<uint32_t>(imageWidth), static_cast<uint32_t>(imageWidth));
+    // Recorded into the staging ring's batch; the image is ready once the ring has submitted it. With a single mip
+    // level there is nothing to blit, so the whole upload runs on the transfer queue.
+    VkCommandBuffer commandBuffer = stagingRing.transferCommandBuffer();
+    transitionImageLayout(commandBuffer, image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
 
-    
-
-    vkDestroyBuffer(vulkanData_.device, stagingBuffer, nullptr);
-    vkFreeMemory(vulkanData_.device, stagingBufferMemory, nullptr);
+    copyBufferToImage(commandBuffer,
+                      staging.buffer, staging.offset, image, static_cast<uint32_t>(imageWidth), static_cast<uint32_t>(imageHeight));
 
-    generateMipmaps(vulkanData_, image, VK_FORMAT_R8G8B8A8_UNORM, imageWidth, imageHeight, mipLevels);
+    // Sampled by the fragment shader and, with --preprocess=vulkan, by PreprocessPass.
+    stagingRing.releaseImage(image, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_SHADER_READ_BIT,
+                             VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, mipLevels);
 
     // Create a default sampler
     VkSamplerCreateInfo samplerCreateInfo = {};
@@ -1043,6 +1092,7 @@ void Texture::createTextureImage(unsigned int imageWidth, unsigned int imageHeig
 
     // Update descriptor image info member that can be used for setting up descriptor sets
     updateDescriptor();
+    return staging.data;
 }
 
 void Texture::updateDescriptor()
@@ -16,6 +16,8 @@
 
 #include "Context.h"
 #include "MemoryManager.h"
+#include "PnmLoader.h"
+#include "ThreadPool.h"
 
 #include <ktx.h>
 #include <ktxvulkan.h>
@@ -34,10 +36,21 @@ public:
     void loadImage(const VulkanData &vulkanData, void *buffer, VkDeviceSize bufferSize, int width, int height, uint32_t mipLevel);
     void emptyTexture(const VulkanData &vulkanData);
     void empty3DTexture(const VulkanData &vulkanData, unsigned char *buffer);
-    void loadImageData(const std::string &filePath, VulkanData &vulkanData,  cudaTextureObject_t& textureObjMipMapInput, 
-                       std::function<void(unsigned int, unsigned int, unsigned int, size_t, VkDeviceMemory &, cudaTextureObject_t&)> importImageMemFunc);
+    // Records the upload of a PPM or PGM file into vulkanData.stagingRing; the image holds the pixels once the ring's
+    // batch has executed. exportMemory gives the image its own exportable allocation for CUDA to import. The pixels
+    // are decoded straight into the staging ring and the file is unmapped afterwards; image_data only keeps a host copy
+    // when keepHostCopy is set.
+    void loadImageData(const std::string &filePath, VulkanData &vulkanData, bool exportMemory, bool keepHostCopy = false);
+    // The same for one file per texture, with the files decoded on the pool while the next uploads are set up.
+    static void loadImageData(std::vector<Texture> &textures, const std::vector<std::string> &filePaths, VulkanData &vulkanData, bool exportMemory,
+                              bool keepHostCopy, ThreadPool &pool);
+    // Overwrites a texture created by loadImageData() with width x height RGBA8 pixels, recorded into the staging
+    // ring like the initial upload. The image keeps its memory, so CUDA's import of it stays valid. The caller makes
+    // sure no submitted work still reads the image.
+    void updateImageData(const unsigned char *pixels);
     VkImage image;
-    VkDeviceMemory memory;
+    VkDeviceMemory memory = VK_NULL_HANDLE; // allocation.memory, kept for the CUDA import
+    MemoryAllocation allocation; // Owns the image memory; every load path allocates through vulkanData.allocator
     VkImageView view;
     VkSampler sampler;
     VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;
@@ -52,13 +65,21 @@ public:
     uint32_t depth = 4;
     size_t totalImageMemSize;
     VkImageLayout imageLayout;
-    unsigned int *image_data = NULL;
+    unsigned int *image_data = NULL; // Host copy of the pixels, see loadImageData(); freed by cleanUp()
+    size_t hostPixelBytes() const { return image_data ? size_t(width) * height * 4 : 0; }
+    // Frees the host copy once nothing reads it any more; the image itself is untouched.
+    void releaseHostPixels();
     std::string execution_path;
 
 private:
     // void copyBufferToImage(VkBuffer buffer, std::vector<VkBufferImageCopy> bufferCopyRegions);
     ktxResult loadKTXFile(std::string filename, ktxTexture **target);
-    void createTextureImage(unsigned int imageWidth, unsigned int imageHeight);
+    // Exits when the file cannot be found or read, like the loaders above.
+    void openImageFile(const std::string &filePath, Pnm::Image &file, bool keepHostCopy);
+    // Safe to run on any thread; only touches the staging region and image_data, if there is one.
+    void decodeImage(const Pnm::Image &file, void *staging);
+    // Returns the staging region the caller fills with the pixels before the ring's batch is submitted.
+    void *createTextureImage(unsigned int imageWidth, unsigned int imageHeight, bool exportMemory);
 };
 
 #endif // TEXTURE_H
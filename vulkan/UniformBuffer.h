@@ -18,7 +18,7 @@ public:
     void updateData(const T& data);
     void cleanUp();
     VkBuffer buffers;
-    VkDeviceMemory memory;
+    MemoryAllocation memory;
     void* mapped;
     VkDescriptorBufferInfo descriptor{} ;
     VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
@@ -39,7 +39,7 @@ void UniformBuffer<T>::init(const VulkanData &vulkanData)
 
     createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, buffers, memory);
 
-    vkMapMemory(vulkanData_.device, memory, 0, bufferSize, 0, &mapped);
+    mapped = memory.mapped;
 
     setupDescriptor(0);
 
@@ -58,8 +58,7 @@ template <typename T>
 void UniformBuffer<T>::cleanUp()
 {
     vkDeviceWaitIdle(vulkanData_.device);  // Ensure no operations are pending
-    vkDestroyBuffer(vulkanData_.device, buffers, nullptr);
-    vkFreeMemory(vulkanData_.device, memory, nullptr);
+    destroyBuffer(buffers, memory);
 }
 
 
@@ -4,6 +4,7 @@
 
 #include "Initializers.h"
 #include "HelperFunctions.h"
+#include "StagingRing.h"
 
 #include <imgui_impl_vulkan.h>
 
@@ -34,9 +35,10 @@ UserInterface::UserInterface()
 
 }
 
-void UserInterface::init(const VulkanData& renderData)
+void UserInterface::init(const VulkanData& renderData, uint32_t framesInFlight)
 {
     vulkanData_ = renderData;
+    frames.resize(framesInFlight);
 }
 
 UserInterface::~UserInterface()
@@ -184,15 +186,11 @@ void UserInterface::prepareResources()
 
     fontView = createImageView(vulkanData_.device, viewInfo);
 
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    // The buffer should be in host visible memory so that we can map it and it should be usable as a transfer source
-    createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
-
-    void* data;
-    vkMapMemory(vulkanData_.device, stagingBufferMemory, 0 , bufferSize, 0, &data);
-    memcpy(data, fontData, static_cast<size_t>(bufferSize));
-    vkUnmapMemory(vulkanData_.device, stagingBufferMemory);
+    // The font goes up through the staging ring together with the other startup uploads.
+    StagingRing &stagingRing = *vulkanData_.stagingRing;
+    StagingRing::Region staging = stagingRing.allocate(bufferSize);
+    memcpy(staging.data, fontData, static_cast<size_t>(bufferSize));
+    VkCommandBuffer commandBuffer = stagingRing.transferCommandBuffer();
 
     // Copy buffer data to font image
     // VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
@@ -202,29 +200,22 @@ void UserInterface::prepareResources()
     subresourceRange.levelCount = 1;
     subresourceRange.layerCount = 1;
 
-    transitionImageLayout(vulkanData_, fontImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,  VK_PIPELINE_STAGE_HOST_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+    transitionImageLayout(commandBuffer, fontImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,  VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
 
     // Copy
     VkBufferImageCopy bufferCopyRegion = {};
+    bufferCopyRegion.bufferOffset = staging.offset;
     bufferCopyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
     bufferCopyRegion.imageSubresource.layerCount = 1;
     bufferCopyRegion.imageExtent.width = texWidth;
     bufferCopyRegion.imageExtent.height = texHeight;
     bufferCopyRegion.imageExtent.depth = 1;
 
-    std::vector<VkBufferImageCopy> bufferCopyRegions;
-
-    bufferCopyRegions.push_back(bufferCopyRegion);
-
-    copyBufferToImage(vulkanData_, fontImage ,stagingBuffer, bufferCopyRegions);
+    vkCmdCopyBufferToImage(commandBuffer, staging.buffer, fontImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &bufferCopyRegion);
 
-       // Prepare for shader read
+       // Prepare for shader read, on the graphics queue
 
-    transitionImageLayout(vulkanData_, fontImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,  VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
-
-
-    vkDestroyBuffer(vulkanData_.device, stagingBuffer, nullptr);
-    vkFreeMemory(vulkanData_.device, stagingBufferMemory, nullptr);
+    stagingRing.releaseImage(fontImage, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
 
     // Font texture Sampler
     VkSamplerCreateInfo samplerInfo = initializers::samplerCreateInfo();
@@ -265,9 +256,13 @@ void UserInterface::prepareResources()
 
 }
 
-bool UserInterface::update()
+bool UserInterface::update(uint32_t frameIndex)
 {
     ImDrawData* imDrawData = ImGui::GetDrawData();
+    Buffer& vertexBuffer = frames[frameIndex].vertexBuffer;
+    Buffer& indexBuffer = frames[frameIndex].indexBuffer;
+    int32_t& vertexCount = frames[frameIndex].vertexCount;
+    int32_t& indexCount = frames[frameIndex].indexCount;
     bool updateCmdBuffers = false;
 
     if (!imDrawData) { return false; };
@@ -317,12 +312,12 @@ bool UserInterface::update()
     return updateCmdBuffers;
 }
 
-void UserInterface::draw(const VkCommandBuffer commandBuffer)
+void UserInterface::draw(const VkCommandBuffer commandBuffer, uint32_t frameIndex)
 {
     ImDrawData* imDrawData = ImGui::GetDrawData();
     int32_t vertexOffset = 0;
     int32_t indexOffset = 0;
-    if ((!imDrawData) || (imDrawData->CmdListsCount == 0)) {
+    if ((!imDrawData) || (imDrawData->CmdListsCount == 0) || (frames[frameIndex].vertexBuffer.buffer == VK_NULL_HANDLE)) {
         return;
     }
 
@@ -336,8 +331,8 @@ void UserInterface::draw(const VkCommandBuffer commandBuffer)
     vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(PushConstBlock), &pushConstBlock);
 
     VkDeviceSize offsets[1] = { 0 };
-    vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertexBuffer.buffer, offsets);
-    vkCmdBindIndexBuffer(commandBuffer, indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT16);
+    vkCmdBindVertexBuffers(commandBuffer, 0, 1, &frames[frameIndex].vertexBuffer.buffer, offsets);
+    vkCmdBindIndexBuffer(commandBuffer, frames[frameIndex].indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT16);
 
     for (int32_t i = 0; i < imDrawData->CmdListsCount; i++)
     {
@@ -456,11 +451,13 @@ void UserInterface::text(const char *formatstr, ...)
 void UserInterface::cleanUp()
 {
 
-    vertexBuffer.cleanUp();
-    indexBuffer.cleanUp();
+    for (FrameGeometry& frame : frames) {
+        frame.vertexBuffer.cleanUp();
+        frame.indexBuffer.cleanUp();
+    }
     vkDestroyImageView(vulkanData_.device, fontView, nullptr);
     vkDestroyImage(vulkanData_.device, fontImage, nullptr);
-    vkFreeMemory(vulkanData_.device, fontMemory, nullptr);
+    vulkanData_.allocator->free(fontMemory);
     vkDestroySampler(vulkanData_.device, sampler, nullptr);
     vkDestroyDescriptorSetLayout(vulkanData_.device, descriptorSetLayout, nullptr);
     vkDestroyDescriptorPool(vulkanData_.device, descriptorPool, nullptr);
@@ -8,7 +8,7 @@ class UserInterface: public MemoryManager
 {
 public:
     UserInterface();
-    void init(const VulkanData &renderData);
+    void init(const VulkanData &renderData, uint32_t framesInFlight = 1);
     ~UserInterface();
 public:
     VkQueue queue{ VK_NULL_HANDLE };
@@ -16,11 +16,15 @@ public:
     VkSampleCountFlagBits rasterizationSamples{ VK_SAMPLE_COUNT_1_BIT };
     uint32_t subpass{ 0 };
 
-    Buffer vertexBuffer;
-    Buffer indexBuffer;
-
-    int32_t vertexCount{ 0 };
-    int32_t indexCount{ 0 };
+    // One set of geometry buffers per frame in flight, so the overlay of frame N+1 can be written while the GPU
+    // still reads the one of frame N.
+    struct FrameGeometry {
+        Buffer vertexBuffer;
+        Buffer indexBuffer;
+        int32_t vertexCount{ 0 };
+        int32_t indexCount{ 0 };
+    };
+    std::vector<FrameGeometry> frames;
 
     std::vector<VkPipelineShaderStageCreateInfo> shaders;
 
@@ -30,7 +34,7 @@ public:
     VkPipelineLayout pipelineLayout{ VK_NULL_HANDLE };
     VkPipeline pipeline{ VK_NULL_HANDLE };
 
-    VkDeviceMemory fontMemory{ VK_NULL_HANDLE };
+    MemoryAllocation fontMemory;
     VkImage fontImage{ VK_NULL_HANDLE };
     VkImageView fontView{ VK_NULL_HANDLE };
     VkSampler sampler{ VK_NULL_HANDLE };
@@ -48,8 +52,8 @@ public:
     void preparePipeline(const VkPipelineCache pipelineCache, const VkRenderPass renderPass, const VkFormat colorFormat, const VkFormat depthFormat);
     void prepareResources();
 
-    bool update();
-    void draw(const VkCommandBuffer commandBuffer);
+    bool update(uint32_t frameIndex);
+    void draw(const VkCommandBuffer commandBuffer, uint32_t frameIndex);
     void resize(uint32_t width, uint32_t height);
 
     void freeResources();